@@ -0,0 +1,286 @@
+#!/usr/bin/env python3
+"""Distill the exported actor into smaller students.
+
+Students are trained on states recorded by a production infer
+(`infer --record FILE`), regressing the teacher's actions that come with
+them. Each student is exported in the layout infer loads (input `s0`,
+`Actor_is_training`, output `actor/Mul`), then benchmarked with
+`infer --benchmark`. The report puts the action error of every student next
+to its batch inference latency, so the cheapest acceptable policy can be
+picked.
+"""
+
+import argparse
+import csv
+import json
+import os
+import subprocess
+from os import path
+
+import numpy as np
+import tensorflow as tf
+
+import context
+
+from agent.agent import Actor
+from agent.definitions import STATE_DIM, ACTION_DIM
+from helpers.logger import logger
+
+tf.compat.v1.logging.set_verbosity(tf.compat.v1.logging.ERROR)
+
+config_path = path.abspath(path.join(path.dirname(__file__), "astraea.json"))
+repo_dir = path.abspath(path.join(path.dirname(__file__), os.pardir))
+teacher_path = path.join(repo_dir, "models", "exported", "model")
+infer_path = path.join(repo_dir, "src", "build", "bin", "infer")
+
+
+def load_records(files, input_size):
+    """Records are input_size float32 inputs followed by the float32 action."""
+    data = np.concatenate([np.fromfile(f, dtype=np.float32) for f in files])
+    if data.size % (input_size + 1) != 0:
+        raise ValueError("record files are truncated or of another input size")
+    data = data.reshape(-1, input_size + 1)
+    return data[:, :input_size], data[:, input_size:]
+
+
+def teacher_actions(model_prefix, states, batch=4096):
+    """Re-run the teacher, for recordings made with another model."""
+    graph = tf.Graph()
+    with graph.as_default(), tf.Session(graph=graph) as sess:
+        saver = tf.train.import_meta_graph(model_prefix + ".meta")
+        saver.restore(sess, model_prefix)
+        actions = [
+            sess.run(
+                "actor/Mul:0",
+                {"s0:0": states[i : i + batch], "Actor_is_training:0": False},
+            )
+            for i in range(0, len(states), batch)
+        ]
+    return np.concatenate(actions)
+
+
+def build_actor(h1, h2, input_size):
+    # same names as the training graph, infer feeds and fetches them
+    s0 = tf.placeholder(tf.float32, shape=[None, input_size], name="s0")
+    is_training = tf.placeholder(tf.bool, name="Actor_is_training")
+    actor = Actor(ACTION_DIM, h1, h2, name="actor")
+    return s0, is_training, actor.build(s0, is_training)
+
+
+def train_student(h1, h2, train, val, args):
+    """Fit a student, return its variables and its actions on val."""
+    (x_train, y_train), (x_val, _) = train, val
+    input_size = x_train.shape[1]
+    graph = tf.Graph()
+    with graph.as_default(), tf.Session(graph=graph) as sess:
+        s0, is_training, out = build_actor(h1, h2, input_size)
+        target = tf.placeholder(tf.float32, shape=[None, ACTION_DIM])
+        loss = tf.reduce_mean(tf.square(out - target))
+        # batch normalization keeps its moving averages in UPDATE_OPS
+        with tf.control_dependencies(tf.get_collection(tf.GraphKeys.UPDATE_OPS)):
+            train_op = tf.train.AdamOptimizer(args.lr).minimize(loss)
+        sess.run(tf.global_variables_initializer())
+
+        rng = np.random.default_rng(args.seed)
+        for epoch in range(args.epochs):
+            order = rng.permutation(len(x_train))
+            for i in range(0, len(order), args.batch_size):
+                idx = order[i : i + args.batch_size]
+                sess.run(
+                    train_op,
+                    {s0: x_train[idx], target: y_train[idx], is_training: True},
+                )
+            val_loss = sess.run(
+                loss, {s0: x_val, target: val[1], is_training: False}
+            )
+            logger.info(
+                "student {}x{} epoch {}: val mse {:.6f}".format(
+                    h1, h2, epoch, val_loss
+                )
+            )
+
+        actor_vars = tf.get_collection(tf.GraphKeys.GLOBAL_VARIABLES, scope="actor")
+        weights = {v.name: sess.run(v) for v in actor_vars}
+        params = sum(
+            int(np.prod(v.shape.as_list()))
+            for v in tf.get_collection(tf.GraphKeys.TRAINABLE_VARIABLES, scope="actor")
+        )
+        predicted = sess.run(out, {s0: x_val, is_training: False})
+    return weights, params, predicted
+
+
+def export_student(h1, h2, input_size, weights, model_prefix):
+    """Save a graph holding nothing but the actor, like models/exported."""
+    graph = tf.Graph()
+    with graph.as_default(), tf.Session(graph=graph) as sess:
+        build_actor(h1, h2, input_size)
+        for v in tf.global_variables():
+            v.load(weights[v.name], sess)
+        tf.train.Saver(tf.global_variables()).save(sess, model_prefix)
+
+
+def multiplier(action):
+    """cwnd multiplier of an action, as map_action in feature.cc applies it"""
+    return np.where(action >= 0, 1 + 0.025 * action, 1 / (1 - 0.025 * action))
+
+
+def action_error(predicted, teacher):
+    err = np.abs(predicted - teacher)
+    cwnd_err = np.abs(multiplier(predicted) / multiplier(teacher) - 1) * 100
+    return {
+        "action_mae": float(np.mean(err)),
+        "action_p99": float(np.percentile(err, 99)),
+        "cwnd_err_mean_pct": float(np.mean(cwnd_err)),
+        "cwnd_err_p99_pct": float(np.percentile(cwnd_err, 99)),
+    }
+
+
+def benchmark(infer_bin, model_prefix):
+    """Per-batch latency of the model in infer, keyed by batch size."""
+    result = subprocess.run(
+        [
+            infer_bin,
+            "--graph",
+            model_prefix + ".meta",
+            "--checkpoint",
+            model_prefix,
+            "--benchmark",
+        ],
+        stdout=subprocess.PIPE,
+        universal_newlines=True,
+        check=True,
+    )
+    latency = {}
+    for line in result.stdout.splitlines():
+        if line.startswith("{"):
+            row = json.loads(line)
+            latency[row["batch"]] = row
+    return latency
+
+
+def parse_widths(text):
+    widths = []
+    for spec in text.split(","):
+        h1, h2 = spec.lower().split("x")
+        widths.append((int(h1), int(h2)))
+    return widths
+
+
+def write_report(rows, out_dir):
+    batches = sorted({b for row in rows for b in row.get("latency", {})})
+    columns = [
+        "model",
+        "h1",
+        "h2",
+        "params",
+        "action_mae",
+        "action_p99",
+        "cwnd_err_mean_pct",
+        "cwnd_err_p99_pct",
+    ] + ["p50_us@{}".format(b) for b in batches]
+
+    table = []
+    for row in rows:
+        line = {c: row.get(c, "") for c in columns}
+        for b in batches:
+            if b in row.get("latency", {}):
+                line["p50_us@{}".format(b)] = row["latency"][b]["p50_us"]
+        table.append(line)
+
+    with open(path.join(out_dir, "report.csv"), "w") as f:
+        writer = csv.DictWriter(f, fieldnames=columns)
+        writer.writeheader()
+        writer.writerows(table)
+    with open(path.join(out_dir, "report.json"), "w") as f:
+        json.dump(rows, f, indent=2)
+
+    def fmt(value):
+        return "{:.4g}".format(value) if isinstance(value, float) else str(value)
+
+    width = max(len(c) for c in columns) + 2
+    print("".join(c.rjust(width) for c in columns))
+    for line in table:
+        print("".join(fmt(line[c]).rjust(width) for c in columns))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument(
+        "--records", nargs="+", required=True, help="files written by infer --record"
+    )
+    parser.add_argument(
+        "--widths",
+        type=str,
+        default="128x64,64x32,32x16,16x8",
+        help="student h1xh2 widths, comma separated (h3 is h2/2 as in Actor)",
+    )
+    parser.add_argument("--out-dir", type=str, default="distilled")
+    parser.add_argument(
+        "--config", type=str, default=config_path, help="configuration file"
+    )
+    parser.add_argument(
+        "--teacher",
+        type=str,
+        default=teacher_path,
+        help="teacher checkpoint prefix, benchmarked as the reference",
+    )
+    parser.add_argument(
+        "--relabel",
+        action="store_true",
+        help="recompute actions with --teacher instead of the recorded ones",
+    )
+    parser.add_argument("--infer-bin", type=str, default=infer_path)
+    parser.add_argument(
+        "--no-benchmark", action="store_true", help="only report action errors"
+    )
+    parser.add_argument("--epochs", type=int, default=20)
+    parser.add_argument("--batch-size", type=int, default=256)
+    parser.add_argument("--lr", type=float, default=1e-3)
+    parser.add_argument("--val-split", type=float, default=0.1)
+    parser.add_argument("--seed", type=int, default=0)
+    args = parser.parse_args()
+
+    with open(args.config) as f:
+        config = json.load(f)
+    input_size = STATE_DIM * config["rec_dim"]
+
+    states, actions = load_records(args.records, input_size)
+    if args.relabel:
+        actions = teacher_actions(args.teacher, states)
+    logger.info("loaded {} recorded states".format(len(states)))
+
+    # hold out the most recent records, closer to what production sees next
+    n_val = max(1, int(len(states) * args.val_split))
+    train = (states[:-n_val], actions[:-n_val])
+    val = (states[-n_val:], actions[-n_val:])
+    os.makedirs(args.out_dir, exist_ok=True)
+
+    rows = []
+    if not args.no_benchmark and path.exists(args.teacher + ".meta"):
+        rows.append(
+            {
+                "model": "teacher",
+                "h1": config["h1_shape"],
+                "h2": config["h2_shape"],
+                "latency": benchmark(args.infer_bin, args.teacher),
+            }
+        )
+    for h1, h2 in parse_widths(args.widths):
+        weights, params, predicted = train_student(h1, h2, train, val, args)
+        model_dir = path.join(args.out_dir, "student_{}x{}".format(h1, h2))
+        os.makedirs(model_dir, exist_ok=True)
+        model_prefix = path.join(model_dir, "model")
+        export_student(h1, h2, input_size, weights, model_prefix)
+        logger.info("exported {}".format(model_prefix))
+
+        row = {"model": model_prefix, "h1": h1, "h2": h2, "params": params}
+        row.update(action_error(predicted, val[1]))
+        if not args.no_benchmark:
+            row["latency"] = benchmark(args.infer_bin, model_prefix)
+        rows.append(row)
+
+    write_report(rows, args.out_dir)
+
+
+if __name__ == "__main__":
+    main()
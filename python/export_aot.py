@@ -0,0 +1,80 @@
+#!/usr/bin/env python3
+"""Freeze the exported actor for tfcompile.
+
+Writes actor.pb, the actor with its variables turned into constants and
+Actor_is_training fixed to false, and actor_b<N>.config.pbtxt, the feed and
+fetch of the function compiled for batches of N. Used by
+scripts/build_aot_actor.sh.
+"""
+
+import argparse
+import os
+from os import path
+
+import tensorflow as tf
+
+import context
+
+from agent.definitions import STATE_DIM
+
+# keep in sync with src/inference/aot/BUILD and ActorAot::batch_sizes()
+BATCH_SIZES = [1, 8, 32, 128, 512]
+
+CONFIG = """feed {{
+  id {{ node_name: "s0" }}
+  shape {{
+    dim {{ size: {batch} }}
+    dim {{ size: {input_size} }}
+  }}
+}}
+fetch {{
+  id {{ node_name: "actor/Mul" }}
+}}
+"""
+
+
+def freeze(model_prefix):
+    graph = tf.Graph()
+    with graph.as_default(), tf.Session(graph=graph) as sess:
+        saver = tf.train.import_meta_graph(model_prefix + ".meta")
+        saver.restore(sess, model_prefix)
+        frozen = tf.graph_util.convert_variables_to_constants(
+            sess, graph.as_graph_def(), ["actor/Mul"]
+        )
+
+    # tfcompile feeds s0 only, batch normalization always in inference mode
+    graph = tf.Graph()
+    with graph.as_default():
+        not_training = tf.constant(False, name="not_training")
+        tf.import_graph_def(
+            frozen, input_map={"Actor_is_training:0": not_training}, name=""
+        )
+        return tf.graph_util.extract_sub_graph(
+            graph.as_graph_def(), ["actor/Mul"]
+        )
+
+
+def main():
+    repo_dir = path.abspath(path.join(path.dirname(__file__), os.pardir))
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument(
+        "--model",
+        type=str,
+        default=path.join(repo_dir, "models", "exported", "model"),
+        help="checkpoint prefix of the exported model",
+    )
+    parser.add_argument("--out-dir", type=str, required=True)
+    parser.add_argument("--rec-dim", type=int, default=5)
+    args = parser.parse_args()
+
+    os.makedirs(args.out_dir, exist_ok=True)
+    with open(path.join(args.out_dir, "actor.pb"), "wb") as f:
+        f.write(freeze(args.model).SerializeToString())
+    for batch in BATCH_SIZES:
+        config = path.join(args.out_dir, "actor_b{}.config.pbtxt".format(batch))
+        with open(config, "w") as f:
+            f.write(CONFIG.format(batch=batch, input_size=STATE_DIM * args.rec_dim))
+
+
+if __name__ == "__main__":
+    main()
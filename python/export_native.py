@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+"""Write the exported actor's weights for infer's native backend.
+
+Each batch normalization (inference mode, no scale) is folded into the dense
+layer before it, so infer only evaluates matrix products, biases and
+activations. The weights go to <model>.native.json, where
+`infer --backend=native` looks for them.
+"""
+
+import argparse
+import json
+import os
+from os import path
+
+import numpy as np
+import tensorflow as tf
+
+import context
+
+# tf.layers names of the actor in agent.agent.Actor, batch_normalization is
+# None for the output layer
+LAYERS = [
+    ("fc1", "batch_normalization"),
+    ("fc2", "batch_normalization_1"),
+    ("fc3", "batch_normalization_2"),
+    ("dense", None),
+]
+# tf.layers.batch_normalization and tf.nn.leaky_relu defaults
+BN_EPSILON = 1e-3
+LEAKY_RELU_ALPHA = 0.2
+
+
+def export(model_prefix, scope="actor"):
+    graph = tf.Graph()
+    with graph.as_default(), tf.Session(graph=graph) as sess:
+        saver = tf.train.import_meta_graph(model_prefix + ".meta")
+        saver.restore(sess, model_prefix)
+
+        def fetch(name):
+            return sess.run(graph.get_tensor_by_name(scope + "/" + name + ":0"))
+
+        layers = []
+        for dense, bn in LAYERS:
+            kernel = fetch(dense + "/kernel")
+            bias = fetch(dense + "/bias")
+            if bn is not None:
+                scale = 1 / np.sqrt(fetch(bn + "/moving_variance") + BN_EPSILON)
+                kernel = kernel * scale
+                bias = (bias - fetch(bn + "/moving_mean")) * scale + fetch(
+                    bn + "/beta"
+                )
+            layers.append(
+                {
+                    "units": int(kernel.shape[1]),
+                    "activation": "leaky_relu" if bn is not None else "tanh",
+                    "alpha": LEAKY_RELU_ALPHA,
+                    # one row of units per input, as tf.layers keeps it
+                    "weights": kernel.astype(np.float32).ravel().tolist(),
+                    "bias": bias.astype(np.float32).tolist(),
+                }
+            )
+        action_scale = float(fetch("Mul/y"))
+    return {"action_scale": action_scale, "layers": layers}
+
+
+def main():
+    repo_dir = path.abspath(path.join(path.dirname(__file__), os.pardir))
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument(
+        "--model",
+        type=str,
+        default=path.join(repo_dir, "models", "exported", "model"),
+        help="checkpoint prefix of the exported model",
+    )
+    args = parser.parse_args()
+
+    out = args.model + ".native.json"
+    with open(out, "w") as f:
+        json.dump(export(args.model), f)
+    print("Wrote", out)
+
+
+if __name__ == "__main__":
+    main()
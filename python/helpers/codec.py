@@ -0,0 +1,55 @@
+import struct
+
+from . import context
+
+
+class StructCodec(object):
+    """Fixed-layout binary codec for a flat record of named fields.
+
+    `fmt` is a struct format string and `fields` names every non-padding
+    item in it, in order. Decoding works directly on memoryviews, so it can
+    be fed with IPCSocket.read_view() without any intermediate copy.
+    """
+
+    def __init__(self, fmt, fields):
+        self.struct = struct.Struct(fmt)
+        self.fields = tuple(fields)
+        if len(self.struct.unpack(bytes(self.struct.size))) != len(self.fields):
+            raise ValueError("StructCodec: fields do not match format {}".format(fmt))
+
+    @property
+    def size(self):
+        return self.struct.size
+
+    def encode(self, record: dict) -> bytes:
+        return self.struct.pack(*(record[name] for name in self.fields))
+
+    def encode_into(self, buffer, offset, record: dict):
+        self.struct.pack_into(buffer, offset, *(record[name] for name in self.fields))
+        return offset + self.struct.size
+
+    def decode(self, buffer, offset=0) -> dict:
+        return dict(zip(self.fields, self.struct.unpack_from(buffer, offset)))
+
+
+# struct TCPDeepCCInfo in src/net/tcp_info.hh, as returned by
+# getsockopt(TCP_DEEPCC_INFO); field names follow TCPDeepCCInfo::to_json()
+DEEPCC_INFO_CODEC = StructCodec(
+    "<3I4xQ10I",
+    (
+        "min_rtt",
+        "avg_urtt",
+        "cnt",
+        "avg_thr",
+        "thr_cnt",
+        "cwnd",
+        "pacing_rate",
+        "loss_bytes",
+        "srtt_us",
+        "snd_ssthresh",
+        "packets_out",
+        "retrans_out",
+        "max_packets_out",
+        "mss_cache",
+    ),
+)
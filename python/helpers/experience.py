@@ -0,0 +1,394 @@
+"""
+Experience transport between actors and the learner.
+
+Actors batch (s0, g0, a, r, s1, g1, terminal) tuples into columnar float32
+blocks and stream them to the learner over TCP. The learner hands out one
+credit per block it is willing to buffer and returns a credit whenever it
+consumes a block, so the sending rate follows the learner. An actor without
+credit keeps a bounded backlog and drops its oldest blocks; it never blocks.
+
+Wire format (network byte order for headers, little-endian float32 data):
+    frame  := u32 frame_len | block header | payload
+    block  := magic "AEXP" | u8 version | u8 flags | u16 reserved
+              | u32 rows | u16 s_dim | u16 g_dim | u16 a_dim
+    payload:= s0 | g0 | a | r | s1 | g1 | terminal  (each rows x dim)
+    credit := magic "ACRD" | u32 credits          (learner -> actor)
+"""
+
+import sys
+import socket
+import struct
+import errno
+import time
+import traceback
+from collections import deque
+
+import numpy as np
+
+try:
+    import lz4.frame as lz4_frame
+except ImportError:
+    lz4_frame = None
+
+from . import context
+from helpers.logger import logger
+from helpers.poller import Poller, Action, PollEvents, ReturnStatus
+
+FRAME = struct.Struct("!I")
+BLOCK = struct.Struct("!4sBBHIHHH")
+CREDIT = struct.Struct("!4sI")
+BLOCK_MAGIC = b"AEXP"
+CREDIT_MAGIC = b"ACRD"
+VERSION = 1
+FLAG_LZ4 = 0x1
+FLOAT = np.dtype("<f4")
+# seconds an actor waits before it tries to reach the learner again
+RETRY_INTERVAL = 0.5
+# largest frame a learner accepts, far above any batch_rows an actor uses
+MAX_FRAME_SIZE = 16 << 20
+
+
+def parse_address(addr):
+    """ "ip:port" as found in astraea.json -> (ip, port)"""
+    ip, port = addr.rsplit(":", 1)
+    return ip, int(port)
+
+
+class ExperienceBlock(object):
+    """Columnar storage of up to `rows` experience tuples"""
+
+    def __init__(self, rows, s_dim, g_dim, a_dim):
+        self.s_dim, self.g_dim, self.a_dim = s_dim, g_dim, a_dim
+        self.widths = [s_dim, g_dim, a_dim, 1, s_dim, g_dim, 1]
+        self.columns = [np.zeros((rows, w), dtype=FLOAT) for w in self.widths]
+        self.length = 0
+
+    @property
+    def capacity(self):
+        return self.columns[0].shape[0]
+
+    def full(self):
+        return self.length == self.capacity
+
+    def append(self, s0, g0, a, r, s1, g1, terminal):
+        for column, value in zip(self.columns, (s0, g0, a, r, s1, g1, terminal)):
+            column[self.length] = value
+        self.length += 1
+
+    def as_tuple(self):
+        """(s0, g0, a, r, s1, g1, terminal) views of the filled rows"""
+        return [column[: self.length] for column in self.columns]
+
+    def encode(self, compress=False):
+        payload = b"".join(
+            column[: self.length].tobytes() for column in self.columns
+        )
+        flags = 0
+        if compress and lz4_frame is not None:
+            payload = lz4_frame.compress(payload)
+            flags |= FLAG_LZ4
+        header = BLOCK.pack(
+            BLOCK_MAGIC,
+            VERSION,
+            flags,
+            0,
+            self.length,
+            self.s_dim,
+            self.g_dim,
+            self.a_dim,
+        )
+        return [FRAME.pack(len(header) + len(payload)), header, payload]
+
+    @staticmethod
+    def decode(frame):
+        """Decode the block carried by `frame` (frame length excluded)"""
+        magic, version, flags, _, rows, s_dim, g_dim, a_dim = BLOCK.unpack_from(frame)
+        if magic != BLOCK_MAGIC or version != VERSION:
+            raise ValueError("ExperienceBlock: bad block header")
+        payload = memoryview(frame)[BLOCK.size :]
+        if flags & FLAG_LZ4:
+            if lz4_frame is None:
+                raise RuntimeError("ExperienceBlock: lz4 is not available")
+            values = np.frombuffer(lz4_frame.decompress(payload), dtype=FLOAT)
+        else:
+            # the receive buffer is reused for the next frame
+            values = np.frombuffer(payload, dtype=FLOAT).copy()
+        block = ExperienceBlock(0, s_dim, g_dim, a_dim)
+        offset = 0
+        block.columns = []
+        for w in block.widths:
+            size = rows * w
+            block.columns.append(values[offset : offset + size].reshape(rows, w))
+            offset += size
+        if offset != len(values):
+            raise ValueError("ExperienceBlock: payload size mismatch")
+        block.length = rows
+        return block
+
+
+class ExperienceSender(object):
+    """Actor side: batch experience and ship it without ever blocking"""
+
+    def __init__(
+        self,
+        learner_addr,
+        s_dim,
+        g_dim,
+        a_dim,
+        batch_rows=256,
+        max_backlog=64,
+        compress=False,
+    ):
+        self.learner_addr = learner_addr
+        self.dims = (s_dim, g_dim, a_dim)
+        self.batch_rows = batch_rows
+        self.compress = compress
+        # sealed blocks waiting for credit; the oldest are dropped when full
+        self.backlog = deque(maxlen=max_backlog)
+        # buffers of the frame currently on the wire
+        self.inflight = []
+        self.credits = 0
+        self.dropped = 0
+        self.sent = 0
+        self.block = ExperienceBlock(batch_rows, *self.dims)
+        self.sock = None
+        # no connection attempt before this time.monotonic()
+        self.retry_at = 0
+        self.credit_buffer = bytearray()
+        # in-process peer, see loopback_pair()
+        self.loopback = None
+
+    def connect(self):
+        sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        sock.setblocking(False)
+        sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        ret = sock.connect_ex(parse_address(self.learner_addr))
+        if ret not in (0, errno.EINPROGRESS):
+            sock.close()
+            self.retry_at = time.monotonic() + RETRY_INTERVAL
+            logger.warning(
+                "ExperienceSender: cannot reach learner {}: {}".format(
+                    self.learner_addr, errno.errorcode.get(ret, ret)
+                )
+            )
+            return False
+        self.sock = sock
+        return True
+
+    def store(self, s0, g0, a, r, s1, g1, terminal):
+        self.block.append(s0, g0, a, r, s1, g1, terminal)
+        if self.block.full():
+            self.seal()
+        self.flush()
+
+    def seal(self):
+        """Close the current block even if it is not full"""
+        if self.block.length == 0:
+            return
+        if len(self.backlog) == self.backlog.maxlen:
+            self.dropped += 1
+        self.backlog.append(self.block.encode(self.compress))
+        self.block = ExperienceBlock(self.batch_rows, *self.dims)
+
+    def flush(self):
+        """Send as many sealed blocks as the learner has granted credit for"""
+        if self.loopback is not None:
+            return self.loopback.flush_sender(self)
+        if self.sock is None:
+            if time.monotonic() < self.retry_at or not self.connect():
+                return 0
+        try:
+            self.__read_credits()
+            sent = 0
+            while True:
+                if not self.inflight:
+                    if self.credits == 0 or not self.backlog:
+                        break
+                    self.inflight = [memoryview(b) for b in self.backlog.popleft()]
+                    self.credits -= 1
+                count = self.sock.sendmsg(self.inflight)
+                sent += count
+                while self.inflight and count >= len(self.inflight[0]):
+                    count -= len(self.inflight.pop(0))
+                if self.inflight:
+                    self.inflight[0] = self.inflight[0][count:]
+                    break
+                self.sent += 1
+            return sent
+        except (BlockingIOError, InterruptedError):
+            return 0
+        except OSError as e:
+            logger.warning("ExperienceSender: connection lost: {}".format(e))
+            self.close()
+            self.retry_at = time.monotonic() + RETRY_INTERVAL
+            return 0
+
+    def __read_credits(self):
+        while True:
+            try:
+                data = self.sock.recv(4096)
+            except (BlockingIOError, InterruptedError):
+                break
+            if data == b"":
+                raise ConnectionResetError("learner closed the connection")
+            self.credit_buffer += data
+        while len(self.credit_buffer) >= CREDIT.size:
+            magic, credits = CREDIT.unpack_from(self.credit_buffer)
+            if magic != CREDIT_MAGIC:
+                raise ValueError("ExperienceSender: bad credit message")
+            self.credits += credits
+            del self.credit_buffer[: CREDIT.size]
+
+    def close(self):
+        if self.sock is not None:
+            self.sock.close()
+            self.sock = None
+        # a partially sent frame cannot be resumed on a new connection
+        self.inflight = []
+        self.credits = 0
+        self.credit_buffer = bytearray()
+
+
+class _Connection(object):
+    def __init__(self, sock, addr):
+        self.sock = sock
+        self.addr = addr
+        self.buffer = bytearray(FRAME.size)
+        self.view = memoryview(self.buffer)
+        self.offset = 0
+        self.reading_header = True
+
+    def grant(self, credits):
+        try:
+            self.sock.send(CREDIT.pack(CREDIT_MAGIC, credits))
+        except OSError as e:
+            logger.warning("ExperienceReceiver: cannot grant credit: {}".format(e))
+
+
+class ExperienceReceiver(object):
+    """Learner side: accept actors, decode blocks and grant credit"""
+
+    def __init__(self, bind_addr, window=8, poller: Poller = None,
+                 max_frame_size=MAX_FRAME_SIZE):
+        self.window = window
+        self.max_frame_size = max_frame_size
+        self.blocks = deque()
+        self.received = 0
+        self.poller = poller if poller is not None else Poller()
+        self.listener = None
+        if bind_addr is not None:
+            self.listener = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+            self.listener.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+            self.listener.bind(parse_address(bind_addr))
+            self.listener.listen(64)
+            self.listener.setblocking(False)
+            self.poller.add_action(
+                Action(self.listener, PollEvents.READ_FLAGS, self.__handle_accept)
+            )
+            logger.info("ExperienceReceiver: listening on {}".format(bind_addr))
+
+    def __handle_accept(self):
+        sock, addr = self.listener.accept()
+        sock.setblocking(False)
+        sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        conn = _Connection(sock, addr)
+        self.poller.add_action(
+            Action(
+                sock,
+                PollEvents.READ_ERR_FLAGS,
+                lambda: self.__handle_read(conn),
+                lambda: sock.close(),
+            )
+        )
+        self.grant(conn, self.window)
+        logger.info("ExperienceReceiver: actor {} connected".format(addr))
+        return ReturnStatus.Continue
+
+    def __handle_read(self, conn: _Connection):
+        while True:
+            try:
+                count = conn.sock.recv_into(conn.view[conn.offset :])
+            except (BlockingIOError, InterruptedError):
+                return ReturnStatus.Continue
+            if count == 0:
+                logger.info("ExperienceReceiver: actor {} left".format(conn.addr))
+                conn.sock.close()
+                return ReturnStatus.Cancel
+            conn.offset += count
+            if conn.offset < len(conn.view):
+                continue
+            if conn.reading_header:
+                frame_len = FRAME.unpack_from(conn.buffer)[0]
+                if frame_len > self.max_frame_size:
+                    # never size a buffer after an unchecked header
+                    logger.warning(
+                        "ExperienceReceiver: drop actor {}: frame of {} bytes".format(
+                            conn.addr, frame_len
+                        )
+                    )
+                    conn.sock.close()
+                    return ReturnStatus.Cancel
+                if frame_len > len(conn.buffer):
+                    conn.buffer = bytearray(frame_len)
+                conn.view = memoryview(conn.buffer)[:frame_len]
+                conn.reading_header = False
+            else:
+                self.blocks.append((conn, ExperienceBlock.decode(conn.view)))
+                self.received += 1
+                conn.view = memoryview(conn.buffer)[: FRAME.size]
+                conn.reading_header = True
+            conn.offset = 0
+
+    def grant(self, conn, credits):
+        if credits > 0:
+            conn.grant(credits)
+
+    def poll(self, timeout=0):
+        self.poller.poll_once(timeout)
+
+    def consume(self, max_blocks=None):
+        """Pop decoded blocks; every consumed block returns one credit"""
+        out = []
+        while self.blocks and (max_blocks is None or len(out) < max_blocks):
+            conn, block = self.blocks.popleft()
+            out.append(block)
+            self.grant(conn, 1)
+        return out
+
+    def drain_into(self, agent, max_blocks=None):
+        """Push received experience into the agent's replay buffer"""
+        rows = 0
+        for block in self.consume(max_blocks):
+            agent.store_many_experience(*block.as_tuple(), block.length)
+            rows += block.length
+        return rows
+
+
+class _Loopback(object):
+    def __init__(self, receiver: ExperienceReceiver, window):
+        self.receiver = receiver
+        self.credits = window
+
+    def grant(self, credits):
+        self.credits += credits
+
+    def flush_sender(self, sender: ExperienceSender):
+        sent = 0
+        while self.credits > 0 and sender.backlog:
+            frame = b"".join(sender.backlog.popleft())
+            # go through the same codec as the TCP path
+            self.receiver.blocks.append((self, ExperienceBlock.decode(frame[FRAME.size :])))
+            self.receiver.received += 1
+            self.credits -= 1
+            sender.sent += 1
+            sent += len(frame)
+        return sent
+
+
+def loopback_pair(s_dim, g_dim, a_dim, window=8, **kwargs):
+    """In-process sender/receiver pair for tests and single-host training"""
+    receiver = ExperienceReceiver(None, window=window)
+    sender = ExperienceSender(None, s_dim, g_dim, a_dim, **kwargs)
+    loopback = _Loopback(receiver, window)
+    sender.loopback = loopback
+    return sender, receiver
@@ -12,6 +12,13 @@ from queue import Queue
 from . import context
 from helpers.logger import logger as logger
 
+# header length in unsigned short, the same as put_field() in C++
+HEADER = struct.Struct("!H")
+# a message can never exceed the 16-bit length header
+MAX_MESSAGE_LEN = 0xFFFF
+# at most this many buffers are handed to a single sendmsg
+MAX_IOV = 64
+
 
 class IPCSocket(object):
     def __init__(self):
@@ -20,12 +27,14 @@ class IPCSocket(object):
         )
         self.connected = False
         self._set_reuseaddr()
-        # message buffer
+        # pending writes as memoryviews: header and body are kept apart so
+        # that they can be scattered by one sendmsg without concatenation
         self.message_buffer = list()
         # length of all buffered bytes
         self.buffer_length = 0
-        # write offset
-        self.offset = 0
+        # preallocated receive buffer, reused by every framed read
+        self.recv_buffer = bytearray(HEADER.size + MAX_MESSAGE_LEN)
+        self.recv_view = memoryview(self.recv_buffer)
 
     def bind(self, ipc_file):
         self.ipc_file = ipc_file
@@ -54,67 +63,92 @@ class IPCSocket(object):
         self.connected = True
         return self
 
-    def read(self, header=True, header_len=2, count=1024):
-        if not self.connected:
-            logger.error("Socket not connected")
-            return None
-        if header:
-            # header length in unsigned short
-            raw = self.__sock.recv(header_len, socket.MSG_WAITALL)
-            data_len = 0
-            if len(raw) == header_len:
-                data_len = struct.unpack("!H", raw)[0]
-                # read all data
-                read_len = 0
-                data_recv = []
-                while read_len < data_len:
-                    try:
-                        data = self.__sock.recv(data_len - read_len)
-                        if data == b"":
-                            logger.warning(
-                                "IPCSocket: read 0 data from {}".format(self.fileno())
-                            )
-                            self.close()
-                            return None
-                        else:
-                            data_recv.append(data)
-                            read_len += len(data)
-                    except socket.error as e:
-                        print_exception(e)
-                        logger.warning(
-                            "IPC socket read error (expected: {}, actually: {}), close it".format(
-                                data_len - read_len, len(data)
-                            )
-                        )
-                        self.close()
-                    except socket.timeout as e:
-                        print_exception(e)
-                        logger.error("IPCSocket: read timeout")
-                        break
-                return b"".join(data_recv)
-            else:
-                # there may be some error
+    def _recv_exactly(self, view: memoryview) -> bool:
+        """Fill `view` completely with recv_into; False if the peer is gone"""
+        read_len = 0
+        while read_len < len(view):
+            try:
+                nbytes = self.__sock.recv_into(view[read_len:])
+            except socket.timeout as e:
+                print_exception(e)
+                logger.error("IPCSocket: read timeout")
+                return False
+            except socket.error as e:
+                print_exception(e)
                 logger.warning(
                     "IPC socket read error (expected: {}, actually: {}), close it".format(
-                        header_len, data_len
+                        len(view), read_len
                     )
                 )
                 self.close()
-                return None
+                return False
+            if nbytes == 0:
+                logger.warning("IPCSocket: read 0 data from {}".format(self.fileno()))
+                self.close()
+                return False
+            read_len += nbytes
+        return True
+
+    def read_view(self, header_len=2):
+        """Read one framed message without copying.
+
+        The returned memoryview aliases the internal receive buffer and is
+        only valid until the next read on this socket.
+        """
+        if not self.connected:
+            logger.error("Socket not connected")
+            return None
+        if header_len != HEADER.size:
+            raise ValueError("IPCSocket: unsupported header length {}".format(header_len))
+        if not self._recv_exactly(self.recv_view[:header_len]):
+            return None
+        data_len = HEADER.unpack_from(self.recv_buffer)[0]
+        body = self.recv_view[header_len : header_len + data_len]
+        if not self._recv_exactly(body):
+            return None
+        return body
+
+    def read(self, header=True, header_len=2, count=1024):
+        if not self.connected:
+            logger.error("Socket not connected")
+            return None
+        if header:
+            view = self.read_view(header_len)
+            # json.loads cannot take a memoryview, hand out a private copy
+            return None if view is None else view.tobytes()
         else:
             return self.__sock.recv(count)
 
-    def add_to_buffer(self, message: str, prepend_message_len=True):
-        message = message.encode("utf-8")
-        if prepend_message_len:
-            head = len(message)
-            # header_length in unsigned short
-            header = struct.pack("!H", head)
-            message = header + message
-        self.message_buffer.append(message)
-        self.buffer_length += len(message)
+    @staticmethod
+    def _frame(message, prepend_message_len=True):
+        """Split a message into the buffers to scatter, without joining them"""
+        if isinstance(message, str):
+            message = message.encode("utf-8")
+        body = memoryview(message).cast("B")
+        if not prepend_message_len:
+            return [body]
+        if len(body) > MAX_MESSAGE_LEN:
+            raise ValueError("IPCSocket: message too long ({})".format(len(body)))
+        return [memoryview(HEADER.pack(len(body))), body]
+
+    def add_to_buffer(self, message, prepend_message_len=True):
+        for buf in self._frame(message, prepend_message_len):
+            self.message_buffer.append(buf)
+            self.buffer_length += len(buf)
         return self.buffer_length
 
+    def _consume_buffer(self, sent):
+        """Drop `sent` bytes from the head of the pending write queue"""
+        self.buffer_length -= sent
+        while sent > 0:
+            head = self.message_buffer[0]
+            if sent >= len(head):
+                sent -= len(head)
+                self.message_buffer.pop(0)
+            else:
+                self.message_buffer[0] = head[sent:]
+                sent = 0
+
     def write_once(self):
         """Dump message from message buffer to IPC"""
         if not self.connected:
@@ -123,14 +157,12 @@ class IPCSocket(object):
         if len(self.message_buffer) == 0:
             return 0
 
-        message: str = self.message_buffer[0]
         send_cnt = -1
-        # write from the last_write_offset of buffer
+        # scatter every pending header and body in one system call
         try:
-            send_cnt = self.__sock.send(message[self.offset :])
+            send_cnt = self.__sock.sendmsg(self.message_buffer[:MAX_IOV])
         except OSError as e:
             sys.stderr.write(traceback.format_exc())
-            logger.error("To write {}".format(message))
             if e.errno == errno.EPIPE:
                 logger.error(
                     "IPCSocket: Catch EPIPE error on fd {}. Close the IPC".format(
@@ -156,36 +188,15 @@ class IPCSocket(object):
                     "IPCSocket: write error {}; write_cnt: {}".format(e, send_cnt)
                 )
                 return 0
-        # logger.trace(
-        #     "IPCSocket: write to {}, total message len: {}, send size: {}, write: {}".format(
-        #         self.fileno(),
-        #         len(message),
-        #         send_cnt,
-        #         message[self.offset : self.offset + send_cnt],
-        #     )
-        # )
-        # update offset
-        self.offset += send_cnt
-        if self.offset == len(message):
-            # remove the first element
-            self.message_buffer.pop(0)
-            self.offset = 0
-        # update total buffer size
-        self.buffer_length -= send_cnt
+        self._consume_buffer(send_cnt)
         return send_cnt
 
-    def write(self, message: str, prepend_message_len=True):
+    def write(self, message, prepend_message_len=True):
         if not self.connected:
             # logger.error("Socket not connected")
             return -1
-        message = message.encode("utf-8")
-        if prepend_message_len:
-            head = len(message)
-            # header_length in unsigned short
-            header = struct.pack("!H", head)
-            message = header + message
-
-        message_len = len(message)
+        buffers = self._frame(message, prepend_message_len)
+        message_len = sum(len(buf) for buf in buffers)
         # self.__sock.sendall(message) cannot give sent count if error occurred
 
         # we attend to write all
@@ -193,10 +204,9 @@ class IPCSocket(object):
         while sent_len < message_len:
             send_cnt = 0
             try:
-                send_cnt = self.__sock.send(message)
+                send_cnt = self.__sock.sendmsg(buffers)
             except OSError as e:
                 sys.stderr.write(traceback.format_exc())
-                logger.error("To write {}".format(message))
                 if e.errno == errno.EPIPE:
                     logger.error(
                         "IPCSocket: Catch EPIPE error on fd {}. Close the IPC".format(
@@ -223,6 +233,12 @@ class IPCSocket(object):
                     self.close()
                     return -1
             sent_len += send_cnt
+            # skip the buffers (or the part of one) that are already out
+            while buffers and send_cnt >= len(buffers[0]):
+                send_cnt -= len(buffers[0])
+                buffers.pop(0)
+            if buffers and send_cnt > 0:
+                buffers[0] = buffers[0][send_cnt:]
         return sent_len
 
     def _set_reuseaddr(self):
@@ -0,0 +1,384 @@
+"""
+Learner-to-actor parameter broadcast.
+
+The learner publishes versioned snapshots of the actor network as one flat
+float32 buffer. Local actors read it from a shared-memory file guarded by a
+sequence lock; remote actors subscribe to a TCP stream that carries a full
+snapshot or, when the subscriber holds the previous version, only the
+changed elements. Actors swap the weights in with pre-built assign ops, so
+neither side saves, loads or rebuilds a graph.
+
+Shared memory layout:
+    magic "APRM" | u32 seq | u64 version | u32 count | u32 pad | f32[count]
+seq is odd while the learner is writing.
+
+Stream frame (network byte order header, little-endian payload):
+    u32 frame_len | magic "APRM" | u8 kind | 3x pad | u64 version
+    | u64 base_version | u32 count | payload
+kind FULL carries f32[count]; kind DELTA carries u32 index[count] followed
+by the new f32 value[count] of every element changed since base_version.
+"""
+
+import os
+import mmap
+import socket
+import struct
+import errno
+import time
+
+import numpy as np
+
+from . import context
+from helpers.logger import logger
+from helpers.experience import parse_address
+from helpers.poller import Poller, Action, PollEvents, ReturnStatus
+
+SHM_HEADER = struct.Struct("<4sIQI4x")
+FRAME = struct.Struct("!I")
+STREAM_HEADER = struct.Struct("!4sB3xQQI")
+MAGIC = b"APRM"
+KIND_FULL = 0
+KIND_DELTA = 1
+FLOAT = np.dtype("<f4")
+INDEX = np.dtype("<u4")
+DEFAULT_SHM_PATH = "/dev/shm/astraea_actor_params"
+# seconds a reader first waits on a torn snapshot, doubled up to the max
+READ_BACKOFF = 50e-6
+READ_BACKOFF_MAX = 1e-3
+
+
+def actor_variables(agent):
+    """Variables that define the actor's inference: weights and BN stats"""
+    import tensorflow as tf
+
+    trainable = set(agent.actor.train_var())
+    scope = agent.actor.name + "/"
+    return [
+        v
+        for v in tf.get_collection(tf.GraphKeys.GLOBAL_VARIABLES, scope=scope)
+        if v in trainable or "moving_" in v.name
+    ]
+
+
+class ParameterLayout(object):
+    """Where each variable lives inside the flat parameter buffer"""
+
+    def __init__(self, variables):
+        self.variables = list(variables)
+        self.shapes = [tuple(v.shape.as_list()) for v in self.variables]
+        self.sizes = [int(np.prod(shape)) for shape in self.shapes]
+        self.offsets = np.cumsum([0] + self.sizes)[:-1].tolist()
+        self.count = int(sum(self.sizes))
+
+    def flatten(self, values, out=None):
+        if out is None:
+            out = np.empty(self.count, dtype=FLOAT)
+        for value, offset, size in zip(values, self.offsets, self.sizes):
+            out[offset : offset + size] = np.ravel(value)
+        return out
+
+    def split(self, flat):
+        return [
+            flat[offset : offset + size].reshape(shape)
+            for offset, size, shape in zip(self.offsets, self.sizes, self.shapes)
+        ]
+
+
+class ParameterAssigner(object):
+    """Swap new weights into a live session without touching the graph"""
+
+    def __init__(self, agent, variables=None):
+        import tensorflow as tf
+
+        self.sess = agent.sess
+        self.layout = ParameterLayout(
+            variables if variables is not None else actor_variables(agent)
+        )
+        # build the assign ops once, feeding them is all an update costs
+        self.placeholders = [
+            tf.placeholder(v.dtype.base_dtype, shape=v.shape) for v in self.layout.variables
+        ]
+        self.assign_op = tf.group(
+            *[tf.assign(v, ph) for v, ph in zip(self.layout.variables, self.placeholders)]
+        )
+
+    def snapshot(self, out=None):
+        return self.layout.flatten(self.sess.run(self.layout.variables), out)
+
+    def apply(self, flat):
+        feed = dict(zip(self.placeholders, self.layout.split(flat)))
+        self.sess.run(self.assign_op, feed_dict=feed)
+
+
+class SharedParameterStore(object):
+    """Single-writer, many-reader parameter buffer in shared memory"""
+
+    def __init__(self, count, path=DEFAULT_SHM_PATH, create=False):
+        self.count = count
+        size = SHM_HEADER.size + count * FLOAT.itemsize
+        # actors only ever read the buffer
+        flags = os.O_RDWR | os.O_CREAT if create else os.O_RDONLY
+        access = mmap.ACCESS_WRITE if create else mmap.ACCESS_READ
+        fd = os.open(path, flags, 0o644)
+        try:
+            if create:
+                os.ftruncate(fd, size)
+            self.mem = mmap.mmap(fd, size, access=access)
+        finally:
+            os.close(fd)
+        self.data = np.frombuffer(self.mem, dtype=FLOAT, count=count, offset=SHM_HEADER.size)
+        if create:
+            SHM_HEADER.pack_into(self.mem, 0, MAGIC, 0, 0, count)
+        else:
+            magic, _, _, stored = SHM_HEADER.unpack_from(self.mem)
+            if magic != MAGIC or stored != count:
+                raise ValueError("SharedParameterStore: layout mismatch in {}".format(path))
+
+    def write(self, version, flat):
+        _, seq, _, _ = SHM_HEADER.unpack_from(self.mem)
+        SHM_HEADER.pack_into(self.mem, 0, MAGIC, seq + 1, version, self.count)
+        self.data[:] = flat
+        SHM_HEADER.pack_into(self.mem, 0, MAGIC, seq + 2, version, self.count)
+
+    def version(self):
+        return SHM_HEADER.unpack_from(self.mem)[2]
+
+    def read(self, out, retries=100):
+        """Copy a consistent snapshot into `out`, return its version"""
+        delay = READ_BACKOFF
+        for _ in range(retries):
+            _, seq, version, _ = SHM_HEADER.unpack_from(self.mem)
+            if not seq & 1:
+                out[:] = self.data
+                if SHM_HEADER.unpack_from(self.mem)[1] == seq:
+                    return version
+            # the learner is writing, give it the core rather than spin
+            time.sleep(delay)
+            delay = min(2 * delay, READ_BACKOFF_MAX)
+        return None
+
+
+class _Subscriber(object):
+    def __init__(self, sock, addr):
+        self.sock = sock
+        self.addr = addr
+        # version the subscriber holds once inflight is sent, None if unknown
+        self.version = None
+        self.inflight = []
+        # registered with the poller for writability while inflight is left
+        self.watching = False
+
+
+class ParameterPublisher(object):
+    """Learner side: publish snapshots to shared memory and remote actors.
+
+    Remote actors are accepted, and sends they were too slow for resumed,
+    from the poller, so the learner polls it between publishes.
+    """
+
+    def __init__(self, assigner: ParameterAssigner, shm_path=DEFAULT_SHM_PATH,
+                 bind_addr=None, max_delta_ratio=0.5, poller: Poller = None):
+        self.assigner = assigner
+        self.count = assigner.layout.count
+        self.version = 0
+        self.current = np.zeros(self.count, dtype=FLOAT)
+        self.previous = np.zeros(self.count, dtype=FLOAT)
+        self.max_delta_ratio = max_delta_ratio
+        self.store = None
+        if shm_path is not None:
+            self.store = SharedParameterStore(self.count, shm_path, create=True)
+        # shared with the ExperienceReceiver, whoever polls it also resumes
+        # the sends that did not fit in the socket buffers
+        self.poller = poller if poller is not None else Poller()
+        self.listener = None
+        self.subscribers = []
+        if bind_addr is not None:
+            self.listener = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+            self.listener.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+            self.listener.bind(parse_address(bind_addr))
+            self.listener.listen(64)
+            self.listener.setblocking(False)
+            self.poller.add_action(
+                Action(self.listener, PollEvents.READ_FLAGS, self.__handle_accept)
+            )
+
+    def __handle_accept(self):
+        sock, addr = self.listener.accept()
+        sock.setblocking(False)
+        sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        sub = _Subscriber(sock, addr)
+        self.subscribers.append(sub)
+        logger.info("ParameterPublisher: actor {} subscribed".format(addr))
+        # a new actor starts from the current snapshot, not the next one
+        if self.version > 0:
+            self.__push(sub)
+        return ReturnStatus.Continue
+
+    def __encode(self, sub: _Subscriber):
+        if sub.version == self.version - 1:
+            changed = np.flatnonzero(self.current != self.previous).astype(INDEX)
+            if len(changed) <= self.max_delta_ratio * self.count:
+                header = STREAM_HEADER.pack(
+                    MAGIC, KIND_DELTA, self.version, sub.version, len(changed)
+                )
+                values = self.current[changed]
+                body = [header, changed.tobytes(), values.tobytes()]
+                return [FRAME.pack(sum(len(b) for b in body))] + body
+        header = STREAM_HEADER.pack(MAGIC, KIND_FULL, self.version, 0, self.count)
+        body = [header, self.current.tobytes()]
+        return [FRAME.pack(sum(len(b) for b in body))] + body
+
+    def __send(self, sub: _Subscriber):
+        try:
+            while sub.inflight:
+                count = sub.sock.sendmsg(sub.inflight)
+                while sub.inflight and count >= len(sub.inflight[0]):
+                    count -= len(sub.inflight.pop(0))
+                if sub.inflight:
+                    sub.inflight[0] = sub.inflight[0][count:]
+        except (BlockingIOError, InterruptedError):
+            return True
+        except OSError as e:
+            self.__drop(sub, e)
+            return False
+        return True
+
+    def __drop(self, sub: _Subscriber, reason):
+        logger.warning("ParameterPublisher: drop actor {}: {}".format(sub.addr, reason))
+        if sub.watching:
+            self.poller.remove_fd(sub.sock.fileno())
+            sub.watching = False
+        sub.sock.close()
+        if sub in self.subscribers:
+            self.subscribers.remove(sub)
+
+    def __push(self, sub: _Subscriber):
+        """Send sub the newest version; what does not fit in the socket
+        buffer goes out once it is writable again"""
+        while True:
+            if not sub.inflight:
+                if sub.version == self.version:
+                    return ReturnStatus.Cancel
+                sub.inflight = [memoryview(b) for b in self.__encode(sub)]
+                sub.version = self.version
+            if not self.__send(sub):
+                return ReturnStatus.Cancel
+            if sub.inflight:
+                break
+        if not sub.watching:
+            sub.watching = True
+            self.poller.add_action(
+                Action(
+                    sub.sock,
+                    PollEvents.WRITE_FLAGS,
+                    lambda: self.__handle_write(sub),
+                    lambda: self.__drop(sub, "connection error"),
+                )
+            )
+        return ReturnStatus.Continue
+
+    def __handle_write(self, sub: _Subscriber):
+        status = self.__push(sub)
+        if status == ReturnStatus.Cancel:
+            # caught up, stop polling until the next frame does not fit
+            sub.watching = False
+        return status
+
+    def publish(self):
+        """Snapshot the learner's actor network as a new version"""
+        self.previous, self.current = self.current, self.previous
+        self.assigner.snapshot(out=self.current)
+        self.version += 1
+        if self.store is not None:
+            self.store.write(self.version, self.current)
+        for sub in list(self.subscribers):
+            # a subscriber still busy with an older frame gets this version
+            # from the poller once that frame is out, as a delta if it is
+            # the one right after
+            if not sub.watching:
+                self.__push(sub)
+        return self.version
+
+    def poll(self, timeout=0):
+        self.poller.poll_once(timeout)
+
+
+class ParameterSubscriber(object):
+    """Actor side: fetch the newest snapshot and swap it in between episodes"""
+
+    def __init__(self, assigner: ParameterAssigner, shm_path=None, learner_addr=None):
+        if (shm_path is None) == (learner_addr is None):
+            raise ValueError("ParameterSubscriber: give either shm_path or learner_addr")
+        self.assigner = assigner
+        self.count = assigner.layout.count
+        self.params = np.zeros(self.count, dtype=FLOAT)
+        self.version = 0
+        self.applied = 0
+        self.store = None
+        self.sock = None
+        if shm_path is not None:
+            self.store = SharedParameterStore(self.count, shm_path)
+        else:
+            self.sock = socket.create_connection(parse_address(learner_addr))
+            self.sock.setblocking(False)
+            self.buffer = bytearray()
+
+    def __receive(self):
+        while True:
+            try:
+                data = self.sock.recv(1 << 20)
+            except (BlockingIOError, InterruptedError):
+                break
+            if data == b"":
+                raise ConnectionResetError("learner closed the parameter stream")
+            self.buffer += data
+        view = memoryview(self.buffer)
+        offset = 0
+        while len(view) - offset >= FRAME.size:
+            frame_len = FRAME.unpack_from(view, offset)[0]
+            if len(view) - offset - FRAME.size < frame_len:
+                break
+            start = offset + FRAME.size
+            self.__apply_frame(view[start : start + frame_len])
+            offset = start + frame_len
+        view.release()
+        del self.buffer[:offset]
+
+    def __apply_frame(self, frame):
+        magic, kind, version, base, count = STREAM_HEADER.unpack_from(frame)
+        if magic != MAGIC:
+            raise ValueError("ParameterSubscriber: bad frame")
+        payload = frame[STREAM_HEADER.size :]
+        if kind == KIND_FULL:
+            self.params[:] = np.frombuffer(payload, dtype=FLOAT, count=count)
+        elif base == self.version:
+            index = np.frombuffer(payload, dtype=INDEX, count=count)
+            values = np.frombuffer(
+                payload, dtype=FLOAT, count=count, offset=count * INDEX.itemsize
+            )
+            self.params[index] = values
+        else:
+            logger.warning(
+                "ParameterSubscriber: delta for version {} while holding {}".format(
+                    base, self.version
+                )
+            )
+            return
+        self.version = version
+
+    def update(self):
+        """Apply the newest published weights if they are newer; cheap no-op otherwise"""
+        if self.store is not None:
+            if self.store.version() == self.applied:
+                return False
+            version = self.store.read(self.params)
+            if version is None:
+                return False
+            self.version = version
+        else:
+            self.__receive()
+        if self.version == self.applied:
+            return False
+        self.assigner.apply(self.params)
+        self.applied = self.version
+        return True
@@ -12,6 +12,9 @@ from helpers.ipc_socket import IPCSocket
 from helpers.logger import logger as logger
 
 
+EPOLL_ERR_FLAGS = select.EPOLLERR | select.EPOLLHUP
+
+
 class PollEvents(Enum):
     READ_FLAGS = select.POLLIN | select.POLLPRI
     WRITE_FLAGS = select.POLLOUT
@@ -23,6 +26,19 @@ class PollEvents(Enum):
     def has_value(cls, value):
         return value in cls._value2member_map_
 
+    @property
+    def epoll_mask(self):
+        """translate poll flags into select.EPOLL* bits, epoll has no POLLNVAL
+        and reports errors and hangups whether asked or not"""
+        mask = 0
+        if self.value & PollEvents.READ_FLAGS.value:
+            mask |= select.EPOLLIN | select.EPOLLPRI
+        if self.value & PollEvents.WRITE_FLAGS.value:
+            mask |= select.EPOLLOUT
+        if self.value & PollEvents.ERR_FLAGS.value:
+            mask |= EPOLL_ERR_FLAGS
+        return mask
+
 
 class ReturnStatus(Enum):
     Continue = 0
@@ -48,12 +64,20 @@ class Action(object):
 
 
 class Poller(object):
+    """Poller on top of epoll.
+
+    Every fd is registered with the kernel once and keeps the list of its
+    actions, so one poll_once costs O(ready fds) rather than
+    O(registered actions).
+    """
+
     def __init__(self):
-        self.__poller = select.poll()
+        self.__epoll = select.epoll()
         self.__action_to_add = []
         # avoid redundant elements
         self.__fd_to_remove = set()
-        self.__actions = []
+        # actions of every registered fd
+        self.__actions = {}
         # avoid repeatedly register, key is fd, value is mask
         self.registered_fd = {}
 
@@ -65,6 +89,41 @@ class Poller(object):
         # tmp queue to store fd to be removed
         self.__fd_to_remove.add(fd)
 
+    def __register_action(self, action: Action):
+        mask = action.event.epoll_mask
+        actions = self.__actions.get(action.fd)
+        if actions and actions[0].sock.fileno() != action.fd:
+            # the fd was closed without a hangup and its number reused, the
+            # kernel dropped it from epoll already
+            logger.warning(
+                "Poller: fd {} was closed while registered".format(action.fd)
+            )
+            self.unregister(action.fd)
+            self.registered_fd.pop(action.fd)
+            actions = None
+        if not actions:
+            self.__epoll.register(action.fd, mask)
+            self.__actions[action.fd] = [action]
+            self.registered_fd[action.fd] = mask
+            logger.debug(
+                "Poller: add fd: {} with event: {}(mask: {})".format(
+                    action.fd, action.event.name, mask
+                )
+            )
+            return
+        actions.append(action)
+        # we need to set new bit in event mask
+        current_mask = self.registered_fd[action.fd]
+        if mask & current_mask != mask:
+            newmask = current_mask | mask
+            self.__epoll.modify(action.fd, newmask)
+            self.registered_fd[action.fd] = newmask
+            logger.debug(
+                "Poller: modified eventmask of fd: {} from {} to be {}. Add: {}".format(
+                    action.fd, current_mask, newmask, action.event.name
+                )
+            )
+
     def __remove_action(self):
         if len(self.__fd_to_remove) == 0:
             return
@@ -72,142 +131,102 @@ class Poller(object):
         for fd in self.__fd_to_remove:
             if fd not in self.registered_fd:
                 logger.error("Poller: FileDescriptor {} is not registered".format(fd))
-                break
-            # multiple actions for one fd
-            for action in reversed(self.__actions):
-                if action.fd == fd:
-                    # one fd may have multiple actions
-                    if fd in self.registered_fd:
-                        self.unregister(fd)
-                        self.registered_fd.pop(fd)
-                        logger.debug(
-                            "Poller: Remove fd: {} from registered fd list".format(fd)
-                        )
-                    self.__actions.remove(action)
-                    logger.debug(
-                        "Poller: Removed action and unregister fd: {}, remove mask of {}, current action_len: {}".format(
-                            action.fd, action.event.name, len(self.__actions)
-                        )
-                    )
+                continue
+            # one fd may have multiple actions, all of them go together
+            self.unregister(fd)
+            self.registered_fd.pop(fd)
+            logger.debug("Poller: Remove fd: {} from registered fd list".format(fd))
         logger.debug(
-            "Poller: finish removing action, current action_len is {}".format(
-                len(self.__actions)
+            "Poller: finish removing action, current fd count is {}".format(
+                len(self.registered_fd)
             )
         )
 
     def get_action_by_fd(self, fd):
-        ret_actions = []
-        for action in self.__actions:
-            if action.fd == fd:
-                ret_actions.append(action)
-        return ret_actions
+        return list(self.__actions.get(fd, []))
+
+    def __run_err_callback(self, action: Action):
+        if action.err_callback:
+            try:
+                action.err_callback()
+            except Exception as e:
+                sys.stderr.write(traceback.format_exc())
+                logger.error("Poller: error in err_callback: {}".format(e))
 
     def poll_once(self, timeout=1000) -> bool:
         # add newly arrived fd
         if len(self.__action_to_add) != 0:
-            self.__actions += self.__action_to_add
+            for action in self.__action_to_add:
+                self.__register_action(action)
             self.__action_to_add = []
 
-        # logger.debug("Poller: start Poll, action len: {}".format(len(self.__actions)))
-        if len(self.__actions) == 0:
+        if len(self.registered_fd) == 0:
             # logger.warning("No valid action to poll")
             return False
 
-        # add poll target
-        for action in self.__actions:
-            # if not registered, then register
-            if action.fd not in self.registered_fd:
-                self.__poller.register(action.fd, action.event.value)
-                self.registered_fd[action.fd] = action.event.value
-                logger.debug(
-                    "Poller: add fd: {} with event: {}(mask: {})".format(
-                        action.fd, action.event.name, action.event.value
-                    )
-                )
-            # we need to set new bit in event mask
-            elif action.event.value & self.registered_fd[action.fd] == 0:
-                current_mask = self.registered_fd[action.fd]
-                newmask = current_mask | action.event.value
-                self.__poller.modify(action.fd, newmask)
-                self.registered_fd[action.fd] = newmask
-                logger.debug(
-                    "Poller: modified eventmask of fd: {} from {} to be {}. Add: {}".format(
-                        action.fd, current_mask, newmask, action.event.name
-                    )
-                )
-
-        # logger.debug("Poller: registered action")
+        # epoll takes seconds, a negative timeout blocks forever
+        timeout_s = -1 if timeout is None or timeout < 0 else timeout / 1000
         while True:
             try:
-                events = self.__poller.poll(timeout)
+                events = self.__epoll.poll(timeout_s)
                 break
             except InterruptedError as e:
                 logger.error("Poller: InterruptedError - {}".format(e))
                 continue
-        # logger.debug("Poller: end Poll")
         if not events:
             logger.warning("Poller: No event in polling")
             return False
 
-        # logger.debug("Poller: have action {}".format(len(events)))
-        for fd, flag in sorted(events):
-            actions = self.get_action_by_fd(fd)
-            if flag & PollEvents.ERR_FLAGS.value:
+        # dispatch the whole batch of ready fds before touching registrations
+        for fd, flag in events:
+            if fd in self.__fd_to_remove or fd not in self.__actions:
+                continue
+            actions = self.__actions[fd]
+            if flag & EPOLL_ERR_FLAGS:
                 # we select the first action to run error callback
-                action = actions[0]
                 logger.error(
                     "Poller: Error on poll fd {}, error is {}".format(
-                        fd, flag & PollEvents.ERR_FLAGS.value
-                    )
-                )
-                logger.debug(
-                    "Poller, to run the error callback of fileno: {}".format(
-                        action.sock.fileno()
+                        fd, flag & EPOLL_ERR_FLAGS
                     )
                 )
-                if action.err_callback:
-                    try:
-                        action.err_callback()
-                    except Exception as e:
-                        sys.stderr.write(traceback.format_exc())
-                        logger.error("Poller: error in err_callback: {}".format(e))
+                self.__run_err_callback(actions[0])
                 self.remove_fd(fd)
-                continue
                 # continue to serve other fds
+                continue
             # one fd may relate to multiple actions, e.g., read or write
             for action in actions:
-                if flag & action.event.value:
-                    # logger.debug("Poller: fd {} is readable".format(fd))
-                    try:
-                        # logger.debug(
-                        #     "Poller: begin to run callback on fd {}".format(fd)
-                        # )
-                        status = action.callback()
-                        if status == ReturnStatus.Continue:
-                            # all is normal, do nothing
-                            continue
-                        elif status == ReturnStatus.Cancel:
-                            logger.info("Poller: Cancel polling on fd: {}".format(fd))
-                            self.remove_fd(fd)
-                            break
-                    except Exception as e:
-                        sys.stderr.write(traceback.format_exc())
-                        logger.error("Poller: error in callback: {}".format(e))
+                if not (flag & action.event.epoll_mask):
+                    continue
+                try:
+                    status = action.callback()
+                    if status == ReturnStatus.Cancel:
+                        logger.info("Poller: Cancel polling on fd: {}".format(fd))
                         self.remove_fd(fd)
-                        # break loop on actions
                         break
-        # logger.debug("Poller: remove action")
+                except Exception as e:
+                    sys.stderr.write(traceback.format_exc())
+                    logger.error(
+                        "Poller: error in callback on fd {}: {}".format(fd, e)
+                    )
+                    self.__run_err_callback(action)
+                    self.remove_fd(fd)
+                    # break loop on actions
+                    break
         self.__remove_action()
         self.__fd_to_remove.clear()
         return True
 
     def clear_all(self):
-        for index, action in enumerate(self.__actions.copy()):
-            self.__actions.pop(index)
+        for fd in list(self.registered_fd.keys()):
+            self.unregister(fd)
+        self.registered_fd.clear()
+        self.__action_to_add = []
 
     def unregister(self, fd):
+        self.__actions.pop(fd, None)
         try:
-            self.__poller.unregister(fd)
-        except KeyError as e:
+            self.__epoll.unregister(fd)
+        except OSError as e:
+            # closed fds leave epoll by themselves
             logger.warning("Poller: fd {} is not registered in poller".format(fd))
             return
@@ -0,0 +1,25 @@
+#!/bin/bash
+
+# AOT-compile the exported actor with tfcompile into ../_deps/actor_aot, for
+# infer built with -DWITH_AOT_BACKEND=ON. Needs the TensorFlow source tree
+# that install_tensorflow_cc.sh configured (or TF_SRC) and its bazel.
+#
+# usage: ./build_aot_actor.sh [checkpoint prefix, ../models/exported/model]
+set -e
+
+MODEL=$(realpath ${1:-../models/exported/model})
+TF_SRC=$(realpath ${TF_SRC:-../_deps/tensorflow_cc/tensorflow_cc/build/tensorflow})
+OUT_DIR=$(realpath -m ../_deps/actor_aot)
+PKG=$TF_SRC/tensorflow/compiler/aot/astraea
+
+# frozen graph and per-batch configs, next to the BUILD rules using them
+mkdir -p $PKG
+python3 ../python/export_aot.py --model $MODEL --out-dir $PKG
+cp ../src/inference/aot/BUILD ../src/inference/aot/actor_aot.hh ../src/inference/aot/actor_aot.cc $PKG
+
+(cd $TF_SRC && bazel build -c opt --config=opt //tensorflow/compiler/aot/astraea:libactor_aot.so)
+
+mkdir -p $OUT_DIR/lib $OUT_DIR/include
+cp -f $TF_SRC/bazel-bin/tensorflow/compiler/aot/astraea/libactor_aot.so $OUT_DIR/lib
+cp -f ../src/inference/aot/actor_aot.hh $OUT_DIR/include
+echo "AOT actor built into $OUT_DIR"
@@ -1,13 +1,17 @@
 #include <getopt.h>
 #include <signal.h>
 #include <stdio.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <cmath>
 #include <deque>
 #include <fstream>
 #include <iostream>
 #include <mutex>
+#include <random>
 #include <string>
 #include <thread>
 #include <vector>
@@ -18,7 +22,9 @@
 #include "current_time.hh"
 #include "deepcc_socket.hh"
 #include "exception.hh"
+#include "feature.hh"
 #include "filesystem.hh"
+#include "inference_pool.hh"
 #include "ipc_socket.hh"
 #include "json.hpp"
 #include "logging.hh"
@@ -28,6 +34,7 @@
 #include "socket.hh"
 #include "system_runner.hh"
 #include "tcp_info.hh"
+#include "tracer.hh"
 
 using namespace std;
 using namespace std::literals;
@@ -40,13 +47,80 @@ using json = nlohmann::json;
 
 // send_traffic should be atomic
 std::atomic<bool> send_traffic(true);
-int global_flow_id = 0;
+// drawn at random unless --id is given, infer registers the flow with its
+// first ALIVE
+int64_t global_flow_id = 0;
 std::unique_ptr<IPCSocket> inference_server = nullptr;
+// set instead of inference_server with --channel=tcp, one or more infers
+std::unique_ptr<InferencePool> remote_server = nullptr;
+// ticks no infer answered in time, they keep the last cwnd
+uint64_t fallback_ticks = 0;
 
 Address inference_server_addr;
 std::chrono::_V2::system_clock::time_point ts_now = clock_type::now();
 std::unique_ptr<std::ofstream> perf_log;
 
+// cwnds asked for per query with --plan, 1 for a query every interval
+int plan_length = 1;
+// the rest of the plan being run and the bounds it holds within
+std::deque<int> plan;
+unsigned int plan_max_urtt = 0;
+double plan_max_loss = 0;
+// ticks run without a query since the last one, planned or skipped
+int unreported_ticks = 0;
+
+// with --stateless the client keeps the actor's feature window, so any
+// infer process can serve any query
+bool stateless = false;
+std::array<float, kNNInputSize> feature_window{};
+
+// the batch cadence of an infer with --aligned-batches, 0 if it batches
+// freely; ticks then go tick_phase_ns into it on steady_clock, which is
+// CLOCK_MONOTONIC as on infer
+int64_t batch_interval_ns = 0;
+int64_t tick_phase_ns = 0;
+// the first query asks for the cadence with a phase hint, there is no START
+// reply to carry it
+bool cadence_asked = false;
+// one query in kPhaseHintEvery asks infer how long it waited for its batch
+const int kPhaseHintEvery = 32;
+int queries_since_hint = 0;
+
+// an overloaded infer asks for queries only every "backoff" ticks, honoured
+// up to --max-backoff; ticks left until the next query
+int max_backoff = 4;
+int backoff_left = 0;
+uint64_t backoff_ticks = 0;
+
+/* how long a flow runs the kernel's default congestion control before it
+ * engages infer, see --engage-bytes; whichever comes first */
+struct EngagePolicy {
+  // bytes acked by the receiver
+  uint64_t bytes = 0;
+  // RTTs since the connection was established
+  double rtts = 0;
+  bool deferred() const { return bytes > 0 or rtts > 0; }
+};
+EngagePolicy engage;
+
+/* when a tick needs a fresh decision, see --max-skip */
+struct TriggerPolicy {
+  // change of avg_urtt relative to min_rtt
+  double rtt = 0.05;
+  // relative change of avg_thr
+  double thr = 0.05;
+  // change of loss_ratio relative to max_tput
+  double loss = 0.01;
+  // most ticks in a row that keep the last cwnd, 0 to query every tick
+  int max_skip = 0;
+};
+TriggerPolicy trigger;
+// the state of the last query and the cwnd in force
+json last_decision_state;
+int last_cwnd = 0;
+int skips_in_row = 0;
+uint64_t skipped_ticks = 0, total_ticks = 0;
+
 /* define message type */
 enum class MessageType { INIT = 0, START = 1, END = 2, ALIVE = 3, OBSERVE = 4 };
 
@@ -58,9 +132,8 @@ constexpr typename std::underlying_type<E>::type to_underlying(E e) noexcept {
 /* algorithm name */
 const char* ALG = "Astraea";
 
-void unix_send_message(std::unique_ptr<IPCSocket>& ipc_sock,
-                       const MessageType& type, const json& state,
-                       const int observer_id = -1, const int step = -1) {
+json make_message(const MessageType& type, const json& state,
+                  const int observer_id = -1, const int step = -1) {
   json message;
   if (!state.empty()) {
     message["state"] = state;
@@ -75,13 +148,22 @@ void unix_send_message(std::unique_ptr<IPCSocket>& ipc_sock,
     // we just need to copy the type
     message["type"] = to_underlying(type);
   }
+  return message;
+}
 
+void unix_send(std::unique_ptr<IPCSocket>& ipc_sock, const json& message) {
   uint16_t len = message.dump().length();
   if (ipc_sock) {
     ipc_sock->write(put_field(len) + message.dump());
   }
 }
 
+void unix_send_message(std::unique_ptr<IPCSocket>& ipc_sock,
+                       const MessageType& type, const json& state,
+                       const int observer_id = -1, const int step = -1) {
+  unix_send(ipc_sock, make_message(type, state, observer_id, step));
+}
+
 std::string unix_recv_message(std::unique_ptr<IPCSocket>& ipc) {
   auto header = ipc->read_exactly(2);
   auto data_len = get_uint16(header.data());
@@ -92,6 +174,18 @@ std::string unix_recv_message(std::unique_ptr<IPCSocket>& ipc) {
 void signal_handler(int sig) {
   if (sig == SIGINT or sig == SIGKILL or sig == SIGTERM) {
     LOG(INFO) << "Caught signal, Client " << global_flow_id << " exiting...";
+    if (trigger.max_skip > 0) {
+      LOG(INFO) << "Client " << global_flow_id << " skipped " << skipped_ticks
+                << " of " << total_ticks << " ticks";
+    }
+    if (backoff_ticks > 0) {
+      LOG(INFO) << "Client " << global_flow_id << " backed off in "
+                << backoff_ticks << " ticks";
+    }
+    if (fallback_ticks > 0) {
+      LOG(INFO) << "Client " << global_flow_id << " fell back to its last cwnd"
+                << " in " << fallback_ticks << " ticks";
+    }
     // first disable read from fd
     // disable write to IPC
     send_traffic = false;
@@ -103,29 +197,238 @@ void signal_handler(int sig) {
     if (inference_server) {
       unix_send_message(inference_server, MessageType::END, json());
     }
+    if (remote_server) {
+      remote_server->notify(make_message(MessageType::END, json()));
+    }
     std::this_thread::sleep_for(std::chrono::microseconds(100));
     exit(1);
   }
 }
 
+/* whether the state moved past a trigger threshold since the last query */
+bool needs_decision(const json& state) {
+  if (trigger.max_skip <= 0 or last_decision_state.is_null() or
+      skips_in_row >= trigger.max_skip) {
+    return true;
+  }
+  auto& last = last_decision_state;
+  double min_rtt = std::max(1.0, state["min_rtt"].get<double>());
+  double max_tput = std::max(1.0, state["max_tput"].get<double>());
+  double last_thr = std::max(1.0, last["avg_thr"].get<double>());
+  double rtt_delta = std::abs(state["avg_urtt"].get<double>() -
+                              last["avg_urtt"].get<double>()) /
+                     min_rtt;
+  double thr_delta =
+      std::abs(state["avg_thr"].get<double>() - last["avg_thr"].get<double>()) /
+      last_thr;
+  double loss_delta = std::abs(state["loss_ratio"].get<double>() -
+                               last["loss_ratio"].get<double>()) /
+                      max_tput;
+  return rtt_delta > trigger.rtt or thr_delta > trigger.thr or
+         loss_delta > trigger.loss;
+}
+
+/* how long a query should wait for its batch, enough to absorb jitter */
+int64_t target_batch_lead() { return batch_interval_ns / 8; }
+
+/* move the ticks by how much the batch lead infer measured is off */
+void align_ticks(int64_t batch_lead_us) {
+  int64_t error = batch_lead_us * 1000 - target_batch_lead();
+  // the nearer of the boundaries before and after
+  error %= batch_interval_ns;
+  if (error >= batch_interval_ns / 2) {
+    error -= batch_interval_ns;
+  } else if (error < -batch_interval_ns / 2) {
+    error += batch_interval_ns;
+  }
+  tick_phase_ns += error;
+  LOG(TRACE) << "Client " << global_flow_id << " batch lead " << batch_lead_us
+             << "us, moves its ticks by " << error / 1000 << "us";
+}
+
+/* a positive 63-bit id, two flows draw the same one with a negligible
+ * chance that infer still detects */
+int64_t random_flow_id() {
+  static std::mt19937_64 generator{std::random_device()()};
+  int64_t flow_id;
+  do {
+    flow_id = static_cast<int64_t>(generator() >> 1);
+  } while (flow_id == 0);
+  return flow_id;
+}
+
+/* take the cadence an infer with --aligned-batches advertises */
+void adopt_cadence(const json& reply) {
+  batch_interval_ns = reply["batch_interval"].get<int64_t>() * 1000;
+  // right for an infer on this host, the next phase hint corrects it for a
+  // remote one
+  tick_phase_ns =
+      reply["batch_phase"].get<int64_t>() * 1000 - target_batch_lead();
+  LOG(INFO) << "Client " << global_flow_id << " aligns its ticks to "
+            << "batches every " << batch_interval_ns / 1000 << "us";
+}
+
+/* the time nearest to target that is tick_phase_ns into the cadence */
+std::chrono::steady_clock::time_point align_tick(
+    std::chrono::steady_clock::time_point target) {
+  if (batch_interval_ns <= 0) {
+    return target;
+  }
+  int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    target.time_since_epoch())
+                    .count();
+  int64_t shift =
+      ((tick_phase_ns - now) % batch_interval_ns + batch_interval_ns) %
+      batch_interval_ns;
+  if (shift >= batch_interval_ns / 2) {
+    shift -= batch_interval_ns;
+  }
+  return target + std::chrono::nanoseconds(shift);
+}
+
 void do_congestion_control(DeepCCSocket& sock,
                            std::unique_ptr<IPCSocket>& ipc_sock) {
-  auto state = sock.get_tcp_deepcc_info_json(RequestType::REQUEST_ACTION);
-  LOG(TRACE) << "Client " << global_flow_id << " send state: " << state.dump();
-  unix_send_message(ipc_sock, MessageType::ALIVE, state);
+  TraceSpan tick("tick", global_flow_id);
+  json state;
+  {
+    TraceSpan span("state_read", global_flow_id);
+    state = sock.get_tcp_deepcc_info_json(RequestType::REQUEST_ACTION);
+  }
   // set timestamp
   ts_now = clock_type::now();
-  // wait for action
-  auto data = unix_recv_message(ipc_sock);
+  total_ticks++;
+  if (stateless) {
+    // every tick goes into the window, queried or not
+    std::copy(feature_window.begin() + kStateSize, feature_window.end(),
+              feature_window.begin());
+    transform_state(make_deepcc_state(state),
+                    &feature_window[kNNInputSize - kStateSize]);
+  }
   int cwnd = 0;
-  try {
-    cwnd = json::parse(data).at("cwnd");
-  } catch (const std::exception& e) {
-    LOG(WARNING) << "Client " << global_flow_id
-                 << " failed to parse action: " << data;
-    return;
+  bool skipped = false;
+  if (!plan.empty()) {
+    if (state["avg_urtt"] <= plan_max_urtt and
+        state["loss_ratio"] <= plan_max_loss) {
+      cwnd = plan.front();
+      plan.pop_front();
+      unreported_ticks++;
+    } else {
+      // the path moved away from what the plan assumed
+      LOG(DEBUG) << "Client " << global_flow_id << " drops its plan with "
+                 << plan.size() << " cwnds left";
+      plan.clear();
+    }
+  }
+  if (cwnd == 0 and backoff_left > 0) {
+    // infer is overloaded, decide less often rather than late
+    cwnd = last_cwnd;
+    skipped = true;
+    backoff_left--;
+    backoff_ticks++;
+    unreported_ticks++;
+  } else if (cwnd == 0 and !needs_decision(state)) {
+    // nothing changed enough, the last cwnd stays in force
+    cwnd = last_cwnd;
+    skipped = true;
+    skips_in_row++;
+    skipped_ticks++;
+    unreported_ticks++;
+    LOG(TRACE) << "Client " << global_flow_id << " skips tick, "
+               << skipped_ticks << " of " << total_ticks << " skipped";
+  }
+  if (cwnd == 0) {
+    json message = make_message(MessageType::ALIVE, state);
+    if (plan_length > 1) {
+      message["plan"] = plan_length;
+    }
+    if (!cadence_asked or (batch_interval_ns > 0 and
+                           queries_since_hint++ % kPhaseHintEvery == 0)) {
+      message["phase"] = 1;
+    }
+    if (stateless) {
+      // the rows before this state, infer transforms the state itself
+      message["history"] = std::vector<float>(
+          feature_window.begin(), feature_window.end() - kStateSize);
+    } else if (unreported_ticks > 0) {
+      message["executed"] = unreported_ticks;
+    }
+    unreported_ticks = 0;
+    LOG(TRACE) << "Client " << global_flow_id
+               << " send state: " << state.dump();
+    if (!remote_server) {
+      TraceSpan span("send", global_flow_id);
+      unix_send(ipc_sock, message);
+    }
+    // wait for action; a tick without a decision keeps the last cwnd and
+    // still writes its perf log row
+    bool decided = false;
+    std::string data;
+    try {
+      TraceSpan span("wait_reply", global_flow_id);
+      json reply;
+      if (remote_server) {
+        // fails over to another infer within the control interval
+        reply = remote_server->call(message);
+        data = reply.dump();
+      } else {
+        data = unix_recv_message(ipc_sock);
+        reply = json::parse(data);
+      }
+      if (reply.is_null()) {
+        // no infer answered in time
+        fallback_ticks++;
+        LOG(WARNING) << "Client " << global_flow_id
+                     << " got no action in time, keeps cwnd " << last_cwnd;
+      } else if (reply.contains("collision")) {
+        // another flow drew the same id first
+        int64_t flow_id = random_flow_id();
+        LOG(WARNING) << "Client " << global_flow_id
+                     << " collides with another flow, continues as "
+                     << flow_id;
+        global_flow_id = flow_id;
+        if (remote_server) {
+          remote_server->set_flow_id(flow_id);
+        }
+        fallback_ticks++;
+      } else {
+        cwnd = reply.at("cwnd");
+        if (reply.contains("plan")) {
+          plan.assign(reply["plan"].begin(), reply["plan"].end());
+          plan_max_urtt = reply.at("max_urtt");
+          plan_max_loss = reply.at("max_loss");
+        }
+        // back to a query every tick once the reply no longer asks otherwise
+        backoff_left =
+            std::clamp(reply.value("backoff", 1), 1, max(1, max_backoff)) - 1;
+        if (!cadence_asked) {
+          cadence_asked = true;
+          // this query was not aligned yet, its batch lead says nothing
+          if (reply.contains("batch_interval")) {
+            adopt_cadence(reply);
+          }
+        } else if (reply.contains("batch_lead") and batch_interval_ns > 0) {
+          align_ticks(reply["batch_lead"]);
+        }
+        decided = true;
+      }
+    } catch (const std::exception& e) {
+      LOG(WARNING) << "Client " << global_flow_id
+                   << " failed to parse action: " << data;
+    }
+    if (decided) {
+      last_decision_state = state;
+      skips_in_row = 0;
+    } else {
+      cwnd = last_cwnd;
+      skipped = true;
+    }
+  }
+  if (!skipped) {
+    TraceSpan span("cwnd_applied", global_flow_id);
+    span.set_arg("cwnd", cwnd);
+    sock.set_tcp_cwnd(cwnd);
   }
-  sock.set_tcp_cwnd(cwnd);
+  last_cwnd = cwnd;
   auto elapsed = clock_type::now() - ts_now;
   LOG(DEBUG)
       << "Client " << global_flow_id << " GET cwnd: " << cwnd
@@ -146,14 +449,89 @@ void do_congestion_control(DeepCCSocket& sock,
   }
 }
 
-void control_thread(DeepCCSocket& sock, std::unique_ptr<IPCSocket>& ipc,
+/* connect to infer over channel; the flow registers with its first ALIVE,
+ * so nothing waits for a reply here */
+void start_inference(const string& channel, const string& infer_addr,
+                     const string& id,
+                     const std::chrono::milliseconds control_interval) {
+  if (channel == "tcp") {
+    // the random id spreads the flows over the ring as well as --id does
+    remote_server = make_unique<InferencePool>(
+        InferencePool::parse_endpoints(infer_addr),
+        id.empty() ? to_string(global_flow_id) : id, control_interval);
+    remote_server->start(global_flow_id);
+  } else {
+    IPCSocket ipcsock;
+    ipcsock.set_reuseaddr();
+    inference_server = make_unique<IPCSocket>(std::move(ipcsock));
+    inference_server->connect("/tmp/astraea.sock");
+  }
+  LOG(INFO) << "Client " << global_flow_id
+            << " IPC with env has been established, control interval is "
+            << control_interval.count() << "ms";
+  Tracer::Get()->set_process_name("client-" + to_string(global_flow_id));
+}
+
+/* hand sock to astraea and DeepCC, !! only once it is connected */
+void enable_astraea(DeepCCSocket& sock, const string& cong_ctl) {
+  sock.set_congestion_control(cong_ctl);
+  LOG(DEBUG) << "Client " << global_flow_id << " set congestion control to "
+             << cong_ctl;
+  int enable_deepcc = 2;
+  sock.enable_deepcc(enable_deepcc);
+  LOG(DEBUG) << "Client " << global_flow_id << " "
+             << "enables deepCC plugin: " << enable_deepcc;
+}
+
+/* wait under the kernel's default congestion control until the flow passes
+ * --engage-bytes or --engage-rtts; false if it stopped before */
+bool wait_to_engage(DeepCCSocket& sock,
                     const std::chrono::milliseconds interval) {
+  double rtts = 0;
+  auto last = std::chrono::steady_clock::now();
+  while (send_traffic.load()) {
+    tcp_info info;
+    socklen_t length = sizeof(info);
+    SystemCall("getsockopt", ::getsockopt(sock.fd_num(), IPPROTO_TCP,
+                                          TCP_INFO, &info, &length));
+    auto now = std::chrono::steady_clock::now();
+    // tcpi_rtt is the srtt in us
+    auto srtt = std::chrono::microseconds(max(info.tcpi_rtt, 1u));
+    rtts += std::chrono::duration<double>(now - last) / srtt;
+    last = now;
+    if ((engage.bytes > 0 and info.tcpi_bytes_acked >= engage.bytes) or
+        (engage.rtts > 0 and rtts >= engage.rtts)) {
+      LOG(INFO) << "Client engages Astraea after " << info.tcpi_bytes_acked
+                << " bytes and " << rtts << " RTTs";
+      return true;
+    }
+    // an RTT tells whether the flow passed its threshold, up to an interval
+    std::this_thread::sleep_for(std::clamp<std::chrono::microseconds>(
+        srtt, 1ms, std::chrono::microseconds(interval)));
+  }
+  return false;
+}
+
+void control_thread(DeepCCSocket& sock, std::unique_ptr<IPCSocket>& ipc,
+                    const std::chrono::milliseconds interval,
+                    const string& channel, const string& infer_addr,
+                    const string& id) {
+  if (engage.deferred()) {
+    // short flows finish before this and never cost infer anything
+    if (!wait_to_engage(sock, interval)) {
+      return;
+    }
+    start_inference(channel, infer_addr, id, interval);
+    enable_astraea(sock, "astraea");
+  }
   // start regular congestion control parttern
-  auto when_started = clock_type::now();
+  auto when_started = std::chrono::steady_clock::now();
   auto target_time = when_started + interval;
   while (send_traffic.load()) {
     do_congestion_control(sock, ipc);
-    std::this_thread::sleep_until(target_time);
+    // the interval holds on average, each tick moves by less than half a
+    // batch interval
+    std::this_thread::sleep_until(align_tick(target_time));
     target_time += interval;
   }
 }
@@ -171,12 +549,38 @@ void usage_error(const string& program_name) {
   cerr << endl;
   cerr << "Options = --ip=IP_ADDR --port=PORT --cong=ALGORITHM"
           "--interval=INTERVAL (Milliseconds) --id=None --perf-log=None"
+          " --channel=unix|tcp --infer=IP:PORT[,IP:PORT]... --plan=STEPS"
+          " --max-skip=N --trigger-rtt=F --trigger-thr=F --trigger-loss=F"
+          " --stateless --max-backoff=N --engage-bytes=N --engage-rtts=N"
        << endl;
   cerr << endl;
   cerr << "Default congestion control algorithms for incoming TCP is CUBIC; "
        << endl
        << "Default control interval is 10ms; " << endl
-       << "Default flow id is None; " << endl;
+       << "Default flow id is None, i.e. a random 63-bit id that infer "
+          "registers with the first ALIVE; "
+       << endl
+       << "Default channel to the inference service is unix; " << endl
+       << "Default inference service for the tcp channel is 127.0.0.1:8888; "
+       << endl
+       << "With several infers, each flow is placed by consistent hashing of "
+          "its flow id and fails over to the next one that is up; "
+       << endl
+       << "Default plan is 1 step, i.e. a query every interval; " << endl
+       << "Default max skip is 0, i.e. no tick is skipped; a tick keeps the "
+          "last cwnd while RTT/min_rtt, throughput and loss/max_tput moved "
+          "less than 0.05, 5% and 0.01 since the last query; "
+       << endl
+       << "--stateless keeps the feature window on the client and sends it "
+          "along with every query; "
+       << endl
+       << "Default max backoff is 4, i.e. an overloaded infer can ask for a "
+          "query only every 4 ticks; 1 ignores it; "
+       << endl
+       << "With --engage-bytes or --engage-rtts, the flow runs the kernel's "
+          "default congestion control and only engages infer once that "
+          "many bytes were acked or RTTs passed; "
+       << endl;
 
   throw runtime_error("invalid arguments");
 }
@@ -201,11 +605,23 @@ int main(int argc, char** argv) {
       {"interval", optional_argument, nullptr, 't'},
       {"id", optional_argument, nullptr, 'f'},
       {"perf-log", optional_argument, nullptr, 'l'},
+      {"channel", required_argument, nullptr, 'h'},
+      {"infer", required_argument, nullptr, 'i'},
+      {"plan", required_argument, nullptr, 'n'},
+      {"max-skip", required_argument, nullptr, 's'},
+      {"trigger-rtt", required_argument, nullptr, 'r'},
+      {"trigger-thr", required_argument, nullptr, 'T'},
+      {"trigger-loss", required_argument, nullptr, 'L'},
+      {"stateless", no_argument, nullptr, 'S'},
+      {"max-backoff", required_argument, nullptr, 'b'},
+      {"engage-bytes", required_argument, nullptr, 'B'},
+      {"engage-rtts", required_argument, nullptr, 'R'},
       {0, 0, nullptr, 0}};
 
   /* use RL inference or not */
   bool use_RL = false;
   string ip, service, pyhelper, model, cong_ctl, interval, id, perf_log_path;
+  string channel = "unix", infer_addr = "127.0.0.1:8888";
   while (true) {
     const int opt = getopt_long(argc, argv, "", command_line_options, nullptr);
     if (opt == -1) { /* end of options */
@@ -230,6 +646,39 @@ int main(int argc, char** argv) {
     case 't':
       interval = optarg;
       break;
+    case 'h':
+      channel = optarg;
+      break;
+    case 'i':
+      infer_addr = optarg;
+      break;
+    case 'n':
+      plan_length = max(1, stoi(optarg));
+      break;
+    case 's':
+      trigger.max_skip = max(0, stoi(optarg));
+      break;
+    case 'r':
+      trigger.rtt = stod(optarg);
+      break;
+    case 'T':
+      trigger.thr = stod(optarg);
+      break;
+    case 'L':
+      trigger.loss = stod(optarg);
+      break;
+    case 'S':
+      stateless = true;
+      break;
+    case 'b':
+      max_backoff = max(1, stoi(optarg));
+      break;
+    case 'B':
+      engage.bytes = stoull(optarg);
+      break;
+    case 'R':
+      engage.rtts = max(0.0, stod(optarg));
+      break;
     case '?':
       usage_error(argv[0]);
       break;
@@ -245,31 +694,25 @@ int main(int argc, char** argv) {
 
   /* assign flow_id */
   if (not id.empty()) {
-    global_flow_id = stoi(id);
+    global_flow_id = stoll(id);
     LOG(INFO) << "Flow id: " << global_flow_id;
+  } else {
+    global_flow_id = random_flow_id();
   }
 
   std::chrono::milliseconds control_interval(20ms);
   if (cong_ctl == "astraea") {
     /* IPC and control interval */
-    IPCSocket ipcsock;
-    ipcsock.set_reuseaddr();
-
     if (not interval.empty()) {
       control_interval = std::move(std::chrono::milliseconds(stoi(interval)));
     }
-    inference_server = make_unique<IPCSocket>(std::move(ipcsock));
-    inference_server->connect("/tmp/astraea.sock");
-    // send initial message
-    json init_message;
-    unix_send_message(inference_server, MessageType::START, init_message);
-    LOG(INFO) << "Sent init message to inference server ...";
-    auto data = unix_recv_message(inference_server);
-    json reply = json::parse(data);
-    global_flow_id = reply["flow_id"];
-    LOG(INFO) << "Client " << global_flow_id
-              << " IPC with env has been established, control interval is "
-              << control_interval.count() << "ms";
+    if (channel != "tcp" and channel != "unix") {
+      usage_error(argv[0]);
+    }
+    // a deferred flow connects to infer from its control thread
+    if (!engage.deferred()) {
+      start_inference(channel, infer_addr, id, control_interval);
+    }
     /* has checked all things, we can use RL */
     use_RL = true;
   }
@@ -288,15 +731,13 @@ int main(int argc, char** argv) {
   client.set_reuseaddr();
   client.connect(address);
 
-  client.set_congestion_control(cong_ctl);
   client.set_nodelay();
-  LOG(DEBUG) << "Client " << global_flow_id << " set congestion control to "
-             << cong_ctl;
-  /* !! should be set after socket connected */
-  int enable_deepcc = 2;
-  client.enable_deepcc(enable_deepcc);
-  LOG(DEBUG) << "Client " << global_flow_id << " "
-             << "enables deepCC plugin: " << enable_deepcc;
+  if (use_RL and engage.deferred()) {
+    LOG(INFO) << "Client runs the kernel's default congestion control until "
+              << engage.bytes << " bytes or " << engage.rtts << " RTTs";
+  } else {
+    enable_astraea(client, cong_ctl);
+  }
 
   /* setup performance log */
   if (not perf_log_path.empty()) {
@@ -321,9 +762,10 @@ int main(int argc, char** argv) {
   }
   /* start data thread and control thread */
   thread ct;
-  if (use_RL and inference_server != nullptr) {
+  if (use_RL) {
     ct = thread(control_thread, std::ref(client), std::ref(inference_server),
-                control_interval);
+                control_interval, std::cref(channel), std::cref(infer_addr),
+                std::cref(id));
     LOG(DEBUG) << "Client " << global_flow_id << " Started control thread ... ";
   }
   thread dt(data_thread, std::ref(client));
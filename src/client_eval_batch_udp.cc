@@ -28,6 +28,7 @@
 #include "socket.hh"
 #include "system_runner.hh"
 #include "tcp_info.hh"
+#include "tracer.hh"
 
 using namespace std;
 using namespace std::literals;
@@ -116,13 +117,25 @@ void signal_handler(int sig) {
 
 void do_congestion_control(DeepCCSocket& sock,
                            std::unique_ptr<UDPSocket>& ipc_sock) {
-  auto state = sock.get_tcp_deepcc_info_json(RequestType::REQUEST_ACTION);
+  TraceSpan tick("tick", global_flow_id);
+  json state;
+  {
+    TraceSpan span("state_read", global_flow_id);
+    state = sock.get_tcp_deepcc_info_json(RequestType::REQUEST_ACTION);
+  }
   LOG(TRACE) << "Client " << global_flow_id << " send state: " << state.dump();
-  udp_send_message(ipc_sock, MessageType::ALIVE, state);
+  {
+    TraceSpan span("send", global_flow_id);
+    udp_send_message(ipc_sock, MessageType::ALIVE, state);
+  }
   // set timestamp
   ts_now = clock_type::now();
   // wait for action
-  auto data = udp_recv_message(ipc_sock);
+  std::string data;
+  {
+    TraceSpan span("wait_reply", global_flow_id);
+    data = udp_recv_message(ipc_sock);
+  }
   int cwnd = 0;
   try {
     cwnd = json::parse(data).at("cwnd");
@@ -131,7 +144,11 @@ void do_congestion_control(DeepCCSocket& sock,
                  << "Error parsing json: " << e.what();
     return;
   }
-  sock.set_tcp_cwnd(cwnd);
+  {
+    TraceSpan span("cwnd_applied", global_flow_id);
+    span.set_arg("cwnd", cwnd);
+    sock.set_tcp_cwnd(cwnd);
+  }
   auto elapsed = clock_type::now() - ts_now;
   LOG(DEBUG)
       << "Client GET cwnd: " << cwnd << ", elapsed time is "
@@ -287,6 +304,7 @@ int main(int argc, char** argv) {
               << control_interval.count() << "ms";
     /* has checked all things, we can use RL */
     use_RL = true;
+    Tracer::Get()->set_process_name("client-" + to_string(global_flow_id));
   }
 
   /* default CC is cubic */
@@ -0,0 +1,251 @@
+#include <getopt.h>
+#include <signal.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "address.hh"
+#include "exception.hh"
+#include "inference_client.hh"
+#include "ipc_socket.hh"
+#include "json.hpp"
+#include "serialization.hh"
+#include "socket.hh"
+
+using namespace std;
+using clock_type = std::chrono::steady_clock;
+using json = nlohmann::json;
+
+/*
+ * Load generator for the inference service: every flow runs the client's
+ * control loop (one ALIVE in flight, next one as soon as the reply is in)
+ * over the chosen channel, so the channels can be compared on loopback.
+ */
+
+enum class MessageType { INIT = 0, START = 1, END = 2, ALIVE = 3, OBSERVE = 4 };
+
+json make_message(const MessageType type, const int flow_id,
+                  const json& state = json()) {
+  json message;
+  message["type"] = static_cast<int>(type);
+  message["flow_id"] = flow_id;
+  if (not state.empty()) {
+    message["state"] = state;
+  }
+  return message;
+}
+
+json fake_state(const int step) {
+  json state;
+  state["avg_thr"] = 1000000 + step % 100;
+  state["avg_urtt"] = 20000;
+  state["srtt_us"] = 160000;
+  state["min_rtt"] = 20000;
+  state["max_tput"] = 1200000;
+  state["cwnd"] = 80 + step % 10;
+  state["packets_out"] = 70;
+  state["pacing_rate"] = 1500000;
+  state["retrans_out"] = 0;
+  state["loss_ratio"] = 0.0;
+  return state;
+}
+
+/* one flow's connection to infer over the unix or UDP channel */
+class Channel {
+ public:
+  virtual ~Channel() {}
+  virtual json call(const json& message) = 0;
+  virtual void notify(const json& message) = 0;
+};
+
+class UnixChannel : public Channel {
+ public:
+  UnixChannel() : sock_() { sock_.connect("/tmp/astraea.sock"); }
+
+  json call(const json& message) override {
+    notify(message);
+    auto header = sock_.read_exactly(2);
+    return json::parse(sock_.read_exactly(get_uint16(header.data())));
+  }
+
+  void notify(const json& message) override {
+    const string body = message.dump();
+    sock_.write(put_field(body.length()) + body);
+  }
+
+ private:
+  IPCSocket sock_;
+};
+
+class UdpChannel : public Channel {
+ public:
+  UdpChannel(const Address& server) : sock_(), server_(server) {}
+
+  json call(const json& message) override {
+    notify(message);
+    string reply = sock_.recvfrom().second;
+    return json::parse(reply.substr(2));
+  }
+
+  void notify(const json& message) override {
+    const string body = message.dump();
+    sock_.sendto(server_, put_field(body.length()) + body);
+  }
+
+ private:
+  UDPSocket sock_;
+  Address server_;
+};
+
+class TcpChannel : public Channel {
+ public:
+  TcpChannel(InferenceClient& client) : client_(client) {}
+
+  json call(const json& message) override { return client_.call(message); }
+  void notify(const json& message) override { client_.notify(message); }
+
+ private:
+  InferenceClient& client_;
+};
+
+void usage_error(const string& program_name) {
+  cerr << "Usage: " << program_name
+       << " --channel=unix|udp|tcp [--infer=IP:PORT] [--flows=N]"
+          " [--requests=N] [--connections=N]"
+       << endl;
+  cerr << endl;
+  cerr << "Default is 16 flows of 1000 requests each over the unix channel; "
+       << endl
+       << "--connections sets the size of the tcp connection pool (4)."
+       << endl;
+  throw runtime_error("invalid arguments");
+}
+
+int main(int argc, char** argv) {
+  const option command_line_options[] = {
+      {"channel", required_argument, nullptr, 'h'},
+      {"infer", required_argument, nullptr, 'i'},
+      {"flows", required_argument, nullptr, 'f'},
+      {"requests", required_argument, nullptr, 'n'},
+      {"connections", required_argument, nullptr, 'c'},
+      {0, 0, nullptr, 0}};
+
+  string channel = "unix", infer_addr = "127.0.0.1:8888";
+  int flows = 16, requests = 1000, connections = 4;
+  while (true) {
+    const int opt = getopt_long(argc, argv, "", command_line_options, nullptr);
+    if (opt == -1) {
+      break;
+    }
+    switch (opt) {
+    case 'h':
+      channel = optarg;
+      break;
+    case 'i':
+      infer_addr = optarg;
+      break;
+    case 'f':
+      flows = stoi(optarg);
+      break;
+    case 'n':
+      requests = stoi(optarg);
+      break;
+    case 'c':
+      connections = stoi(optarg);
+      break;
+    default:
+      usage_error(argv[0]);
+    }
+  }
+  auto colon = infer_addr.rfind(':');
+  if (colon == string::npos or flows <= 0 or requests <= 0 or
+      connections <= 0) {
+    usage_error(argv[0]);
+  }
+  Address server(infer_addr.substr(0, colon),
+                 static_cast<uint16_t>(stoi(infer_addr.substr(colon + 1))));
+  signal(SIGPIPE, SIG_IGN);
+
+  unique_ptr<InferenceClient> remote;
+  if (channel == "tcp") {
+    remote = make_unique<InferenceClient>(server, connections);
+  } else if (channel != "unix" and channel != "udp") {
+    usage_error(argv[0]);
+  }
+
+  // per-request latency in microseconds, merged after the run
+  vector<vector<double>> latencies(flows);
+  atomic<int> failures(0);
+  vector<thread> threads;
+  auto started = clock_type::now();
+  for (int i = 0; i < flows; ++i) {
+    threads.emplace_back([&, i] {
+      try {
+        unique_ptr<Channel> chan;
+        if (channel == "unix") {
+          chan = make_unique<UnixChannel>();
+        } else if (channel == "udp") {
+          chan = make_unique<UdpChannel>(server);
+        } else {
+          chan = make_unique<TcpChannel>(*remote);
+        }
+        int flow_id = chan->call(make_message(MessageType::START, i))
+                          .at("flow_id")
+                          .get<int>();
+        auto& latency = latencies[i];
+        latency.reserve(requests);
+        for (int step = 0; step < requests; ++step) {
+          auto sent = clock_type::now();
+          json reply = chan->call(
+              make_message(MessageType::ALIVE, flow_id, fake_state(step)));
+          if (reply.at("flow_id") != flow_id) {
+            failures++;
+          }
+          latency.push_back(
+              chrono::duration<double, micro>(clock_type::now() - sent)
+                  .count());
+        }
+        chan->notify(make_message(MessageType::END, flow_id));
+      } catch (const exception& e) {
+        cerr << "Flow " << i << ": " << e.what() << endl;
+        failures++;
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  double elapsed =
+      chrono::duration<double>(clock_type::now() - started).count();
+
+  vector<double> all;
+  for (auto& latency : latencies) {
+    all.insert(all.end(), latency.begin(), latency.end());
+  }
+  sort(all.begin(), all.end());
+  cout << "channel " << channel << ", " << flows << " flows";
+  if (remote) {
+    cout << " over " << connections << " connections";
+  }
+  cout << ": " << all.size() << " replies in " << fixed << setprecision(2)
+       << elapsed << "s, " << setprecision(0) << all.size() / elapsed
+       << " req/s, " << failures.load() << " failures" << endl;
+  if (all.empty()) {
+    return 1;
+  }
+  auto percentile = [&](double p) {
+    return all[min(all.size() - 1, size_t(p * all.size()))];
+  };
+  cout << setprecision(1) << "latency (us) p50 " << percentile(0.5) << " p90 "
+       << percentile(0.9) << " p99 " << percentile(0.99) << " max "
+       << all.back() << endl;
+  return failures.load() == 0 ? 0 : 1;
+}
@@ -0,0 +1,9 @@
+#ifndef ALLOC_COUNTER_HH
+#define ALLOC_COUNTER_HH
+
+#include <cstdint>
+
+/* number of operator new calls made by infer so far, all threads */
+uint64_t heap_allocations();
+
+#endif  // ALLOC_COUNTER_HH
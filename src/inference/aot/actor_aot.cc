@@ -0,0 +1,52 @@
+#include "actor_aot.hh"
+
+#include <stdexcept>
+#include <string>
+
+// generated by the tf_library rules in BUILD
+#include "tensorflow/compiler/aot/astraea/actor_b1.h"
+#include "tensorflow/compiler/aot/astraea/actor_b8.h"
+#include "tensorflow/compiler/aot/astraea/actor_b32.h"
+#include "tensorflow/compiler/aot/astraea/actor_b128.h"
+#include "tensorflow/compiler/aot/astraea/actor_b512.h"
+
+const std::vector<int>& ActorAot::batch_sizes() {
+  // keep in sync with BUILD and BATCH_SIZES in python/export_aot.py
+  static const std::vector<int> sizes = {1, 8, 32, 128, 512};
+  return sizes;
+}
+
+ActorAot::ActorAot(int batch) : batch_(batch), function_() {
+  switch (batch) {
+  case 1:
+    function_.reset(new astraea::ActorB1());
+    break;
+  case 8:
+    function_.reset(new astraea::ActorB8());
+    break;
+  case 32:
+    function_.reset(new astraea::ActorB32());
+    break;
+  case 128:
+    function_.reset(new astraea::ActorB128());
+    break;
+  case 512:
+    function_.reset(new astraea::ActorB512());
+    break;
+  default:
+    throw std::invalid_argument("No actor compiled for batches of " +
+                                std::to_string(batch));
+  }
+}
+
+ActorAot::~ActorAot() {}
+
+float* ActorAot::input() { return static_cast<float*>(function_->arg_data(0)); }
+
+const float* ActorAot::output() const {
+  return static_cast<const float*>(function_->result_data(0));
+}
+
+bool ActorAot::run() { return function_->Run(); }
+
+const char* ActorAot::error() const { return function_->error_msg().c_str(); }
@@ -0,0 +1,44 @@
+#ifndef ACTOR_AOT_HH
+#define ACTOR_AOT_HH
+
+#include <memory>
+#include <vector>
+
+namespace tensorflow {
+class XlaCompiledCpuFunction;
+}
+
+/**
+ * @brief The actor compiled ahead of time by tfcompile.
+ *
+ * Built with the functions it wraps into libactor_aot.so by
+ * scripts/build_aot_actor.sh; this header is all infer needs from it, no
+ * TensorFlow header or library comes along.
+ */
+class ActorAot {
+ public:
+  // compiled batch sizes, ascending
+  static const std::vector<int>& batch_sizes();
+
+  // batch must be one of batch_sizes()
+  explicit ActorAot(int batch);
+  ~ActorAot();
+
+  ActorAot(const ActorAot&) = delete;
+  ActorAot& operator=(const ActorAot&) = delete;
+
+  int batch() const { return batch_; }
+  // batch rows of kNNInputSize floats
+  float* input();
+  // batch actions, valid after run()
+  const float* output() const;
+
+  bool run();
+  const char* error() const;
+
+ private:
+  int batch_;
+  std::unique_ptr<tensorflow::XlaCompiledCpuFunction> function_;
+};
+
+#endif  // ACTOR_AOT_HH
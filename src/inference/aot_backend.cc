@@ -0,0 +1,44 @@
+#include "aot_backend.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+AotBackend::AotBackend() : mutex_(), variants_() {
+  for (int batch : ActorAot::batch_sizes()) {
+    variants_.emplace_back(new ActorAot(batch));
+  }
+  if (variants_.empty()) {
+    throw std::runtime_error("The AOT actor has no compiled batch size");
+  }
+}
+
+void AotBackend::run(const float* const* states, size_t batch,
+                     float* actions) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  while (batch > 0) {
+    auto fits = std::find_if(variants_.begin(), variants_.end(),
+                             [batch](const std::unique_ptr<ActorAot>& v) {
+                               return size_t(v->batch()) >= batch;
+                             });
+    ActorAot& actor = fits != variants_.end() ? **fits : *variants_.back();
+    size_t rows = std::min(batch, size_t(actor.batch()));
+
+    float* input = actor.input();
+    for (size_t i = 0; i < rows; ++i) {
+      std::memcpy(input + i * kNNInputSize, states[i],
+                  kNNInputSize * sizeof(float));
+    }
+    std::memset(input + rows * kNNInputSize, 0,
+                (actor.batch() - rows) * kNNInputSize * sizeof(float));
+    if (!actor.run()) {
+      throw std::runtime_error(std::string("Error during inference: ") +
+                               actor.error());
+    }
+    std::memcpy(actions, actor.output(), rows * sizeof(float));
+
+    states += rows;
+    actions += rows;
+    batch -= rows;
+  }
+}
@@ -0,0 +1,31 @@
+#ifndef AOT_BACKEND_HH
+#define AOT_BACKEND_HH
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "actor_aot.hh"
+#include "backend.hh"
+
+/**
+ * @brief Runs the actor compiled by tfcompile.
+ *
+ * There is one compiled function per batch size in ActorAot::batch_sizes().
+ * A batch runs on the smallest one that fits it, the rows past the batch
+ * padded with zeros; batches beyond the largest one run in several calls.
+ */
+class AotBackend : public InferenceBackend {
+ public:
+  AotBackend();
+
+  void run(const float* const* states, size_t batch, float* actions) override;
+
+ private:
+  // compiled functions keep their buffers, one call at a time
+  std::mutex mutex_;
+  // ascending batch sizes
+  std::vector<std::unique_ptr<ActorAot>> variants_;
+};
+
+#endif  // AOT_BACKEND_HH
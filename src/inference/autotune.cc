@@ -0,0 +1,233 @@
+#include "autotune.hh"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+#include "backend.hh"
+#include "timestamp.hh"
+
+// batch sizes profiled, choices never go beyond the largest one
+static const size_t kProfileBatches[] = {1, 4, 16, 64, 256, 1024};
+static const int kWarmupRuns = 5;
+static const int kProfileRuns = 50;
+
+Autotuner::Autotuner(const std::string& graph_path,
+                     const std::string& checkpoint_path)
+    : graph_path_(graph_path), checkpoint_path_(checkpoint_path), profiles_() {}
+
+std::string Autotuner::host_key() const {
+  char hostname[256] = {0};
+  gethostname(hostname, sizeof(hostname) - 1);
+  return std::string(hostname) + "/" +
+         std::to_string(std::thread::hardware_concurrency()) + " cores";
+}
+
+std::string Autotuner::model_key() const {
+  // a retrained model has another size or modification time
+  auto describe = [](const std::string& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+      return path;
+    }
+    return path + ":" + std::to_string(st.st_size) + ":" +
+           std::to_string(st.st_mtime);
+  };
+  return inferenceBackend + ":" + describe(graph_path_) + "," +
+         describe(checkpoint_path_ + ".index");
+}
+
+bool Autotuner::load(const std::string& path) {
+  std::ifstream file(path);
+  if (!file) {
+    return false;
+  }
+  json saved = json::parse(file, nullptr, false);
+  if (saved.is_discarded() or saved.value("host", "") != host_key() or
+      saved.value("model", "") != model_key()) {
+    return false;
+  }
+  profiles_.clear();
+  for (auto& entry : saved.at("profiles")) {
+    ThreadProfile profile;
+    profile.intra_op_threads = entry.at("intra_op_threads");
+    profile.inter_op_threads = entry.at("inter_op_threads");
+    profile.fixed_us = entry.at("fixed_us");
+    profile.per_request_us = entry.at("per_request_us");
+    for (auto& latency : entry.at("latencies")) {
+      profile.latencies.push_back(
+          {latency.at("batch"), latency.at("p50_us"), latency.at("p99_us")});
+    }
+    profiles_.push_back(profile);
+  }
+  return !profiles_.empty();
+}
+
+void Autotuner::save(const std::string& path) const {
+  json saved;
+  saved["host"] = host_key();
+  saved["model"] = model_key();
+  saved["profiles"] = json::array();
+  for (auto& profile : profiles_) {
+    json entry;
+    entry["intra_op_threads"] = profile.intra_op_threads;
+    entry["inter_op_threads"] = profile.inter_op_threads;
+    entry["fixed_us"] = profile.fixed_us;
+    entry["per_request_us"] = profile.per_request_us;
+    entry["latencies"] = json::array();
+    for (auto& latency : profile.latencies) {
+      entry["latencies"].push_back({{"batch", latency.batch},
+                                    {"p50_us", latency.p50_us},
+                                    {"p99_us", latency.p99_us}});
+    }
+    saved["profiles"].push_back(entry);
+  }
+  std::ofstream file(path);
+  if (!file) {
+    std::cerr << "Cannot save the autotune profile to " << path << std::endl;
+    return;
+  }
+  file << saved.dump(2) << std::endl;
+}
+
+void Autotuner::profile() {
+  const int cores = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<int> intra_options, inter_options;
+  if (inferenceBackend == "session") {
+    for (int threads = 1; threads < cores; threads *= 2) {
+      intra_options.push_back(threads);
+    }
+    intra_options.push_back(cores);
+    inter_options = {1, 2};
+  } else {
+    // the compiled actor runs on the calling thread
+    intra_options = {0};
+    inter_options = {0};
+  }
+
+  profiles_.clear();
+  for (int inter : inter_options) {
+    for (int intra : intra_options) {
+      profiles_.push_back(measure(intra, inter));
+      auto& profile = profiles_.back();
+      std::cout << "Autotune: " << intra << " intra-op / " << inter
+                << " inter-op threads, batch p99 ~ " << profile.fixed_us
+                << "us + " << profile.per_request_us << "us per request"
+                << std::endl;
+    }
+  }
+}
+
+ThreadProfile Autotuner::measure(int intra_op_threads,
+                                 int inter_op_threads) const {
+  auto backend =
+      InferenceBackend::Create(inferenceBackend, graph_path_, checkpoint_path_,
+                               intra_op_threads, inter_op_threads);
+  ThreadProfile profile;
+  profile.intra_op_threads = intra_op_threads;
+  profile.inter_op_threads = inter_op_threads;
+
+  std::mt19937 rng(0);
+  std::uniform_real_distribution<float> dist(0, 1);
+  std::vector<NNInput> inputs(kProfileBatches[std::size(kProfileBatches) - 1]);
+  std::vector<const float*> states;
+  for (auto& input : inputs) {
+    std::generate(input.begin(), input.end(), [&] { return dist(rng); });
+    states.push_back(input.data());
+  }
+  std::vector<float> actions(inputs.size());
+  for (size_t batch : kProfileBatches) {
+    std::vector<uint64_t> durations;
+    for (int i = 0; i < kWarmupRuns + kProfileRuns; ++i) {
+      uint64_t begin = monotonic_nsecs();
+      backend->run(states.data(), batch, actions.data());
+      if (i >= kWarmupRuns) {
+        durations.push_back(monotonic_nsecs() - begin);
+      }
+    }
+    std::sort(durations.begin(), durations.end());
+    profile.latencies.push_back({batch, durations[kProfileRuns / 2] / 1e3,
+                                 durations[kProfileRuns * 99 / 100] / 1e3});
+  }
+  // least squares line through the p99s, kept non-negative
+  double n = profile.latencies.size(), sum_x = 0, sum_y = 0, sum_xx = 0,
+         sum_xy = 0;
+  for (auto& latency : profile.latencies) {
+    sum_x += latency.batch;
+    sum_y += latency.p99_us;
+    sum_xx += double(latency.batch) * latency.batch;
+    sum_xy += latency.batch * latency.p99_us;
+  }
+  double slope = (n * sum_xy - sum_x * sum_y) / (n * sum_xx - sum_x * sum_x);
+  profile.per_request_us = std::max(0.0, slope);
+  profile.fixed_us =
+      std::max(0.0, (sum_y - profile.per_request_us * sum_x) / n);
+  return profile;
+}
+
+TuningChoice Autotuner::choose(double target_p99_us, bool batch) const {
+  if (profiles_.empty()) {
+    throw std::runtime_error("Autotune: nothing profiled");
+  }
+  TuningChoice best;
+  // the fastest setting for a single request, also the fallback
+  auto fastest = std::min_element(
+      profiles_.begin(), profiles_.end(),
+      [](const ThreadProfile& a, const ThreadProfile& b) {
+        return a.batch_p99_us(1) < b.batch_p99_us(1);
+      });
+  if (!batch) {
+    // every request runs alone on its session thread
+    best.intra_op_threads = fastest->intra_op_threads;
+    best.inter_op_threads = fastest->inter_op_threads;
+    best.batch_interval = batchInterval;
+    best.max_batch_size = maxBatchSize;
+    best.p99_us = fastest->batch_p99_us(1);
+    best.requests_per_sec = 1e6 / best.p99_us;
+    best.meets_target = best.p99_us <= target_p99_us;
+    return best;
+  }
+
+  const size_t largest = kProfileBatches[std::size(kProfileBatches) - 1];
+  for (auto& profile : profiles_) {
+    for (size_t cap = 1; cap <= largest; cap *= 2) {
+      double run_us = profile.batch_p99_us(cap);
+      double interval = target_p99_us - 2 * run_us;
+      if (interval < kMinBatchInterval) {
+        break;
+      }
+      double requests_per_sec = cap * 1e6 / (interval + run_us);
+      // more threads only if they buy noticeably more throughput
+      if (requests_per_sec > best.requests_per_sec * 1.01) {
+        best.intra_op_threads = profile.intra_op_threads;
+        best.inter_op_threads = profile.inter_op_threads;
+        best.batch_interval = static_cast<size_t>(interval);
+        best.max_batch_size = cap;
+        best.p99_us = interval + 2 * run_us;
+        best.requests_per_sec = requests_per_sec;
+        best.meets_target = true;
+      }
+    }
+  }
+  if (!best.meets_target) {
+    best.intra_op_threads = fastest->intra_op_threads;
+    best.inter_op_threads = fastest->inter_op_threads;
+    best.batch_interval = kMinBatchInterval;
+    best.max_batch_size = 1;
+    best.p99_us = kMinBatchInterval + 2 * fastest->batch_p99_us(1);
+    best.requests_per_sec = 1e6 / (kMinBatchInterval + fastest->batch_p99_us(1));
+  }
+  return best;
+}
+
+void Autotuner::apply(const TuningChoice& choice) {
+  intraOpThreads = choice.intra_op_threads;
+  interOpThreads = choice.inter_op_threads;
+  batchInterval = choice.batch_interval;
+  maxBatchSize = choice.max_batch_size;
+}
@@ -0,0 +1,88 @@
+#ifndef AUTOTUNE_HH
+#define AUTOTUNE_HH
+
+#include <string>
+#include <vector>
+
+#include "define.hh"
+
+/* Session::Run latency of one batch size */
+struct BatchLatency {
+  size_t batch;
+  double p50_us;
+  double p99_us;
+};
+
+/* latencies under one thread setting, and the line fitted through them */
+struct ThreadProfile {
+  int intra_op_threads = 0;
+  int inter_op_threads = 0;
+  std::vector<BatchLatency> latencies{};
+  // p99 latency of a batch of n is about fixed_us + n * per_request_us
+  double fixed_us = 0;
+  double per_request_us = 0;
+
+  double batch_p99_us(size_t batch) const {
+    return fixed_us + batch * per_request_us;
+  }
+};
+
+/* parameters picked for a target p99, with what the model predicts for them */
+struct TuningChoice {
+  int intra_op_threads = 0;
+  int inter_op_threads = 0;
+  size_t batch_interval = 0;
+  size_t max_batch_size = 0;
+  double p99_us = 0;
+  double requests_per_sec = 0;
+  // false if nothing met the target and this is the fastest setting instead
+  bool meets_target = false;
+};
+
+/**
+ * @brief Picks the batching and threading parameters of infer for this host.
+ *
+ * Profiles the model under every intra/inter-op thread setting worth trying,
+ * fits the p99 batch latency as a line in the batch size, and looks for the
+ * setting that serves the most requests per second while a request still
+ * gets its reply within the target p99. The profile is saved with the host
+ * and model it was made on, so later starts only redo the choice.
+ *
+ * A request that just missed a batch waits for that batch, the batch
+ * interval and its own batch, so its latency is bounded by
+ * interval + 2 * batch_p99(max_batch_size), and the loop serves at most
+ * max_batch_size requests every interval + batch_p99(max_batch_size).
+ */
+class Autotuner {
+ public:
+  Autotuner(const std::string& graph_path, const std::string& checkpoint_path);
+
+  /* use a saved profile, if it was made on this host for this model */
+  bool load(const std::string& path);
+  void save(const std::string& path) const;
+
+  /* measure the model under every thread setting, takes a few seconds */
+  void profile();
+
+  TuningChoice choose(double target_p99_us, bool batch) const;
+
+  /* set batchInterval, maxBatchSize and the thread pools */
+  static void apply(const TuningChoice& choice);
+
+  const std::vector<ThreadProfile>& profiles() const { return profiles_; }
+
+  // shortest batch interval worth sleeping for
+  static const size_t kMinBatchInterval = 100;
+
+ private:
+  ThreadProfile measure(int intra_op_threads, int inter_op_threads) const;
+  std::string host_key() const;
+  std::string model_key() const;
+
+ private:
+  std::string graph_path_;
+  std::string checkpoint_path_;
+  std::vector<ThreadProfile> profiles_;
+};
+
+#endif  // AUTOTUNE_HH
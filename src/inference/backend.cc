@@ -0,0 +1,37 @@
+#include "backend.hh"
+
+#include <stdexcept>
+
+#ifdef AOT_BACKEND
+#include "aot_backend.hh"
+#endif
+#include "native_backend.hh"
+#ifdef SESSION_BACKEND
+#include "session_backend.hh"
+#endif
+
+std::unique_ptr<InferenceBackend> InferenceBackend::Create(
+    const std::string& name, [[maybe_unused]] const std::string& graph_path,
+    const std::string& checkpoint_path,
+    [[maybe_unused]] int intra_op_threads,
+    [[maybe_unused]] int inter_op_threads) {
+#ifdef SESSION_BACKEND
+  if (name == "session") {
+    return std::make_unique<SessionBackend>(graph_path, checkpoint_path,
+                                            intra_op_threads,
+                                            inter_op_threads);
+  }
+#endif
+#ifdef AOT_BACKEND
+  if (name == "aot") {
+    // the weights are compiled in, the model files are not read
+    return std::make_unique<AotBackend>();
+  }
+#endif
+  if (name == "native") {
+    return std::make_unique<NativeBackend>(checkpoint_path +
+                                           kNativeWeightsSuffix);
+  }
+  throw std::runtime_error("Inference backend " + name +
+                           " is not part of this build");
+}
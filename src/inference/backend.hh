@@ -0,0 +1,51 @@
+#ifndef BACKEND_HH
+#define BACKEND_HH
+
+#include <memory>
+#include <string>
+
+#include "define.hh"
+
+/**
+ * @brief What runs the actor for TFInference.
+ *
+ * "session" interprets the exported meta graph with a TensorFlow session,
+ * "aot" calls the actor compiled ahead of time by tfcompile (see
+ * scripts/build_aot_actor.sh), "native" evaluates the weights written by
+ * python/export_native.py in plain C++. Which of the first two exist depends
+ * on the build.
+ */
+class InferenceBackend {
+ public:
+  virtual ~InferenceBackend() {}
+
+  /* write the action of the row states[i] to actions[i], for batch rows */
+  virtual void run(const float* const* states, size_t batch,
+                   float* actions) = 0;
+
+  /* units of the first layer if the backend can start from fc1 partial sums
+   * cached per flow (see Fc1Cache), 0 otherwise */
+  virtual size_t fc1_units() const { return 0; }
+
+  /* add the fc1 product of one state sitting at window slot `slot` to out,
+   * fc1_units() floats */
+  virtual void add_fc1_slot(const float* /* state */, size_t /* slot */,
+                            float* /* out */) const {}
+
+  /* like run(), for rows holding the fc1 product of the whole window */
+  virtual void run_fc1(const float* const* /* fc1 */, size_t /* batch */,
+                       float* /* actions */) {}
+
+  /**
+   * @brief Create the backend called name
+   *
+   * @param intra_op_threads thread pools of the session backend, 0 for
+   * TensorFlow's default, as inter_op_threads
+   */
+  static std::unique_ptr<InferenceBackend> Create(
+      const std::string& name, const std::string& graph_path,
+      const std::string& checkpoint_path, int intra_op_threads = 0,
+      int inter_op_threads = 0);
+};
+
+#endif  // BACKEND_HH
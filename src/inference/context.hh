@@ -1,27 +1,46 @@
 #ifndef CONTEXT_HH
 #define CONTEXT_HH
 
+#include <chrono>
+
 #include "define.hh"
+#include "fc1_cache.hh"
 #include "tf_inference.hh"
 
-int map_action(float action, float cwnd);
-
 class FlowContext {
  public:
-  FlowContext(int flow_id);
+  FlowContext(int64_t flow_id);
+  // resume a flow whose window was handed over by another infer process
+  FlowContext(int64_t flow_id, const NNInput& window);
 
-  // get new cwnd from model
-  std::vector<float> format_state(json& data);
+  // push the new state into the sliding window and return the window,
+  // skipped are the intervals a plan ran through without reporting
+  const NNInput& format_state(const DeepCCState& state, int skipped = 0);
 
- private:
-  void transform_state(json& state_dict);
+  int64_t flow_id() const { return flow_id_; }
+  // the connection or UDP peer using the id, 0 until one claims it
+  uint64_t owner() const { return owner_; }
+  void set_owner(uint64_t owner) {
+    owner_ = owner;
+    if (owner == 0) {
+      unclaimed_since_ = std::chrono::steady_clock::now();
+    }
+  }
+  // when the context was created or its owner went away, if owner() is 0
+  std::chrono::steady_clock::time_point unclaimed_since() const {
+    return unclaimed_since_;
+  }
+  const NNInput& window() const { return state_; }
+  Fc1Cache& fc1_cache() { return fc1_cache_; }
 
  private:
-  int flow_id_;
-  // 1 * 10
-  std::vector<float> current_;
+  int64_t flow_id_;
+  uint64_t owner_;
+  std::chrono::steady_clock::time_point unclaimed_since_;
   // 1 * 50
-  std::vector<float> state_;
+  NNInput state_;
+  // fc1 partial sums of the window, only filled with --incremental
+  Fc1Cache fc1_cache_;
 };
 
 #endif  // CONTEXT_HH
\ No newline at end of file
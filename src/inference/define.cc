@@ -2,10 +2,30 @@
 
 std::string graphPath = "models/my-model.meta";
 std::string checkpointPath = "models/my-model";
+#if defined(SESSION_BACKEND)
+std::string inferenceBackend = "session";
+#elif defined(AOT_BACKEND)
+std::string inferenceBackend = "aot";
+#else
+std::string inferenceBackend = "native";
+#endif
 int batchMode = false;
 std::string channel = "unix";
+bool stageTracing = true;
+bool perfCounters = false;
+bool globalAggregation = false;
+size_t batchInterval = 5000;
+bool alignedBatches = false;
+double targetLoad = 0;
+size_t maxBatchSize = 0;
+int intraOpThreads = 0;
+int interOpThreads = 0;
+int maxPlanSteps = 8;
+double planRttSlack = 0.25;
+bool incrementalFc1 = false;
+bool verifyIncremental = false;
 
-std::string print_state(const std::vector<float>& state) {
+std::string print_state(const NNInput& state) {
   std::string str = "[";
   for (auto& s : state) {
     str += std::to_string(s) + ", ";
@@ -1,9 +1,12 @@
 #ifndef DEFINE_HH
 #define DEFINE_HH
 
+#include <array>
 #include <iostream>
 #include <string>
 
+#include "feature.hh"
+#include "inplace_function.hh"
 #include "json.hpp"
 
 using json = nlohmann::json;
@@ -13,22 +16,52 @@ using json = nlohmann::json;
 #define likely(x) __builtin_expect(!!(x), 1)
 #define unlikely(x) __builtin_expect(!!(x), 0)
 
-typedef std::function<void(float, const std::string&)> ResponseCallback;
+// kept inline so that handing a reply callback around never allocates
+typedef InplaceFunction<void(float, const std::string&)> ResponseCallback;
 
-const size_t kStateSize = 10;
-const size_t kRecurrentNum = 5;
-const size_t kNNInputSize = 50;
+// actor input of one flow, the last kRecurrentNum states
+typedef std::array<float, kNNInputSize> NNInput;
 
-// 3000us batch
-const size_t kBatchInterval = 5000;
+// pause between two batches in microseconds, set by --batch-interval or
+// --autotune
+extern size_t batchInterval;
+// start batches on a fixed cadence of batchInterval that clients can align
+// their ticks to, set by --aligned-batches
+extern bool alignedBatches;
+// busy fraction of the batch thread above which replies ask clients to
+// query less often, 0 to never ask, set by --target-load
+extern double targetLoad;
+// most requests served by one batch, 0 for no limit
+extern size_t maxBatchSize;
+// TensorFlow intra/inter-op thread pools, 0 for TensorFlow's default
+extern int intraOpThreads;
+extern int interOpThreads;
 
 extern std::string graphPath;
 extern std::string checkpointPath;
 
-// use UDP or UNIX socket
+// what runs the actor, "session", "aot" or "native"
+extern std::string inferenceBackend;
+
+// use UDP, TCP or UNIX socket
 extern std::string channel;
 
 extern int batchMode;
-std::string print_state(const std::vector<float>& state);
+
+// record per-stage timestamps of every request, dumped on SIGUSR1
+extern bool stageTracing;
+// read cycles/instructions/LLC misses around every inference call
+extern bool perfCounters;
+// count the state of every ALIVE in the global state, not only OBSERVEs
+extern bool globalAggregation;
+// longest plan handed out for an ALIVE with "plan", set by --max-plan
+extern int maxPlanSteps;
+// relative RTT inflation and loss increase before a client drops its plan
+extern double planRttSlack;
+// start from fc1 sums cached per flow, see Fc1Cache, and with
+// verifyIncremental check every action against a full evaluation
+extern bool incrementalFc1;
+extern bool verifyIncremental;
+std::string print_state(const NNInput& state);
 
 #endif  // DEFINE_HH
\ No newline at end of file
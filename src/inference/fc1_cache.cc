@@ -0,0 +1,43 @@
+#include "fc1_cache.hh"
+
+#include <algorithm>
+#include <cstring>
+
+void Fc1Cache::update(const InferenceBackend& backend, const NNInput& window,
+                      float* out) {
+  const size_t units = backend.fc1_units();
+  const size_t last = kRecurrentNum - 1;
+  bool shifted = units_ == units and
+                 std::memcmp(&window_[kStateSize], window.data(),
+                             (kNNInputSize - kStateSize) * sizeof(float)) == 0;
+  if (shifted) {
+    // the current tick's row is used up, it becomes the last one ahead
+    std::fill(sums(0), sums(0) + units, 0.f);
+    head_ = (head_ + 1) % kRecurrentNum;
+    const float* state = &window[last * kStateSize];
+    for (size_t ahead = 0; ahead <= last; ++ahead) {
+      backend.add_fc1_slot(state, last - ahead, sums(ahead));
+    }
+  } else {
+    units_ = units;
+    head_ = 0;
+    sums_.assign(kRecurrentNum * units, 0.f);
+    // the state in slot k sits in slot k - ahead that many ticks from now
+    for (size_t slot = 0; slot <= last; ++slot) {
+      const float* state = &window[slot * kStateSize];
+      for (size_t ahead = 0; ahead <= slot; ++ahead) {
+        backend.add_fc1_slot(state, slot - ahead, sums(ahead));
+      }
+    }
+  }
+  window_ = window;
+  std::copy(sums(0), sums(0) + units, out);
+}
+
+void Fc1Cache::compute(const InferenceBackend& backend, const NNInput& window,
+                       float* out) {
+  std::fill(out, out + backend.fc1_units(), 0.f);
+  for (size_t slot = 0; slot < kRecurrentNum; ++slot) {
+    backend.add_fc1_slot(&window[slot * kStateSize], slot, out);
+  }
+}
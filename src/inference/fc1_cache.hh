@@ -0,0 +1,50 @@
+#ifndef FC1_CACHE_HH
+#define FC1_CACHE_HH
+
+#include <vector>
+
+#include "backend.hh"
+#include "define.hh"
+
+// widest first layer whose product a request can carry
+const size_t kMaxFc1Units = 256;
+typedef std::array<float, kMaxFc1Units> Fc1Product;
+
+/**
+ * @brief Pipelined fc1 partial sums of one flow's window, see --incremental.
+ *
+ * fc1 is linear, so its product over the window is the sum of the products
+ * of each state with the weights of the slot it sits in. When a state
+ * arrives, its products with all kRecurrentNum slot weights are added to the
+ * sums of the ticks it will take part in. The slot weights differ, so that
+ * is as many multiply-adds as one full product, but they are done on the
+ * thread that received the state instead of in the batch. A window that did
+ * not move by exactly one state (a new or handed over flow, intervals
+ * skipped by a plan) rebuilds the sums.
+ */
+class Fc1Cache {
+ public:
+  Fc1Cache() : window_(), sums_(), head_(0) {}
+
+  /* write fc1's product for window, without bias, into out */
+  void update(const InferenceBackend& backend, const NNInput& window,
+              float* out);
+
+  /* the same product without a cache, for windows that come with the
+   * request; allocates nothing */
+  static void compute(const InferenceBackend& backend, const NNInput& window,
+                      float* out);
+
+ private:
+  float* sums(size_t ticks_ahead) {
+    return &sums_[((head_ + ticks_ahead) % kRecurrentNum) * units_];
+  }
+
+  NNInput window_;
+  // kRecurrentNum rows of units_, the row head_ is the current tick
+  std::vector<float> sums_;
+  size_t head_;
+  size_t units_ = 0;
+};
+
+#endif  // FC1_CACHE_HH
@@ -0,0 +1,103 @@
+#include "global_state.hh"
+
+void GlobalState::update(int64_t flow_id, int group,
+                         const DeepCCState& state) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = flows_.find(flow_id);
+  if (it != flows_.end()) {
+    subtract(it->second);
+    if (group < 0) {
+      group = it->second.group;
+    }
+  } else {
+    it = flows_.emplace(flow_id, FlowSample()).first;
+  }
+  FlowSample& sample = it->second;
+  sample.group = group < 0 ? 0 : group;
+  sample.avg_thr = state.avg_thr;
+  sample.avg_urtt = state.avg_urtt;
+  sample.cwnd = state.cwnd;
+  sample.min_rtt = state.min_rtt;
+  sample.loss_ratio = state.loss_ratio;
+  add(sample);
+}
+
+void GlobalState::remove(int64_t flow_id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = flows_.find(flow_id);
+  if (it == flows_.end()) {
+    return;
+  }
+  subtract(it->second);
+  flows_.erase(it);
+}
+
+void GlobalState::add(const FlowSample& sample) {
+  auto& aggregate = groups_[sample.group];
+  aggregate.flows++;
+  aggregate.sum_thr += sample.avg_thr;
+  aggregate.sum_urtt += sample.avg_urtt;
+  aggregate.sum_cwnd += sample.cwnd;
+  aggregate.sum_loss += sample.loss_ratio;
+  aggregate.thr.insert(sample.avg_thr);
+  aggregate.cwnd.insert(sample.cwnd);
+  if (sample.min_rtt > 0) {
+    aggregate.min_rtt.insert(sample.min_rtt);
+  }
+}
+
+void GlobalState::subtract(const FlowSample& sample) {
+  auto& aggregate = groups_[sample.group];
+  if (--aggregate.flows == 0) {
+    // also drops the rounding the loss sum has gathered
+    groups_.erase(sample.group);
+    return;
+  }
+  aggregate.sum_thr -= sample.avg_thr;
+  aggregate.sum_urtt -= sample.avg_urtt;
+  aggregate.sum_cwnd -= sample.cwnd;
+  aggregate.sum_loss -= sample.loss_ratio;
+  aggregate.thr.erase(aggregate.thr.find(sample.avg_thr));
+  aggregate.cwnd.erase(aggregate.cwnd.find(sample.cwnd));
+  if (sample.min_rtt > 0) {
+    aggregate.min_rtt.erase(aggregate.min_rtt.find(sample.min_rtt));
+  }
+}
+
+json GlobalState::query(int group) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  json reply;
+  reply["group"] = group;
+  auto it = groups_.find(group);
+  if (it == groups_.end()) {
+    reply["flows"] = 0;
+    reply["global_state"] = json::array();
+    return reply;
+  }
+  const auto& aggregate = it->second;
+  const double flows = aggregate.flows;
+  reply["flows"] = aggregate.flows;
+  reply["sum_thr"] = aggregate.sum_thr;
+  reply["min_thr"] = *aggregate.thr.begin();
+  reply["max_thr"] = *aggregate.thr.rbegin();
+  reply["avg_urtt"] = aggregate.sum_urtt / flows;
+  reply["min_rtt"] =
+      aggregate.min_rtt.empty() ? 0 : *aggregate.min_rtt.begin();
+  reply["min_cwnd"] = *aggregate.cwnd.begin();
+  reply["max_cwnd"] = *aggregate.cwnd.rbegin();
+  reply["avg_cwnd"] = aggregate.sum_cwnd / flows;
+  reply["avg_loss"] = aggregate.sum_loss / flows;
+  // normalised like transform_state() in python/agent/definitions.py
+  reply["global_state"] = {
+      aggregate.sum_thr / 5e7,
+      *aggregate.thr.begin() / 5e7,
+      *aggregate.thr.rbegin() / 5e7,
+      aggregate.sum_urtt / flows / 5e5,
+      *aggregate.cwnd.begin() / 1000.0,
+      *aggregate.cwnd.rbegin() / 1000.0,
+      aggregate.sum_cwnd / flows / 1000.0,
+      aggregate.sum_loss / flows / 1e6,
+      flows / 10,
+  };
+  return reply;
+}
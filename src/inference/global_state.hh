@@ -0,0 +1,77 @@
+#ifndef GLOBAL_STATE_HH
+#define GLOBAL_STATE_HH
+
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+
+#include "define.hh"
+
+/* running aggregates of the flows sharing one bottleneck */
+struct GroupAggregate {
+  uint32_t flows = 0;
+  uint64_t sum_thr = 0;
+  uint64_t sum_urtt = 0;
+  uint64_t sum_cwnd = 0;
+  double sum_loss = 0;
+  // the extremes stay O(1) to read while flows come, change and go
+  std::multiset<uint32_t> thr{};
+  std::multiset<uint32_t> cwnd{};
+  // flows that have measured their min RTT
+  std::multiset<uint32_t> min_rtt{};
+};
+
+/**
+ * @brief Global state of every bottleneck group, kept up to date flow by
+ * flow.
+ *
+ * Each update replaces the flow's previous sample in its group's sums and
+ * ordered sets, so a query reads the aggregates directly instead of
+ * visiting every flow. Flows join the group named by the "group" key of
+ * their messages, 0 by default.
+ */
+class GlobalState {
+ public:
+  static GlobalState* Get() {
+    static GlobalState global_state;
+    return &global_state;
+  }
+
+  /* replace the last sample of flow_id, group -1 keeps the flow's group */
+  void update(int64_t flow_id, int group, const DeepCCState& state);
+  void remove(int64_t flow_id);
+
+  /**
+   * @brief The aggregates of group
+   *
+   * @return json the raw aggregates and "global_state", the first nine
+   * global features of agent/definitions.py (the last three describe the
+   * link and are up to the caller)
+   */
+  json query(int group);
+
+ private:
+  struct FlowSample {
+    int group;
+    uint32_t avg_thr;
+    uint32_t avg_urtt;
+    uint32_t cwnd;
+    uint32_t min_rtt;
+    double loss_ratio;
+  };
+
+  GlobalState() : mutex_(), flows_(), groups_() {}
+  GlobalState(const GlobalState&) = delete;
+  GlobalState& operator=(const GlobalState&) = delete;
+
+  void add(const FlowSample& sample);
+  void subtract(const FlowSample& sample);
+
+ private:
+  std::mutex mutex_;
+  std::unordered_map<int64_t, FlowSample> flows_;
+  std::unordered_map<int, GroupAggregate> groups_;
+};
+
+#endif  // GLOBAL_STATE_HH
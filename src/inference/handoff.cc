@@ -0,0 +1,172 @@
+#include "handoff.hh"
+
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <iostream>
+
+#include <boost/bind.hpp>
+
+#include "exception.hh"
+#include "server.hh"
+
+namespace {
+
+std::string put_uint32(uint32_t n) {
+  n = htonl(n);
+  return std::string(reinterpret_cast<const char*>(&n), sizeof(n));
+}
+
+uint32_t get_uint32(const std::string& data) {
+  uint32_t n;
+  std::memcpy(&n, data.data(), sizeof(n));
+  return ntohl(n);
+}
+
+}  // namespace
+
+/*
+ * Wire format, old to new:
+ *   1. 4-byte length of the json below, carrying the listener fd
+ *   2. json: channel, pending bytes of every session, flow contexts
+ *   3. per batch of at most IPCSocket::kMaxFds sessions, a 4-byte count
+ *      carrying their fds, in the order of the json
+ * and new to old a single byte once everything has been adopted.
+ */
+void send_handoff(IPCSocket& peer, const HandoffState& state) {
+  json doc;
+  doc["channel"] = state.channel;
+  doc["sessions"] = json::array();
+  for (auto& session : state.sessions) {
+    doc["sessions"].push_back(
+        std::vector<uint8_t>(session.pending.begin(), session.pending.end()));
+  }
+  doc["contexts"] = json::array();
+  for (auto& context : state.contexts) {
+    doc["contexts"].push_back(
+        {{"flow_id", context.first}, {"window", context.second}});
+  }
+  std::string body = doc.dump();
+
+  peer.send_fds(put_uint32(body.size()), {state.listener_fd});
+  peer.write(body);
+  for (size_t i = 0; i < state.sessions.size(); i += IPCSocket::kMaxFds) {
+    std::vector<int> fds;
+    for (size_t j = i; j < std::min(i + IPCSocket::kMaxFds,
+                                    state.sessions.size());
+         ++j) {
+      fds.push_back(state.sessions[j].fd);
+    }
+    peer.send_fds(put_uint32(fds.size()), fds);
+  }
+}
+
+HandoffState receive_handoff(IPCSocket& peer) {
+  HandoffState state;
+  std::vector<int> fds;
+  uint32_t body_len = get_uint32(peer.recv_fds(sizeof(uint32_t), fds));
+  if (fds.size() != 1) {
+    throw std::runtime_error("handoff: expected the listener fd");
+  }
+  state.listener_fd = fds[0];
+
+  json doc = json::parse(peer.read_exactly(body_len));
+  state.channel = doc.at("channel");
+  for (auto& pending : doc.at("sessions")) {
+    auto bytes = pending.get<std::vector<uint8_t>>();
+    state.sessions.push_back({-1, std::string(bytes.begin(), bytes.end())});
+  }
+  for (auto& context : doc.at("contexts")) {
+    state.contexts.emplace_back(context.at("flow_id").get<int64_t>(),
+                                context.at("window").get<NNInput>());
+  }
+
+  fds.clear();
+  while (fds.size() < state.sessions.size()) {
+    size_t before = fds.size();
+    uint32_t count = get_uint32(peer.recv_fds(sizeof(uint32_t), fds));
+    if (fds.size() - before != count) {
+      throw std::runtime_error("handoff: session fds went missing");
+    }
+  }
+  if (fds.size() != state.sessions.size()) {
+    throw std::runtime_error("handoff: too many session fds");
+  }
+  for (size_t i = 0; i < fds.size(); ++i) {
+    state.sessions[i].fd = fds[i];
+  }
+  return state;
+}
+
+void ack_handoff(IPCSocket& peer) { peer.write(std::string(1, 'K')); }
+
+HandoffListener::HandoffListener(boost::asio::io_service& io_service,
+                                 Server& server,
+                                 std::function<void()> on_handed_off)
+    : server_(server),
+      on_handed_off_(std::move(on_handed_off)),
+      acceptor_(io_service),
+      peer_(io_service) {
+  // a process that took over removes the listener of the one it replaced
+  ::unlink(kHandoffSocketPath.c_str());
+  boost::asio::local::stream_protocol::endpoint endpoint(kHandoffSocketPath);
+  acceptor_.open(endpoint.protocol());
+  acceptor_.bind(endpoint);
+  acceptor_.listen();
+  accept();
+}
+
+void HandoffListener::accept() {
+  acceptor_.async_accept(peer_,
+                         boost::bind(&HandoffListener::handle_accept, this,
+                                     boost::asio::placeholders::error));
+}
+
+void HandoffListener::handle_accept(const boost::system::error_code& error) {
+  if (error) {
+    std::cerr << "Handoff accept error: " << error.message() << std::endl;
+    return;
+  }
+  std::cout << "New infer process connected, pausing for handoff" << std::endl;
+  server_.pause([this] { hand_off(); });
+}
+
+void HandoffListener::hand_off() {
+  bool handed_off = false;
+  try {
+    // blocking and brief: the server is paused anyway
+    IPCSocket peer(
+        FileDescriptor(SystemCall("dup", ::dup(peer_.native_handle()))),
+        AF_UNIX, SOCK_STREAM);
+    peer.set_blocking(true);
+    HandoffState state;
+    server_.export_state(state);
+    send_handoff(peer, state);
+
+    pollfd pfd = {peer.fd_num(), POLLIN, 0};
+    int ready = SystemCall("poll", ::poll(&pfd, 1, kHandoffTimeoutMs));
+    if (ready == 0) {
+      std::cerr << "Handoff timed out" << std::endl;
+    } else if (peer.read(1) == "K") {
+      std::cout << "Handed off " << state.sessions.size() << " sessions and "
+                << state.contexts.size() << " flows" << std::endl;
+      handed_off = true;
+    } else {
+      std::cerr << "Handoff rejected by the new process" << std::endl;
+    }
+  } catch (const std::exception& e) {
+    std::cerr << "Handoff failed: " << e.what() << std::endl;
+  }
+  peer_.close();
+
+  if (handed_off) {
+    acceptor_.close();
+    on_handed_off_();
+  } else {
+    std::cout << "Resuming service" << std::endl;
+    server_.resume();
+    accept();
+  }
+}
@@ -0,0 +1,83 @@
+#ifndef HANDOFF_HH
+#define HANDOFF_HH
+
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "define.hh"
+#include "ipc_socket.hh"
+
+/*
+ * Zero-downtime restart. A running infer listens on kHandoffSocketPath; a new
+ * binary started with --takeover connects to it, warms up its model and
+ * receives the client-facing listening socket, every established session and
+ * the per-flow feature windows. Clients keep their connections and never
+ * notice. The old process then replies to what it still has in flight and
+ * exits.
+ */
+const std::string kHandoffSocketPath = "/tmp/astraea.handoff.sock";
+
+// how long the old process waits for the new one to adopt the state
+const int kHandoffTimeoutMs = 5000;
+
+/* an established client connection, paused between reads */
+struct SessionHandoff {
+  int fd;
+  // bytes of a frame that was only partially read when the session paused
+  std::string pending;
+};
+
+struct HandoffState {
+  // "unix" or "udp", the new process follows the old one
+  std::string channel{};
+  // the listening unix socket, or the bound UDP socket
+  int listener_fd = -1;
+  std::vector<SessionHandoff> sessions{};
+  // flow id and sliding window of every flow
+  std::vector<std::pair<int64_t, NNInput>> contexts{};
+};
+
+/**
+ * @brief Send the state, fds travel with SCM_RIGHTS. The sender keeps its own
+ * copies of the fds open.
+ */
+void send_handoff(IPCSocket& peer, const HandoffState& state);
+
+/* blocks until the whole state is in, throws on a malformed handoff */
+HandoffState receive_handoff(IPCSocket& peer);
+
+/* tell the old process that the state has been adopted */
+void ack_handoff(IPCSocket& peer);
+
+class Server;
+
+/**
+ * @brief Hands the server over to the next infer that connects to
+ * kHandoffSocketPath.
+ *
+ * The server is paused on the io thread so that no session is in the middle
+ * of a read. If the new process goes away before acknowledging, the server
+ * resumes as if nothing happened.
+ */
+class HandoffListener {
+ public:
+  HandoffListener(boost::asio::io_service& io_service, Server& server,
+                  std::function<void()> on_handed_off);
+
+ private:
+  void accept();
+  void handle_accept(const boost::system::error_code& error);
+  void hand_off();
+
+ private:
+  Server& server_;
+  std::function<void()> on_handed_off_;
+  boost::asio::local::stream_protocol::acceptor acceptor_;
+  boost::asio::local::stream_protocol::socket peer_;
+};
+
+#endif  // HANDOFF_HH
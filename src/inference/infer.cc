@@ -1,18 +1,37 @@
 #include <getopt.h>
 #include <signal.h>
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <memory>
+#include <random>
 #include <unordered_map>
 #include <unordered_set>
 
 #include <boost/asio.hpp>
 
+#include "autotune.hh"
 #include "define.hh"
+#include "handoff.hh"
+#include "native_backend.hh"
+#include "plan.hh"
 #include "server.hh"
+#include "stage_tracer.hh"
+#include "state_recorder.hh"
+#include "tcp_server.hh"
 #include "tf_inference.hh"
+#include "tracer.hh"
 #include "udp_server.hh"
 #include "unix_socket_server.hh"
 
+// where --autotune keeps the profile of this host and model
+const std::string kDefaultAutotuneProfile = "/var/tmp/astraea.autotune.json";
+// reply latency --autotune aims for, in microseconds
+const double kDefaultTargetP99 = 10000;
+// how long a handed-off infer keeps writing the replies of drained requests
+const std::chrono::milliseconds kReplyDrainTime{200};
+
 void signal_handler(int sig) {
   std::cout << "Signal " << sig << " received" << std::endl;
   TFInference::Get()->stop();
@@ -21,10 +40,109 @@ void signal_handler(int sig) {
 
 void usage_error(char** argv) {
   std::cerr << "Usage: " << argv[0] << " [-g|--graph] <graph-file> "
-            << "[-c|--checkpoint] <checkpoint-path> [-b|--batch] BATCH_MODE\n";
+            << "[-c|--checkpoint] <checkpoint-path> [-b|--batch] BATCH_MODE "
+            << "[--perf-counters] [--no-trace] [--takeover] "
+            << "[--record FILE [--record-every N]] [--benchmark] "
+            << "[--autotune [--target-p99 US] [--autotune-profile FILE]] "
+            << "[--batch-interval US] [--aligned-batches] [--max-batch N] "
+            << "[--intra-op-threads N] [--inter-op-threads N] "
+            << "[--backend session|aot|native] "
+            << "[--incremental [--verify-incremental]] "
+            << "[--global-state] [--max-plan N] [--plan-rtt-slack F] "
+            << "[--target-load F]\n"
+            << "Send SIGUSR1 to print per-stage latency percentiles\n"
+            << "--takeover replaces a running infer without dropping its "
+            << "clients\n"
+            << "--record appends every N-th input window and action to FILE\n"
+            << "--benchmark prints the batch inference latency and exits\n"
+            << "--autotune picks the batching and thread parameters that "
+            << "serve the most requests within the target p99 (default "
+            << kDefaultTargetP99 << "us) on this host, explicit values "
+            << "override its choices\n"
+            << "--backend aot runs the actor compiled by "
+            << "scripts/build_aot_actor.sh, --graph and --checkpoint are "
+            << "then only used to tell models apart; --backend native "
+            << "reads <checkpoint>" << kNativeWeightsSuffix << ", written "
+            << "by python/export_native.py\n"
+            << "--incremental (native backend) keeps fc1 partial sums per "
+            << "flow, --verify-incremental checks them against a full "
+            << "evaluation\n"
+            << "--aligned-batches starts batches on a fixed cadence that is "
+            << "advertised in START replies, clients that ask for \"phase\" "
+            << "hints move their ticks just before a batch starts\n"
+            << "--global-state aggregates the state of every ALIVE per "
+            << "bottleneck group, not only OBSERVE states; an OBSERVE without "
+            << "state gets the aggregates of its group\n"
+            << "--max-plan caps the cwnds an ALIVE with \"plan\" gets "
+            << "(default " << maxPlanSteps << ", at most " << kMaxPlanSteps
+            << "), --plan-rtt-slack is the RTT inflation the client "
+            << "tolerates before dropping a plan (default " << planRttSlack
+            << ")\n"
+            << "--target-load asks clients to query up to " << kMaxBackoff
+            << " times less often while the batch thread is busier than "
+            << "that fraction of the time, e.g. 0.8\n";
   exit(1);
 }
 
+/* profile, or reuse the saved profile, and apply the best parameters */
+void autotune(const std::string& profile_path, double target_p99_us) {
+  Autotuner tuner(graphPath, checkpointPath);
+  if (tuner.load(profile_path)) {
+    std::cout << "Autotune: reusing the profile in " << profile_path
+              << std::endl;
+  } else {
+    std::cout << "Autotune: profiling the model on this host" << std::endl;
+    tuner.profile();
+    tuner.save(profile_path);
+  }
+  TuningChoice choice = tuner.choose(target_p99_us, batchMode);
+  if (!choice.meets_target) {
+    std::cerr << "Autotune: no setting meets a p99 of " << target_p99_us
+              << "us, using the fastest one" << std::endl;
+  }
+  Autotuner::apply(choice);
+  std::cout << "Autotune: " << intraOpThreads << " intra-op / "
+            << interOpThreads << " inter-op threads";
+  if (batchMode) {
+    std::cout << ", batch interval " << batchInterval << "us, max batch "
+              << maxBatchSize;
+  }
+  std::cout << ", expected p99 " << choice.p99_us << "us at up to "
+            << static_cast<uint64_t>(choice.requests_per_sec) << " req/s"
+            << std::endl;
+}
+
+/* latency of one Session::Run per batch size, as json lines */
+void run_benchmark() {
+  const size_t kBatchSizes[] = {1, 8, 32, 128, 512};
+  const int kIterations = 200;
+  std::mt19937 rng(0);
+  std::uniform_real_distribution<float> dist(0, 1);
+  for (size_t batch : kBatchSizes) {
+    std::vector<NNInput> inputs(batch);
+    std::vector<const float*> states;
+    for (auto& input : inputs) {
+      std::generate(input.begin(), input.end(), [&] { return dist(rng); });
+      states.push_back(input.data());
+    }
+    std::vector<float> actions(batch);
+    std::vector<uint64_t> durations;
+    for (int i = 0; i < kIterations; ++i) {
+      uint64_t begin = monotonic_nsecs();
+      TFInference::Get()->batch_inference(states.data(), batch,
+                                          actions.data());
+      durations.push_back(monotonic_nsecs() - begin);
+    }
+    std::sort(durations.begin(), durations.end());
+    json line;
+    line["batch"] = batch;
+    line["p50_us"] = durations[kIterations / 2] / 1e3;
+    line["p99_us"] = durations[kIterations * 99 / 100] / 1e3;
+    line["per_request_us"] = durations[kIterations / 2] / 1e3 / batch;
+    std::cout << line.dump() << std::endl;
+  }
+}
+
 int main(int argc, char** argv) {
   if (argc < 2) {
     usage_error(argv);
@@ -34,10 +152,40 @@ int main(int argc, char** argv) {
                          {"checkpoint", required_argument, nullptr, 'c'},
                          {"batch", optional_argument, nullptr, 'b'},
                          {"channel", optional_argument, nullptr, 'h'},
+                         {"perf-counters", no_argument, nullptr, 'p'},
+                         {"no-trace", no_argument, nullptr, 'n'},
+                         {"takeover", no_argument, nullptr, 't'},
+                         {"record", required_argument, nullptr, 'r'},
+                         {"record-every", required_argument, nullptr, 'e'},
+                         {"benchmark", no_argument, nullptr, 'k'},
+                         {"autotune", no_argument, nullptr, 'a'},
+                         {"target-p99", required_argument, nullptr, 'T'},
+                         {"autotune-profile", required_argument, nullptr, 'P'},
+                         {"batch-interval", required_argument, nullptr, 'i'},
+                         {"max-batch", required_argument, nullptr, 'm'},
+                         {"intra-op-threads", required_argument, nullptr, 'I'},
+                         {"inter-op-threads", required_argument, nullptr, 'O'},
+                         {"backend", required_argument, nullptr, 'B'},
+                         {"global-state", no_argument, nullptr, 'G'},
+                         {"max-plan", required_argument, nullptr, 'K'},
+                         {"plan-rtt-slack", required_argument, nullptr, 'S'},
+                         {"incremental", no_argument, nullptr, 'N'},
+                         {"verify-incremental", no_argument, nullptr, 'V'},
+                         {"aligned-batches", no_argument, nullptr, 'A'},
+                         {"target-load", required_argument, nullptr, 'L'},
                          {0, 0, nullptr, 0}};
 
+  bool takeover = false, benchmark = false, tune = false;
+  std::string record_path, autotune_profile = kDefaultAutotuneProfile;
+  int record_every = 1;
+  double target_p99 = kDefaultTargetP99;
+  // explicit settings, applied over what --autotune picks
+  long batch_interval = -1, max_batch = -1, intra_threads = -1,
+       inter_threads = -1;
   int opt;
-  while ((opt = getopt_long(argc, argv, "b:g:c:h:", opts, nullptr)) != -1) {
+  while ((opt = getopt_long(argc, argv,
+                            "b:g:c:h:pntr:e:kaT:P:i:m:I:O:B:GK:S:NVAL:", opts,
+                            nullptr)) != -1) {
     switch (opt) {
     case 'b':
       batchMode = atoi(optarg);
@@ -51,6 +199,70 @@ int main(int argc, char** argv) {
     case 'h':
       channel = optarg;
       break;
+    case 'p':
+      perfCounters = true;
+      break;
+    case 'n':
+      stageTracing = false;
+      break;
+    case 't':
+      takeover = true;
+      break;
+    case 'r':
+      record_path = optarg;
+      break;
+    case 'e':
+      record_every = atoi(optarg);
+      break;
+    case 'k':
+      benchmark = true;
+      break;
+    case 'a':
+      tune = true;
+      break;
+    case 'T':
+      target_p99 = atof(optarg);
+      break;
+    case 'P':
+      autotune_profile = optarg;
+      break;
+    case 'i':
+      batch_interval = atol(optarg);
+      break;
+    case 'm':
+      max_batch = atol(optarg);
+      break;
+    case 'I':
+      intra_threads = atol(optarg);
+      break;
+    case 'O':
+      inter_threads = atol(optarg);
+      break;
+    case 'B':
+      inferenceBackend = optarg;
+      break;
+    case 'G':
+      globalAggregation = true;
+      break;
+    case 'K':
+      maxPlanSteps = std::clamp(atoi(optarg), 1, kMaxPlanSteps);
+      break;
+    case 'S':
+      planRttSlack = atof(optarg);
+      break;
+    case 'N':
+      incrementalFc1 = true;
+      break;
+    case 'V':
+      incrementalFc1 = true;
+      verifyIncremental = true;
+      break;
+    case 'A':
+      alignedBatches = true;
+      break;
+    case 'L':
+      targetLoad = atof(optarg);
+      break;
     case '?':
       usage_error(argv);
       return 1;
@@ -66,32 +278,123 @@ int main(int argc, char** argv) {
     std::cout << "Batch mode enabled" << std::endl;
   }
   std::cout << "Communication Channel: " << channel << std::endl;
+  std::cout << "Inference backend: " << inferenceBackend << std::endl;
+  if (incrementalFc1) {
+    std::cout << "Incremental fc1 enabled"
+              << (verifyIncremental ? ", verified" : "") << std::endl;
+  }
+  if (perfCounters) {
+    std::cout << "Hardware counters enabled" << std::endl;
+  }
   signal(SIGTERM, signal_handler);
   signal(SIGINT, signal_handler);
+  Tracer::Get()->set_process_name("infer");
+
+  // the thread pools are fixed once the session exists
+  if (tune) {
+    try {
+      autotune(autotune_profile, target_p99);
+    } catch (const std::exception& e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+  }
+  if (batch_interval >= 0) {
+    batchInterval = batch_interval;
+  }
+  if (max_batch >= 0) {
+    maxBatchSize = max_batch;
+  }
+  if (intra_threads >= 0) {
+    intraOpThreads = intra_threads;
+  }
+  if (inter_threads >= 0) {
+    interOpThreads = inter_threads;
+  }
 
-  TFInference::Get();
-  std::vector<float> input(50, 0);
+  try {
+    TFInference::Get();
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  NNInput input{};
   for (int i = 0; i < 100; ++i) {
-    auto state = input;
-    TFInference::Get()->inference_imdt(0, std::move(state), [](float, const std::string&) {});
+    TFInference::Get()->inference_imdt(0, input, [](float, const std::string&) {});
+  }
+  if (benchmark) {
+    run_benchmark();
+    TFInference::Get()->stop();
+    return 0;
+  }
+  // after the warm-up, which would only record zeros
+  if (!record_path.empty()) {
+    StateRecorder::Get()->open(record_path, record_every);
+    std::cout << "Recording every " << record_every << " state(s) to "
+              << record_path << std::endl;
   }
   // launch UDP server
   try {
     boost::asio::io_service io_service;
-    if (channel == "udp") {
-      UdpServer server(io_service);
-      server.start();
-      io_service.run();
+    // dump the stage latency breakdown on SIGUSR1
+    boost::asio::signal_set dump_signal(io_service, SIGUSR1);
+    std::function<void(const boost::system::error_code&, int)> dump_stats =
+        [&](const boost::system::error_code& error, int) {
+          if (error) {
+            return;
+          }
+          StageTracer::Get()->dump(std::cout);
+          dump_signal.async_wait(dump_stats);
+        };
+    dump_signal.async_wait(dump_stats);
+    std::unique_ptr<Server> server;
+    if (takeover) {
+      // the model is warm, take the sockets and flows of the running infer
+      IPCSocket peer;
+      peer.connect(kHandoffSocketPath);
+      HandoffState state = receive_handoff(peer);
+      channel = state.channel;
+      if (channel == "udp") {
+        server.reset(new UdpServer(io_service, state));
+      } else if (channel == "tcp") {
+        server.reset(new TcpServer(io_service, state));
+      } else {
+        server.reset(new UnixSocketServer(io_service, state));
+      }
+      ack_handoff(peer);
+      std::cout << "Took over " << state.sessions.size() << " sessions and "
+                << state.contexts.size() << " flows on " << channel
+                << std::endl;
+    } else if (channel == "udp") {
+      server.reset(new UdpServer(io_service));
+    } else if (channel == "tcp") {
+      // remote clients, pipelined over pooled connections
+      server.reset(new TcpServer(io_service, PORT));
     } else if (channel == "unix") {
       // launch unix socket server
       std::string socket_path = "/tmp/astraea.sock";
       ::unlink(socket_path.c_str());
-      UnixSocketServer server(io_service, socket_path);
-      server.start();
-      io_service.run();
+      server.reset(new UnixSocketServer(io_service, socket_path));
     } else {
       throw std::runtime_error("Unknown communication channel: " + channel);
     }
+    server->start();
+    // hand everything over when the next binary starts with --takeover
+    bool handed_off = false;
+    HandoffListener handoff(io_service, *server, [&] {
+      handed_off = true;
+      io_service.stop();
+    });
+    io_service.run();
+    if (handed_off) {
+      // the sessions are gone to the new process, only replies are left
+      std::cout << "Draining in-flight requests" << std::endl;
+      TFInference::Get()->drain();
+      TFInference::Get()->stop();
+      // tcp replies are written by the io loop
+      io_service.restart();
+      io_service.run_for(kReplyDrainTime);
+    }
   } catch (std::exception& e) {
     std::cerr << e.what() << std::endl;
   }
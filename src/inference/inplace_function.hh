@@ -0,0 +1,112 @@
+#ifndef INPLACE_FUNCTION_HH
+#define INPLACE_FUNCTION_HH
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/**
+ * @brief A std::function that keeps the callable in a fixed inline buffer.
+ *
+ * std::function only stores 16 bytes inline and heap-allocates anything
+ * larger, e.g. a lambda capturing a UDP endpoint. Callables that do not fit
+ * Capacity fail to compile instead of allocating.
+ */
+template <typename Signature, size_t Capacity = 64>
+class InplaceFunction;
+
+template <typename R, typename... Args, size_t Capacity>
+class InplaceFunction<R(Args...), Capacity> {
+ public:
+  InplaceFunction() noexcept : storage_(), invoke_(nullptr), manage_(nullptr) {}
+
+  template <typename F,
+            typename = std::enable_if_t<
+                !std::is_same<std::decay_t<F>, InplaceFunction>::value>>
+  InplaceFunction(F&& f) : storage_(), invoke_(nullptr), manage_(nullptr) {
+    using Fn = std::decay_t<F>;
+    static_assert(sizeof(Fn) <= Capacity,
+                  "callable does not fit into InplaceFunction");
+    static_assert(alignof(Fn) <= alignof(std::max_align_t),
+                  "callable is over-aligned for InplaceFunction");
+    new (&storage_) Fn(std::forward<F>(f));
+    invoke_ = [](void* fn, Args... args) -> R {
+      return (*static_cast<Fn*>(fn))(std::forward<Args>(args)...);
+    };
+    manage_ = [](void* dst, void* src, Op op) {
+      switch (op) {
+      case Op::kCopy:
+        new (dst) Fn(*static_cast<const Fn*>(src));
+        break;
+      case Op::kMove:
+        new (dst) Fn(std::move(*static_cast<Fn*>(src)));
+        break;
+      case Op::kDestroy:
+        static_cast<Fn*>(dst)->~Fn();
+        break;
+      }
+    };
+  }
+
+  InplaceFunction(const InplaceFunction& other)
+      : storage_(), invoke_(other.invoke_), manage_(other.manage_) {
+    if (manage_) {
+      manage_(&storage_, const_cast<Storage*>(&other.storage_), Op::kCopy);
+    }
+  }
+
+  InplaceFunction(InplaceFunction&& other) noexcept
+      : storage_(), invoke_(other.invoke_), manage_(other.manage_) {
+    if (manage_) {
+      manage_(&storage_, &other.storage_, Op::kMove);
+    }
+  }
+
+  InplaceFunction& operator=(const InplaceFunction& other) {
+    if (this != &other) {
+      InplaceFunction tmp(other);
+      *this = std::move(tmp);
+    }
+    return *this;
+  }
+
+  InplaceFunction& operator=(InplaceFunction&& other) noexcept {
+    if (this != &other) {
+      reset();
+      invoke_ = other.invoke_;
+      manage_ = other.manage_;
+      if (manage_) {
+        manage_(&storage_, &other.storage_, Op::kMove);
+      }
+    }
+    return *this;
+  }
+
+  ~InplaceFunction() { reset(); }
+
+  R operator()(Args... args) const {
+    return invoke_(const_cast<Storage*>(&storage_), std::forward<Args>(args)...);
+  }
+
+  explicit operator bool() const noexcept { return invoke_ != nullptr; }
+
+ private:
+  enum class Op { kCopy, kMove, kDestroy };
+  using Storage = std::aligned_storage_t<Capacity, alignof(std::max_align_t)>;
+
+  void reset() {
+    if (manage_) {
+      manage_(&storage_, nullptr, Op::kDestroy);
+    }
+    invoke_ = nullptr;
+    manage_ = nullptr;
+  }
+
+ private:
+  Storage storage_;
+  R (*invoke_)(void*, Args...);
+  void (*manage_)(void*, void*, Op);
+};
+
+#endif  // INPLACE_FUNCTION_HH
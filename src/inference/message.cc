@@ -0,0 +1,467 @@
+#include "message.hh"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+
+#include "serialization.hh"
+
+namespace {
+
+enum Field {
+  kAvgThr = 0,
+  kAvgUrtt,
+  kSrttUs,
+  kMinRtt,
+  kMaxTput,
+  kCwnd,
+  kPacketsOut,
+  kPacingRate,
+  kRetransOut,
+  kLossRatio,
+  kNumFields,
+  // keys we have no use for
+  kIgnored,
+  // top-level keys
+  kType,
+  kFlowId,
+  kRequestId,
+  kGroup,
+  kPlan,
+  kExecuted,
+  kPhase,
+  kWindow,
+  kHistory,
+  kState,
+};
+
+const uint32_t kAllFields = (1u << kNumFields) - 1;
+
+Field state_field(const std::string_view& key) {
+  // dispatch on length first, most keys are told apart by it alone
+  switch (key.size()) {
+  case 4:
+    return key == "cwnd" ? kCwnd : kIgnored;
+  case 7:
+    if (key == "avg_thr") return kAvgThr;
+    if (key == "srtt_us") return kSrttUs;
+    if (key == "min_rtt") return kMinRtt;
+    return kIgnored;
+  case 8:
+    if (key == "avg_urtt") return kAvgUrtt;
+    if (key == "max_tput") return kMaxTput;
+    return kIgnored;
+  case 10:
+    return key == "loss_ratio" ? kLossRatio : kIgnored;
+  case 11:
+    if (key == "packets_out") return kPacketsOut;
+    if (key == "pacing_rate") return kPacingRate;
+    if (key == "retrans_out") return kRetransOut;
+    return kIgnored;
+  default:
+    return kIgnored;
+  }
+}
+
+Field top_field(const std::string_view& key) {
+  if (key == "type") return kType;
+  if (key == "flow_id") return kFlowId;
+  if (key == "req_id") return kRequestId;
+  if (key == "group") return kGroup;
+  if (key == "plan") return kPlan;
+  if (key == "executed") return kExecuted;
+  if (key == "phase") return kPhase;
+  if (key == "window") return kWindow;
+  if (key == "history") return kHistory;
+  if (key == "state") return kState;
+  return kIgnored;
+}
+
+/* pulls the fields of a Message out of the scanned tokens */
+class MessageHandler {
+ public:
+  explicit MessageHandler(Message& msg) : msg_(msg) {}
+
+  bool complete() const {
+    if (!has_type_ or !has_flow_id_) {
+      return false;
+    }
+    return !msg_.has_state or fields_ == kAllFields;
+  }
+
+  bool number_integer(int64_t val) { return number(val); }
+  bool number_float(double val) { return number(val); }
+
+  bool start_object() {
+    if (depth_ == 0) {
+      depth_++;
+      return true;
+    }
+    if (depth_ == 1 and key_ == kState and !msg_.has_state) {
+      msg_.has_state = true;
+      depth_++;
+      return true;
+    }
+    return false;
+  }
+  bool end_object() {
+    depth_--;
+    return true;
+  }
+  bool start_array() {
+    // only the features of a stateless ALIVE, once
+    if (depth_ != 1 or in_array_ or msg_.window_size > 0 or
+        (key_ != kWindow and key_ != kHistory)) {
+      return false;
+    }
+    in_array_ = true;
+    array_size_ = key_ == kWindow ? kNNInputSize : kNNInputSize - kStateSize;
+    return true;
+  }
+  bool end_array() {
+    in_array_ = false;
+    return msg_.window_size == array_size_;
+  }
+  int depth() const { return depth_; }
+
+  bool key(const std::string_view& key) {
+    key_ = depth_ == 1 ? top_field(key) : state_field(key);
+    return true;
+  }
+
+ private:
+  /* same conversions json::get<>() does on the DOM path */
+  template <typename T>
+  bool number(T val) {
+    if (in_array_) {
+      if (msg_.window_size == array_size_) {
+        return false;
+      }
+      msg_.window[msg_.window_size++] = static_cast<float>(val);
+      return true;
+    }
+    if (depth_ == 1) {
+      switch (key_) {
+      case kType:
+        msg_.type = static_cast<int>(val);
+        has_type_ = true;
+        return true;
+      case kFlowId:
+        msg_.flow_id = static_cast<int64_t>(val);
+        has_flow_id_ = true;
+        return true;
+      case kRequestId:
+        msg_.request_id = static_cast<int64_t>(val);
+        return true;
+      case kGroup:
+        msg_.group = static_cast<int>(val);
+        return true;
+      case kPlan:
+        msg_.plan_steps = static_cast<int>(val);
+        return true;
+      case kExecuted:
+        msg_.executed = static_cast<int>(val);
+        return true;
+      case kPhase:
+        msg_.phase_hint = val != 0;
+        return true;
+      case kState:
+        return false;
+      default:
+        return true;
+      }
+    }
+    auto& s = msg_.state;
+    switch (key_) {
+    case kAvgThr: s.avg_thr = static_cast<uint32_t>(val); break;
+    case kAvgUrtt: s.avg_urtt = static_cast<uint32_t>(val); break;
+    case kSrttUs: s.srtt_us = static_cast<uint32_t>(val); break;
+    case kMinRtt: s.min_rtt = static_cast<uint32_t>(val); break;
+    case kMaxTput: s.max_tput = static_cast<uint32_t>(val); break;
+    case kCwnd: s.cwnd = static_cast<uint32_t>(val); break;
+    case kPacketsOut: s.packets_out = static_cast<uint32_t>(val); break;
+    case kPacingRate: s.pacing_rate = static_cast<uint32_t>(val); break;
+    case kRetransOut: s.retrans_out = static_cast<uint32_t>(val); break;
+    case kLossRatio: s.loss_ratio = static_cast<double>(val); break;
+    default: return true;
+    }
+    fields_ |= 1u << key_;
+    return true;
+  }
+
+ private:
+  Message& msg_;
+  int depth_ = 0;
+  Field key_ = kIgnored;
+  uint32_t fields_ = 0;
+  bool has_type_ = false;
+  bool has_flow_id_ = false;
+  bool in_array_ = false;
+  size_t array_size_ = 0;
+};
+
+/**
+ * Scans the flat JSON the clients send: objects, keys without escapes,
+ * numbers and arrays of numbers. Anything else (strings, nested arrays,
+ * literals, escapes) makes it give up. Unlike nlohmann's lexer it neither copies tokens nor allocates.
+ */
+class Scanner {
+ public:
+  Scanner(const char* data, size_t length)
+      : pos_(data), end_(data + length) {}
+
+  bool parse(MessageHandler& handler) {
+    if (!value(handler)) {
+      return false;
+    }
+    skip_space();
+    return pos_ == end_;
+  }
+
+ private:
+  void skip_space() {
+    while (pos_ < end_ and
+           (*pos_ == ' ' or *pos_ == '\n' or *pos_ == '\t' or *pos_ == '\r')) {
+      pos_++;
+    }
+  }
+
+  bool value(MessageHandler& handler) {
+    skip_space();
+    if (pos_ == end_) {
+      return false;
+    }
+    if (*pos_ == '{') {
+      return object(handler);
+    }
+    if (*pos_ == '[') {
+      return array(handler);
+    }
+    return number(handler);
+  }
+
+  bool array(MessageHandler& handler) {
+    if (!handler.start_array()) {
+      return false;
+    }
+    pos_++;
+    skip_space();
+    if (pos_ < end_ and *pos_ == ']') {
+      pos_++;
+      return handler.end_array();
+    }
+    while (true) {
+      skip_space();
+      if (!number(handler)) {
+        return false;
+      }
+      skip_space();
+      if (pos_ == end_) {
+        return false;
+      }
+      if (*pos_ == ']') {
+        pos_++;
+        return handler.end_array();
+      }
+      if (*pos_ != ',') {
+        return false;
+      }
+      pos_++;
+    }
+  }
+
+  bool object(MessageHandler& handler) {
+    // nesting is bounded by the handler, which accepts two levels
+    if (!handler.start_object()) {
+      return false;
+    }
+    pos_++;
+    skip_space();
+    if (pos_ < end_ and *pos_ == '}') {
+      pos_++;
+      return handler.end_object();
+    }
+    while (true) {
+      std::string_view name;
+      if (!key(name) or !handler.key(name)) {
+        return false;
+      }
+      skip_space();
+      if (pos_ == end_ or *pos_ != ':') {
+        return false;
+      }
+      pos_++;
+      if (!value(handler)) {
+        return false;
+      }
+      skip_space();
+      if (pos_ == end_) {
+        return false;
+      }
+      if (*pos_ == '}') {
+        pos_++;
+        return handler.end_object();
+      }
+      if (*pos_ != ',') {
+        return false;
+      }
+      pos_++;
+    }
+  }
+
+  bool key(std::string_view& name) {
+    skip_space();
+    if (pos_ == end_ or *pos_ != '"') {
+      return false;
+    }
+    const char* begin = ++pos_;
+    while (pos_ < end_ and *pos_ != '"') {
+      if (*pos_ == '\\') {
+        return false;
+      }
+      pos_++;
+    }
+    if (pos_ == end_) {
+      return false;
+    }
+    name = std::string_view(begin, pos_ - begin);
+    pos_++;
+    return true;
+  }
+
+  bool number(MessageHandler& handler) {
+    const char* begin = pos_;
+    bool is_float = false;
+    if (pos_ < end_ and *pos_ == '-') {
+      pos_++;
+    }
+    while (pos_ < end_) {
+      char c = *pos_;
+      if (c == '.' or c == 'e' or c == 'E' or c == '+' or c == '-') {
+        is_float = true;
+      } else if (c < '0' or c > '9') {
+        break;
+      }
+      pos_++;
+    }
+    if (pos_ == begin) {
+      return false;
+    }
+    if (!is_float) {
+      int64_t val = 0;
+      auto result = std::from_chars(begin, pos_, val);
+      // beyond int64: leave it to the DOM path
+      return result.ec == std::errc() and result.ptr == pos_ and
+             handler.number_integer(val);
+    }
+    // strtod needs a terminated string
+    char buffer[64];
+    size_t len = pos_ - begin;
+    if (len >= sizeof(buffer)) {
+      return false;
+    }
+    std::memcpy(buffer, begin, len);
+    buffer[len] = '\0';
+    char* parsed = nullptr;
+    double val = std::strtod(buffer, &parsed);
+    return parsed == buffer + len and handler.number_float(val);
+  }
+
+ private:
+  const char* pos_;
+  const char* end_;
+};
+
+}  // namespace
+
+bool decode_message(const char* data, size_t length, Message& msg) {
+  msg = Message();
+  MessageHandler handler(msg);
+  Scanner scanner(data, length);
+  return scanner.parse(handler) and handler.depth() == 0 and
+         handler.complete();
+}
+
+void decode_message(const json& data, Message& msg) {
+  msg = Message();
+  msg.type = data.at("type");
+  msg.flow_id = data.at("flow_id");
+  if (data.contains("req_id")) {
+    msg.request_id = data["req_id"];
+  }
+  if (data.contains("group")) {
+    msg.group = data["group"];
+  }
+  if (data.contains("plan")) {
+    msg.plan_steps = data["plan"];
+  }
+  if (data.contains("executed")) {
+    msg.executed = data["executed"];
+  }
+  if (data.contains("phase")) {
+    msg.phase_hint = data["phase"] != 0;
+  }
+  if (data.contains("state")) {
+    msg.has_state = true;
+    msg.state = make_deepcc_state(data["state"]);
+  }
+  if (data.contains("window") or data.contains("history")) {
+    bool full = data.contains("window");
+    auto& values = data[full ? "window" : "history"];
+    size_t size = full ? kNNInputSize : kNNInputSize - kStateSize;
+    if (!values.is_array() or values.size() != size) {
+      throw std::invalid_argument(std::string(full ? "window" : "history") +
+                                  " needs " + std::to_string(size) +
+                                  " features");
+    }
+    for (auto& value : values) {
+      msg.window[msg.window_size++] = value.get<float>();
+    }
+  }
+}
+
+bool stateless_input(const Message& msg, NNInput& input) {
+  if (msg.window_size == kNNInputSize) {
+    input = msg.window;
+    return true;
+  }
+  if (msg.window_size == kNNInputSize - kStateSize) {
+    std::copy(msg.window.begin(), msg.window.begin() + msg.window_size,
+              input.begin());
+    transform_state(msg.state, &input[msg.window_size]);
+    return true;
+  }
+  return false;
+}
+
+size_t encode_action_reply(char* out, int64_t flow_id, int cwnd,
+                           int64_t request_id, int backoff) {
+  int len;
+  if (unlikely(backoff > 1)) {
+    // keys stay in json::dump() order
+    len = snprintf(out + 2, kMaxActionReplySize - 2,
+                   "{\"backoff\":%d,\"cwnd\":%d,\"flow_id\":%lld", backoff,
+                   cwnd, static_cast<long long>(flow_id));
+    if (request_id >= 0) {
+      len += snprintf(out + 2 + len, kMaxActionReplySize - 2 - len,
+                      ",\"req_id\":%lld", static_cast<long long>(request_id));
+    }
+    out[2 + len++] = '}';
+  } else if (request_id < 0) {
+    len = snprintf(out + 2, kMaxActionReplySize - 2,
+                   "{\"cwnd\":%d,\"flow_id\":%lld}", cwnd,
+                   static_cast<long long>(flow_id));
+  } else {
+    // keys stay in json::dump() order
+    len = snprintf(out + 2, kMaxActionReplySize - 2,
+                   "{\"cwnd\":%d,\"flow_id\":%lld,\"req_id\":%lld}", cwnd,
+                   static_cast<long long>(flow_id),
+                   static_cast<long long>(request_id));
+  }
+  put_field(len, out);
+  return len + 2;
+}
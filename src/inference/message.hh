@@ -0,0 +1,76 @@
+#ifndef MESSAGE_HH
+#define MESSAGE_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "define.hh"
+
+/* a decoded client message, see Server::MessageType */
+struct Message {
+  int type = -1;
+  // chosen by the client, or assigned by the START reply
+  int64_t flow_id = 0;
+  // set by pipelining clients to match replies, -1 if absent
+  int64_t request_id = -1;
+  // bottleneck group of the flow for the global state, -1 if absent
+  int group = -1;
+  // ALIVE only: cwnds asked for, and intervals run from the last plan
+  int plan_steps = 1;
+  int executed = 0;
+  // ALIVE only: asks for the batch lead with --aligned-batches
+  bool phase_hint = false;
+  // only ALIVE and OBSERVE messages carry a state
+  bool has_state = false;
+  DeepCCState state{};
+  // features a stateless ALIVE brings along, see stateless_input()
+  size_t window_size = 0;
+  NNInput window{};
+};
+
+// longest message the servers take, length header excluded
+const size_t kMaxMessageSize = 4096;
+
+/**
+ * @brief Decode the known message shape straight into a Message, without
+ * building a DOM and without allocating.
+ *
+ * Top-level keys other than "type", "flow_id", "req_id", "group", "plan",
+ * "executed", "phase", "window", "history" and "state" must be numbers, "state" must
+ * be a flat object of numbers holding every DeepCCState field, "window" and
+ * "history" arrays of numbers.
+ *
+ * @return false if the message has any other shape, the caller then falls
+ * back to decode_message(const json&)
+ */
+bool decode_message(const char* data, size_t length, Message& msg);
+
+/* slow path for unknown shapes, throws like json::at() on missing fields */
+void decode_message(const json& data, Message& msg);
+
+/**
+ * @brief The actor input of a stateless ALIVE, whose client keeps the feature
+ * window itself: a "window" of all kNNInputSize features, or the "history"
+ * of the rows before msg.state, which is transformed here
+ *
+ * @return false if the message leaves the window to the flow's context
+ */
+bool stateless_input(const Message& msg, NNInput& input);
+
+/* longest reply encode_action_reply() writes, length header included */
+const size_t kMaxActionReplySize = 128;
+
+/**
+ * @brief Write a framed {"cwnd":<cwnd>,"flow_id":<flow_id>} reply into out,
+ * the body byte-identical to json::dump()
+ *
+ * @param out at least kMaxActionReplySize bytes
+ * @param request_id echoed as "req_id" unless negative
+ * @param backoff sent as "backoff" when above 1, see --target-load
+ * @return size_t length of the frame
+ */
+size_t encode_action_reply(char* out, int64_t flow_id, int cwnd,
+                           int64_t request_id = -1, int backoff = 1);
+
+#endif  // MESSAGE_HH
@@ -0,0 +1,103 @@
+#include "native_backend.hh"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+
+NativeBackend::NativeBackend(const std::string& weights_path)
+    : layers_(), action_scale_(1) {
+  std::ifstream file(weights_path);
+  if (!file) {
+    throw std::runtime_error("Cannot read the native weights " +
+                             weights_path +
+                             ", see python/export_native.py");
+  }
+  json model = json::parse(file);
+  action_scale_ = model.at("action_scale");
+  size_t inputs = kNNInputSize;
+  for (auto& entry : model.at("layers")) {
+    Layer layer;
+    layer.inputs = inputs;
+    layer.units = entry.at("units");
+    layer.weights = entry.at("weights").get<std::vector<float>>();
+    layer.bias = entry.at("bias").get<std::vector<float>>();
+    layer.alpha = entry.value("alpha", 0.2f);
+    layer.tanh = entry.at("activation") == "tanh";
+    if (layer.units > kMaxNativeUnits or
+        layer.weights.size() != layer.inputs * layer.units or
+        layer.bias.size() != layer.units) {
+      throw std::runtime_error("Layer " + std::to_string(layers_.size()) +
+                               " of " + weights_path + " has a bad shape");
+    }
+    inputs = layer.units;
+    layers_.push_back(std::move(layer));
+  }
+  if (layers_.empty() or layers_.back().units != 1) {
+    throw std::runtime_error(weights_path + " does not end in one action");
+  }
+}
+
+void NativeBackend::run(const float* const* states, size_t batch,
+                        float* actions) {
+  std::array<float, kMaxNativeUnits> product;
+  for (size_t row = 0; row < batch; ++row) {
+    std::fill(product.begin(), product.begin() + fc1_units(), 0.f);
+    for (size_t slot = 0; slot < kRecurrentNum; ++slot) {
+      add_fc1_slot(states[row] + slot * kStateSize, slot, product.data());
+    }
+    actions[row] = finish(product.data());
+  }
+}
+
+void NativeBackend::add_fc1_slot(const float* state, size_t slot,
+                                 float* out) const {
+  auto& fc1 = layers_[0];
+  // a row of weights per input keeps the inner loop vectorizable
+  for (size_t i = 0; i < kStateSize; ++i) {
+    const float* w = &fc1.weights[(slot * kStateSize + i) * fc1.units];
+    const float x = state[i];
+    for (size_t j = 0; j < fc1.units; ++j) {
+      out[j] += w[j] * x;
+    }
+  }
+}
+
+void NativeBackend::run_fc1(const float* const* fc1, size_t batch,
+                            float* actions) {
+  for (size_t row = 0; row < batch; ++row) {
+    actions[row] = finish(fc1[row]);
+  }
+}
+
+float NativeBackend::finish(const float* fc1) const {
+  std::array<float, kMaxNativeUnits> a, b;
+  float* in = a.data();
+  float* out = b.data();
+  std::copy(fc1, fc1 + layers_[0].units, in);
+  for (size_t l = 0; l < layers_.size(); ++l) {
+    auto& layer = layers_[l];
+    if (l > 0) {
+      std::fill(out, out + layer.units, 0.f);
+      for (size_t i = 0; i < layer.inputs; ++i) {
+        const float* w = &layer.weights[i * layer.units];
+        const float x = in[i];
+        for (size_t j = 0; j < layer.units; ++j) {
+          out[j] += w[j] * x;
+        }
+      }
+      std::swap(in, out);
+    }
+    // in holds the layer's product
+    for (size_t j = 0; j < layer.units; ++j) {
+      float sum = in[j] + layer.bias[j];
+      if (layer.tanh) {
+        in[j] = std::tanh(sum);
+      } else {
+        in[j] = sum > 0 ? sum : layer.alpha * sum;
+      }
+    }
+  }
+  return in[0] * action_scale_;
+}
@@ -0,0 +1,52 @@
+#ifndef NATIVE_BACKEND_HH
+#define NATIVE_BACKEND_HH
+
+#include <string>
+#include <vector>
+
+#include "backend.hh"
+
+// python/export_native.py writes the weights next to the checkpoint
+const std::string kNativeWeightsSuffix = ".native.json";
+// widest layer the native backend evaluates
+const size_t kMaxNativeUnits = 1024;
+
+/**
+ * @brief Evaluates the actor's dense layers in plain C++.
+ *
+ * The exporter folds each batch normalization into the dense layer before
+ * it, so a layer is a matrix product, a bias and an activation. The first
+ * layer can also be fed with its product precomputed per flow, see Fc1Cache.
+ */
+class NativeBackend : public InferenceBackend {
+ public:
+  explicit NativeBackend(const std::string& weights_path);
+
+  void run(const float* const* states, size_t batch, float* actions) override;
+
+  size_t fc1_units() const override { return layers_[0].units; }
+  void add_fc1_slot(const float* state, size_t slot,
+                    float* out) const override;
+  void run_fc1(const float* const* fc1, size_t batch,
+               float* actions) override;
+
+ private:
+  struct Layer {
+    size_t inputs = 0;
+    size_t units = 0;
+    // inputs rows of units weights, as TensorFlow keeps the kernel
+    std::vector<float> weights{};
+    std::vector<float> bias{};
+    // leaky ReLU slope, the last layer is tanh instead
+    float alpha = 0;
+    bool tanh = false;
+  };
+
+  /* the action for the first layer's product without its bias */
+  float finish(const float* fc1) const;
+
+  std::vector<Layer> layers_;
+  float action_scale_;
+};
+
+#endif  // NATIVE_BACKEND_HH
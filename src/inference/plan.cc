@@ -0,0 +1,33 @@
+#include "plan.hh"
+
+#include <algorithm>
+
+DeepCCState predict_state(const DeepCCState& state, int cwnd) {
+  DeepCCState next = state;
+  double ratio = state.cwnd > 0 ? static_cast<double>(cwnd) / state.cwnd : 1;
+  next.cwnd = cwnd;
+  next.packets_out = static_cast<uint32_t>(state.packets_out * ratio);
+  next.pacing_rate = static_cast<uint32_t>(state.pacing_rate * ratio);
+  double thr = state.avg_thr * ratio;
+  if (state.max_tput > 0) {
+    // a larger window beyond the bottleneck only builds a queue
+    thr = std::min<double>(thr, state.max_tput);
+  }
+  next.avg_thr = static_cast<uint32_t>(thr);
+  return next;
+}
+
+std::string encode_plan_reply(int64_t flow_id, const int* cwnds, size_t steps,
+                              const DeepCCState& state) {
+  json reply;
+  reply["cwnd"] = cwnds[0];
+  reply["flow_id"] = flow_id;
+  reply["plan"] = json::array();
+  for (size_t i = 1; i < steps; ++i) {
+    reply["plan"].push_back(cwnds[i]);
+  }
+  reply["max_urtt"] =
+      static_cast<uint32_t>(state.avg_urtt * (1 + planRttSlack));
+  reply["max_loss"] = state.loss_ratio * (1 + planRttSlack);
+  return reply.dump();
+}
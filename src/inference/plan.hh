@@ -0,0 +1,40 @@
+#ifndef PLAN_HH
+#define PLAN_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "define.hh"
+
+// most cwnds one plan reply carries, --max-plan can only lower it
+const int kMaxPlanSteps = 16;
+
+/* an ALIVE asking for the cwnds of its next `steps` intervals */
+struct PlanRequest {
+  // 1 for a plain ALIVE
+  int steps = 1;
+  // the reported state the rollout starts from
+  DeepCCState state{};
+  // the reply also carries the batch lead, see --aligned-batches
+  bool phase_hint = false;
+};
+
+/**
+ * @brief The state the flow would report next if it used cwnd and the path
+ * stayed as it is: RTTs and loss are held, what the window drives scales with
+ * it, and throughput never goes beyond what the path has delivered so far
+ */
+DeepCCState predict_state(const DeepCCState& state, int cwnd);
+
+/**
+ * @brief Encode {"cwnd":c0,"flow_id":id,"plan":[c1,...],"max_urtt":..,
+ * "max_loss":..}, the client runs c0 now and the rest one per interval while
+ * its avg_urtt stays at most max_urtt and its loss_ratio at most max_loss
+ *
+ * @param state the state the plan was computed from
+ */
+std::string encode_plan_reply(int64_t flow_id, const int* cwnds, size_t steps,
+                              const DeepCCState& state);
+
+#endif  // PLAN_HH
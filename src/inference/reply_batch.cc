@@ -0,0 +1,25 @@
+#include "reply_batch.hh"
+
+#include <vector>
+
+namespace {
+
+std::vector<std::shared_ptr<BufferedReplies>>& deferred() {
+  // keeps its capacity, so steady state batches do not allocate
+  thread_local std::vector<std::shared_ptr<BufferedReplies>> conns;
+  return conns;
+}
+
+}  // namespace
+
+void defer_flush(std::shared_ptr<BufferedReplies> conn) {
+  deferred().push_back(std::move(conn));
+}
+
+void flush_deferred_replies() {
+  auto& conns = deferred();
+  for (auto& conn : conns) {
+    conn->flush_replies();
+  }
+  conns.clear();
+}
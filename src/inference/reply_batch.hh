@@ -0,0 +1,24 @@
+#ifndef REPLY_BATCH_HH
+#define REPLY_BATCH_HH
+
+#include <memory>
+
+/**
+ * @brief A connection that queues its replies and writes them in one go.
+ *
+ * Replies produced by one inference batch for flows sharing a connection
+ * then cost a single send instead of one per flow.
+ */
+class BufferedReplies {
+ public:
+  virtual ~BufferedReplies() {}
+  virtual void flush_replies() = 0;
+};
+
+/* have the current thread flush conn at its next flush_deferred_replies() */
+void defer_flush(std::shared_ptr<BufferedReplies> conn);
+
+/* write everything the current thread has queued, called once per batch */
+void flush_deferred_replies();
+
+#endif  // REPLY_BATCH_HH
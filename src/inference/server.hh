@@ -1,36 +1,179 @@
 #ifndef SERVER_HH
 #define SERVER_HH
 
+#include <chrono>
+#include <functional>
+#include <random>
+#include <stdexcept>
 #include <string>
 
 #include "context.hh"
 #include "define.hh"
+#include "global_state.hh"
+#include "handoff.hh"
+#include "message.hh"
+#include "stage_tracer.hh"
 
 class FlowContext;
 class Server {
  public:
-  Server() {}
+  Server() : flow_contexts(), trace_(), next_expiry_() {}
   virtual ~Server() {}
   virtual void start() = 0;
 
+  /* stop reading at a message boundary, on_paused runs once every session
+   * is parked */
+  virtual void pause(std::function<void()> /* on_paused */) {
+    throw std::runtime_error("handoff is not supported by this server");
+  }
+  /* pick up again after a failed handoff */
+  virtual void resume() {}
+  /* the fds and flows of a paused server, see handoff.hh */
+  virtual void export_state(HandoffState& /* state */) {}
+
  protected:
-  virtual void handle_flow_init(int& flow_id,
+  /* START, the legacy registration; flow_id is replaced if taken */
+  virtual void handle_flow_init(int64_t& flow_id,
                                 ResponseCallback&& send_response) = 0;
-  virtual void handle_congestion_control(int flow_id, json& data,
+  // an ALIVE, msg.plan_steps > 1 asks for a plan, see plan.hh
+  virtual void handle_congestion_control(const Message& msg,
                                          ResponseCallback&& send_response) = 0;
 
-  virtual void handle_flow_removal(int flow_id) {
-    if (flow_contexts.find(flow_id) == flow_contexts.end()) {
+  /* END from owner, which cannot end the flow of another client */
+  virtual void handle_flow_removal(int64_t flow_id, uint64_t owner) {
+    auto it = flow_contexts.find(flow_id);
+    if (it == flow_contexts.end()) {
       std::cerr << "Flow " << flow_id << " does not exist" << std::endl;
       return;
     }
-    delete flow_contexts[flow_id];
-    flow_contexts.erase(flow_id);
+    if (it->second->owner() != 0 and it->second->owner() != owner) {
+      std::cerr << "Flow " << flow_id << " is not ended by its owner"
+                << std::endl;
+      return;
+    }
+    delete it->second;
+    flow_contexts.erase(it);
+    GlobalState::Get()->remove(flow_id);
+  }
+
+  /* free the contexts no owner claimed for kUnclaimedTimeout, i.e. flows
+   * whose client went away without END; at most once a second */
+  void expire_contexts() {
+    auto now = std::chrono::steady_clock::now();
+    if (now < next_expiry_) {
+      return;
+    }
+    next_expiry_ = now + std::chrono::seconds(1);
+    for (auto it = flow_contexts.begin(); it != flow_contexts.end();) {
+      FlowContext* context = it->second;
+      if (context->owner() != 0 or
+          now - context->unclaimed_since() < kUnclaimedTimeout) {
+        ++it;
+        continue;
+      }
+      std::cout << "Expire flow " << it->first << std::endl;
+      GlobalState::Get()->remove(it->first);
+      delete context;
+      it = flow_contexts.erase(it);
+    }
+  }
+
+  /**
+   * @brief The context of an ALIVE's flow, created by the flow's first ALIVE
+   * so that clients need no START round trip.
+   *
+   * A context belongs to the connection (or UDP peer) that first sends an
+   * ALIVE for it, until release_contexts(). Another owner sending the same
+   * id is a collision of two clients' random ids: it is told so with
+   * {"collision":1,"flow_id":id} and should pick a new id.
+   *
+   * @return null on a collision
+   */
+  FlowContext* claim_context(int64_t flow_id, uint64_t owner,
+                             ResponseCallback& send_response) {
+    auto it = flow_contexts.find(flow_id);
+    if (unlikely(it == flow_contexts.end())) {
+      expire_contexts();
+      it = flow_contexts.emplace(flow_id, new FlowContext(flow_id)).first;
+    }
+    FlowContext* context = it->second;
+    if (unlikely(context->owner() != owner)) {
+      if (context->owner() != 0) {
+        std::cerr << "Flow id " << flow_id << " collides with another client"
+                  << std::endl;
+        json reply;
+        reply["collision"] = 1;
+        reply["flow_id"] = flow_id;
+        send_response(-1, reply.dump());
+        return nullptr;
+      }
+      context->set_owner(owner);
+    }
+    return context;
+  }
+
+  /* the connection owner went away, a new one may take over its flows
+   * within kUnclaimedTimeout */
+  void release_contexts(uint64_t owner) {
+    for (auto& entry : flow_contexts) {
+      if (entry.second->owner() == owner) {
+        entry.second->set_owner(0);
+      }
+    }
+    expire_contexts();
+  }
+
+  /* a random id no flow has, for a START whose id is taken */
+  int64_t unused_flow_id() const {
+    static std::mt19937_64 generator{std::random_device()()};
+    int64_t flow_id;
+    do {
+      // positive, the same range clients draw from
+      flow_id = static_cast<int64_t>(generator() >> 1);
+    } while (flow_id == 0 or flow_contexts.count(flow_id) > 0);
+    return flow_id;
+  }
+
+  /* an ALIVE state, counted in the global state with --global-state */
+  void aggregate_state(const Message& msg) {
+    if (globalAggregation) {
+      GlobalState::Get()->update(msg.flow_id, msg.group, msg.state);
+    }
+  }
+
+  /* OBSERVE with a state updates the flow's sample, without one it asks for
+   * the aggregates of its group */
+  void handle_observe(const Message& msg, ResponseCallback&& send_response) {
+    if (msg.has_state) {
+      GlobalState::Get()->update(msg.flow_id, msg.group, msg.state);
+      return;
+    }
+    json reply = GlobalState::Get()->query(msg.group < 0 ? 0 : msg.group);
+    reply["flow_id"] = msg.flow_id;
+    send_response(-1, reply.dump());
+  }
+
+  void export_contexts(HandoffState& state) const {
+    for (auto& entry : flow_contexts) {
+      state.contexts.emplace_back(entry.first, entry.second->window());
+    }
+  }
+
+  void adopt_contexts(const HandoffState& state) {
+    for (auto& context : state.contexts) {
+      flow_contexts[context.first] =
+          new FlowContext(context.first, context.second);
+    }
   }
 
  protected:
   // per flow inference context
-  std::unordered_map<int, FlowContext*> flow_contexts;
+  std::unordered_map<int64_t, FlowContext*> flow_contexts;
+  // stage timestamps of the request being handled
+  RequestTrace trace_;
+  // how long a released flow may take to come back on a new connection
+  static constexpr std::chrono::seconds kUnclaimedTimeout{10};
+  std::chrono::steady_clock::time_point next_expiry_;
   enum class MessageType {
     INIT = 0,
     START = 1,
@@ -0,0 +1,115 @@
+#include "session_backend.hh"
+
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+SessionBackend::SessionBackend(const std::string& graph_path,
+                               const std::string& checkpoint_path,
+                               int intra_op_threads, int inter_op_threads)
+    : session_(nullptr),
+      train_flag_(tensorflow::DT_BOOL, tensorflow::TensorShape()) {
+  *train_flag_.flat<bool>().data() = false;
+
+  tensorflow::SessionOptions options;
+
+  tensorflow::ConfigProto* config = &options.config;
+  config->set_allow_soft_placement(true);
+  config->set_intra_op_parallelism_threads(intra_op_threads);
+  config->set_inter_op_parallelism_threads(inter_op_threads);
+  tensorflow::Status status = NewSession(options, &session_);
+  if (!status.ok()) {
+    std::cout << status.ToString() << "\n";
+    throw std::runtime_error("Failed to create a TensorFlow session");
+  }
+  if (!LoadModel(session_, graph_path, checkpoint_path).ok()) {
+    delete session_;
+    throw std::runtime_error("Failed to load the model");
+  }
+}
+
+void SessionBackend::run(const float* const* states, size_t batch,
+                         float* actions) {
+  tensorflow::Tensor data = prepare_batch_input(states, batch);
+  // std::cout << data.DebugString() << std::endl;
+  // std::cout << train_flag_.DebugString() << std::endl;
+  TensorDict feedDict = {
+      {"s0:0", data},
+      {"Actor_is_training:0", train_flag_},
+  };
+  std::vector<std::string> outputOps = {
+      {"actor/Mul:0"},
+  };
+  std::vector<tensorflow::Tensor> output;
+  tensorflow::Status status = session_->Run(feedDict, outputOps, {}, &output);
+  if (!status.ok()) {
+    std::cout << status.ToString() << "\n";
+    throw std::runtime_error("Error during inference");
+  }
+  std::memcpy(actions, output[0].flat<float>().data(), batch * sizeof(float));
+}
+
+tensorflow::Tensor SessionBackend::prepare_batch_input(
+    const float* const* states, int batch) {
+  tensorflow::TensorShape input_shape({batch, kNNInputSize});
+  tensorflow::Tensor tmp(tensorflow::DT_FLOAT, input_shape);
+  // copy state to input tensor, rows are contiguous in the tensor
+  float* input = tmp.flat<float>().data();
+  for (int i = 0; i < batch; ++i) {
+    std::memcpy(input + i * kNNInputSize, states[i],
+                kNNInputSize * sizeof(float));
+  }
+  return tmp;
+}
+
+tensorflow::Status SessionBackend::LoadModel(tensorflow::Session* sess,
+                                             std::string graph_fn,
+                                             std::string checkpoint_fn) {
+  tensorflow::Status status;
+
+  // Read in the protobuf graph we exported
+  tensorflow::MetaGraphDef graph_def;
+  status = ReadBinaryProto(tensorflow::Env::Default(), graph_fn, &graph_def);
+  if (status != tensorflow::Status::OK()) {
+    std::cout << status.ToString() << std::endl;
+    return status;
+  }
+
+  // create the graph in the current session
+  status = sess->Create(graph_def.graph_def());
+  if (status != tensorflow::Status::OK()) {
+    std::cout << status.ToString() << std::endl;
+    return status;
+  }
+
+  // restore model from checkpoint, iff checkpoint is given
+  if (checkpoint_fn != "") {
+    const std::string restore_op_name = graph_def.saver_def().restore_op_name();
+    const std::string filename_tensor_name =
+        graph_def.saver_def().filename_tensor_name();
+
+    tensorflow::Tensor filename_tensor(tensorflow::DT_STRING,
+                                       tensorflow::TensorShape());
+    filename_tensor.scalar<std::string>()() = checkpoint_fn;
+
+    TensorDict feed_dict = {{filename_tensor_name, filename_tensor}};
+    status = sess->Run(feed_dict, {}, {restore_op_name}, nullptr);
+    if (status != tensorflow::Status::OK()) {
+      std::cout << status.ToString() << std::endl;
+      return status;
+    }
+  } else {
+    // virtual Status Run(const std::vector<std::pair<string, Tensor> >&
+    // inputs,
+    //                  const std::vector<string>& output_tensor_names,
+    //                  const std::vector<string>& target_node_names,
+    //                  std::vector<Tensor>* outputs) = 0;
+    status = sess->Run({}, {}, {"init"}, nullptr);
+    if (status != tensorflow::Status::OK()) {
+      std::cout << status.ToString() << std::endl;
+      return status;
+    }
+  }
+
+  return tensorflow::Status::OK();
+}
\ No newline at end of file
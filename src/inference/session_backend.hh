@@ -0,0 +1,47 @@
+#ifndef SESSION_BACKEND_HH
+#define SESSION_BACKEND_HH
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <tensorflow/core/platform/env.h>
+#include <tensorflow/core/protobuf/meta_graph.pb.h>
+#include <tensorflow/core/public/session.h>
+
+#include "backend.hh"
+
+typedef std::vector<std::pair<std::string, tensorflow::Tensor>> TensorDict;
+
+/* runs the exported meta graph in a TensorFlow session */
+class SessionBackend : public InferenceBackend {
+ public:
+  /**
+   * @brief Create a session with the given thread pools and load the model
+   *
+   * @param intra_op_threads 0 for TensorFlow's default, as inter_op_threads
+   */
+  SessionBackend(const std::string& graph_path,
+                 const std::string& checkpoint_path, int intra_op_threads,
+                 int inter_op_threads);
+  ~SessionBackend() { delete session_; }
+
+  SessionBackend(const SessionBackend&) = delete;
+  SessionBackend& operator=(const SessionBackend&) = delete;
+
+  void run(const float* const* states, size_t batch, float* actions) override;
+
+ private:
+  tensorflow::Tensor prepare_batch_input(const float* const* states,
+                                         int batch = 1);
+
+  tensorflow::Status LoadModel(tensorflow::Session* sess, std::string graph_fn,
+                               std::string checkpoint_fn = "");
+
+ private:
+  tensorflow::Session* session_;
+  // always false, the actor's batch normalization runs in inference mode
+  tensorflow::Tensor train_flag_;
+};
+
+#endif  // SESSION_BACKEND_HH
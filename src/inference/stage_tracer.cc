@@ -0,0 +1,207 @@
+#include "stage_tracer.hh"
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+
+#include "alloc_counter.hh"
+
+PerfCounters::PerfCounters() : fds_() { fds_.fill(-1); }
+
+PerfCounters::~PerfCounters() {
+  for (int fd : fds_) {
+    if (fd >= 0) {
+      ::close(fd);
+    }
+  }
+}
+
+PerfCounters* PerfCounters::ThreadLocal() {
+  if (!perfCounters) {
+    return nullptr;
+  }
+  thread_local std::unique_ptr<PerfCounters> counters;
+  thread_local bool failed = false;
+  if (unlikely(!counters and !failed)) {
+    counters.reset(new PerfCounters());
+    if (!counters->open()) {
+      counters.reset();
+      failed = true;
+    }
+  }
+  return counters.get();
+}
+
+bool PerfCounters::open() {
+  const uint64_t configs[] = {PERF_COUNT_HW_CPU_CYCLES,
+                              PERF_COUNT_HW_INSTRUCTIONS,
+                              PERF_COUNT_HW_CACHE_MISSES};
+  for (size_t i = 0; i < fds_.size(); ++i) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = configs[i];
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // this thread on any cpu, the first event leads the group
+    fds_[i] = syscall(__NR_perf_event_open, &attr, 0, -1,
+                      i == 0 ? -1 : fds_[0], 0);
+    if (fds_[i] < 0) {
+      std::cerr << "perf_event_open: " << strerror(errno)
+                << ", hardware counters disabled for this thread" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool PerfCounters::read(PerfSample& sample) const {
+  struct {
+    uint64_t nr;
+    uint64_t values[3];
+  } group;
+  if (::read(fds_[0], &group, sizeof(group)) != sizeof(group)) {
+    return false;
+  }
+  sample.cycles = group.values[0];
+  sample.instructions = group.values[1];
+  sample.llc_misses = group.values[2];
+  return true;
+}
+
+StageTracer::Ring* StageTracer::local_ring() {
+  thread_local Ring* ring = nullptr;
+  if (unlikely(ring == nullptr)) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    rings_.emplace_back(new Ring());
+    ring = rings_.back().get();
+  }
+  return ring;
+}
+
+void StageTracer::record(const RequestTrace& trace) {
+  if (!stageTracing) {
+    return;
+  }
+  Ring* ring = local_ring();
+  uint64_t head = ring->head.load(std::memory_order_relaxed);
+  ring->records[head % kRingSize] = trace;
+  ring->head.store(head + 1, std::memory_order_release);
+}
+
+namespace {
+
+struct StageSpec {
+  const char* name;
+  TracePoint from;
+  TracePoint to;
+};
+
+const StageSpec kStages[] = {
+    {"read", kReceived, kRead},        {"parse", kRead, kParsed},
+    {"format", kParsed, kFormatted},   {"queue", kFormatted, kDequeued},
+    {"inference", kDequeued, kInferred}, {"reply", kInferred, kReplied},
+    {"total", kReceived, kReplied},
+};
+
+double percentile(const std::vector<uint64_t>& sorted, double p) {
+  size_t idx = std::min(sorted.size() - 1, size_t(p * sorted.size()));
+  return sorted[idx] / 1e3;
+}
+
+}  // namespace
+
+void StageTracer::dump(std::ostream& out) {
+  std::vector<RequestTrace> traces;
+  uint64_t requests = 0;
+  const uint64_t allocations = heap_allocations();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& ring : rings_) {
+      uint64_t head = ring->head.load(std::memory_order_acquire);
+      requests += head;
+      uint64_t count = std::min<uint64_t>(head, kRingSize);
+      for (uint64_t i = head - count; i < head; ++i) {
+        traces.push_back(ring->records[i % kRingSize]);
+      }
+    }
+  }
+  // requests that were dropped on the way never reach kReplied
+  traces.erase(std::remove_if(traces.begin(), traces.end(),
+                              [](const RequestTrace& t) {
+                                return t.ts[kReceived] == 0 or
+                                       t.ts[kReplied] == 0;
+                              }),
+               traces.end());
+
+  // the dump allocates too, count from before it started
+  const uint64_t new_requests = requests - last_requests_;
+  out << "Heap allocations: " << allocations - last_allocations_ << " for "
+      << new_requests << " requests since the last dump";
+  if (new_requests > 0) {
+    out << ", " << std::fixed << std::setprecision(2)
+        << double(allocations - last_allocations_) / new_requests
+        << " per request";
+  }
+  out << std::endl;
+  last_allocations_ = allocations;
+  last_requests_ = requests;
+
+  out << "Stage latency over " << traces.size() << " requests (us)"
+      << std::endl;
+  if (traces.empty()) {
+    return;
+  }
+  out << std::setw(10) << "stage" << std::setw(10) << "p50" << std::setw(10)
+      << "p90" << std::setw(10) << "p99" << std::setw(10) << "p99.9"
+      << std::setw(10) << "max" << std::endl;
+  std::vector<uint64_t> durations;
+  durations.reserve(traces.size());
+  for (auto& stage : kStages) {
+    durations.clear();
+    for (auto& t : traces) {
+      // a point can be skipped, e.g. no queue without batch mode
+      uint64_t from = t.ts[stage.from], to = t.ts[stage.to];
+      if (from != 0 and to >= from) {
+        durations.push_back(to - from);
+      }
+    }
+    if (durations.empty()) {
+      continue;
+    }
+    std::sort(durations.begin(), durations.end());
+    out << std::fixed << std::setprecision(1) << std::setw(10) << stage.name
+        << std::setw(10) << percentile(durations, 0.5) << std::setw(10)
+        << percentile(durations, 0.9) << std::setw(10)
+        << percentile(durations, 0.99) << std::setw(10)
+        << percentile(durations, 0.999) << std::setw(10)
+        << durations.back() / 1e3 << std::endl;
+  }
+
+  // hardware counters are per inference call, shared by its batch
+  PerfSample sum;
+  uint64_t batches = 0, sampled = 0;
+  for (auto& t : traces) {
+    if (t.perf.cycles == 0) {
+      continue;
+    }
+    sum.cycles += t.perf.cycles / t.batch_size;
+    sum.instructions += t.perf.instructions / t.batch_size;
+    sum.llc_misses += t.perf.llc_misses / t.batch_size;
+    batches += t.batch_size;
+    sampled++;
+  }
+  if (sampled > 0) {
+    out << "Inference per request: " << sum.cycles / sampled << " cycles, "
+        << sum.instructions / sampled << " instructions, "
+        << sum.llc_misses / sampled << " LLC misses, mean batch "
+        << std::setprecision(1) << double(batches) / sampled << std::endl;
+  }
+}
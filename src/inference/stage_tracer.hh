@@ -0,0 +1,116 @@
+#ifndef STAGE_TRACER_HH
+#define STAGE_TRACER_HH
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+#include "define.hh"
+#include "timestamp.hh"
+
+/* points in the life of one ALIVE request */
+enum TracePoint {
+  kReceived = 0,  // first byte of the request is in
+  kRead,          // whole message is in
+  kParsed,        // json::parse done
+  kFormatted,     // feature window built, request handed to TFInference
+  kDequeued,      // picked up by the inference loop
+  kInferred,      // Session::Run returned
+  kReplied,       // reply written to the socket
+  kNumTracePoints
+};
+
+/* hardware counters of the inference call that served the request */
+struct PerfSample {
+  uint64_t cycles = 0;
+  uint64_t instructions = 0;
+  uint64_t llc_misses = 0;
+};
+
+struct RequestTrace {
+  std::array<uint64_t, kNumTracePoints> ts{};
+  int64_t flow_id = 0;
+  // number of requests served by the same Session::Run
+  uint32_t batch_size = 0;
+  PerfSample perf{};
+
+  inline void mark(TracePoint point) {
+    if (stageTracing) {
+      ts[point] = monotonic_nsecs();
+    }
+  }
+  void reset() { *this = RequestTrace(); }
+};
+
+/**
+ * @brief Per-thread perf_event_open group (cycles, instructions, LLC misses).
+ *
+ * The counters follow the calling thread only, so each thread that runs
+ * inference opens its own group on first use.
+ */
+class PerfCounters {
+ public:
+  /* nullptr if counters are disabled or the kernel refused them */
+  static PerfCounters* ThreadLocal();
+  ~PerfCounters();
+
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+
+  /* running totals since the group was opened */
+  bool read(PerfSample& sample) const;
+
+ private:
+  PerfCounters();
+  bool open();
+
+ private:
+  std::array<int, 3> fds_;
+};
+
+/**
+ * @brief Collects finished RequestTraces and reports per-stage percentiles.
+ *
+ * Each thread records into its own fixed ring, so recording takes no lock
+ * and allocates nothing. A dump copies the rings; a record overwritten while
+ * it is being copied can show up torn, which only costs one sample.
+ */
+class StageTracer {
+ public:
+  static StageTracer* Get() {
+    static StageTracer tracer;
+    return &tracer;
+  }
+
+  void record(const RequestTrace& trace);
+
+  /* per-stage percentiles over the last kRingSize requests of each thread,
+   * and heap allocations per request since the previous dump */
+  void dump(std::ostream& out);
+
+ private:
+  StageTracer()
+      : mutex_(), rings_(), last_allocations_(0), last_requests_(0) {}
+  StageTracer(const StageTracer&) = delete;
+  StageTracer& operator=(const StageTracer&) = delete;
+
+  static constexpr size_t kRingSize = 8192;
+  struct Ring {
+    std::array<RequestTrace, kRingSize> records{};
+    std::atomic<uint64_t> head{0};
+  };
+  Ring* local_ring();
+
+ private:
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<Ring>> rings_;
+  // heap allocations and requests as of the previous dump
+  uint64_t last_allocations_;
+  uint64_t last_requests_;
+};
+
+#endif  // STAGE_TRACER_HH
@@ -0,0 +1,30 @@
+#include "state_recorder.hh"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+void StateRecorder::open(const std::string& path, uint32_t every) {
+  file_ = fopen(path.c_str(), "ab");
+  if (file_ == nullptr) {
+    throw std::runtime_error("StateRecorder: " + path + ": " +
+                             strerror(errno));
+  }
+  every_ = every > 0 ? every : 1;
+}
+
+StateRecorder::~StateRecorder() {
+  if (file_ != nullptr) {
+    fclose(file_);
+  }
+}
+
+void StateRecorder::record(const NNInput& state, float action) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (seen_++ % every_ != 0) {
+    return;
+  }
+  // stdio buffers the records, the file is flushed on exit
+  fwrite(state.data(), sizeof(float), state.size(), file_);
+  fwrite(&action, sizeof(float), 1, file_);
+}
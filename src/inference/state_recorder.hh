@@ -0,0 +1,43 @@
+#ifndef STATE_RECORDER_HH
+#define STATE_RECORDER_HH
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+
+#include "define.hh"
+
+/**
+ * @brief Records what the actor sees and answers, to distill smaller actors
+ * from production traffic (python/distill.py).
+ *
+ * Each record is kNNInputSize float32 inputs followed by the float32 action,
+ * in host byte order. Only every n-th reply is kept.
+ */
+class StateRecorder {
+ public:
+  static StateRecorder* Get() {
+    static StateRecorder recorder;
+    return &recorder;
+  }
+
+  void open(const std::string& path, uint32_t every);
+  inline bool enabled() const { return file_ != nullptr; }
+
+  void record(const NNInput& state, float action);
+
+ private:
+  StateRecorder() : mutex_(), file_(nullptr), every_(1), seen_(0) {}
+  ~StateRecorder();
+  StateRecorder(const StateRecorder&) = delete;
+  StateRecorder& operator=(const StateRecorder&) = delete;
+
+ private:
+  std::mutex mutex_;
+  FILE* file_;
+  uint32_t every_;
+  uint64_t seen_;
+};
+
+#endif  // STATE_RECORDER_HH
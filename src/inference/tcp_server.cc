@@ -0,0 +1,422 @@
+#include "tcp_server.hh"
+
+#include <algorithm>
+#include <cstring>
+
+#include "serialization.hh"
+#include "tracer.hh"
+
+TcpServer::TcpServer(boost::asio::io_service& io_service, unsigned short port)
+    : io_service_(io_service),
+      acceptor_(io_service, boost::asio::ip::tcp::endpoint(
+                                boost::asio::ip::tcp::v4(), port)),
+      sessions_(),
+      paused_(false),
+      parked_() {}
+
+TcpServer::TcpServer(boost::asio::io_service& io_service,
+                     const HandoffState& state)
+    : io_service_(io_service),
+      acceptor_(io_service, boost::asio::ip::tcp::v4(), state.listener_fd),
+      sessions_(),
+      paused_(false),
+      parked_() {
+  adopt_contexts(state);
+  for (auto& handoff : state.sessions) {
+    auto session = std::make_shared<TcpSession>(io_service_);
+    session->set_tcp_server(this);
+    session->socket().assign(boost::asio::ip::tcp::v4(), handoff.fd);
+    sessions_.push_back(session);
+    session->start(handoff.pending);
+  }
+}
+
+void TcpServer::start() {
+  auto new_session = std::make_shared<TcpSession>(io_service_);
+  new_session->set_tcp_server(this);
+  acceptor_.async_accept(
+      new_session->socket(),
+      boost::bind(&TcpServer::handle_accept, this, new_session,
+                  boost::asio::placeholders::error));
+}
+
+void TcpServer::handle_accept(std::shared_ptr<TcpSession> new_session,
+                              const boost::system::error_code& error) {
+  if (!error) {
+    // replies are small and latency bound
+    new_session->socket().set_option(boost::asio::ip::tcp::no_delay(true));
+    sessions_.erase(std::remove_if(sessions_.begin(), sessions_.end(),
+                                   [](const std::weak_ptr<TcpSession>& s) {
+                                     return s.expired();
+                                   }),
+                    sessions_.end());
+    sessions_.push_back(new_session);
+    new_session->start();
+    if (!paused_) {
+      start();
+    }
+  } else if (!paused_) {
+    std::cerr << "Accept error: " << error.message() << std::endl;
+  }
+}
+
+void TcpServer::pause(std::function<void()> on_paused) {
+  paused_ = true;
+  acceptor_.cancel();
+  for (auto& weak : sessions_) {
+    if (auto session = weak.lock()) {
+      boost::system::error_code ignored;
+      session->socket().cancel(ignored);
+    }
+  }
+  io_service_.post(on_paused);
+}
+
+void TcpServer::resume() {
+  paused_ = false;
+  for (auto& session : parked_) {
+    session->start(session->pending());
+  }
+  parked_.clear();
+  start();
+}
+
+void TcpServer::export_state(HandoffState& state) {
+  state.channel = "tcp";
+  state.listener_fd = acceptor_.native_handle();
+  for (auto& session : parked_) {
+    state.sessions.push_back(
+        {session->socket().native_handle(), session->pending()});
+  }
+  export_contexts(state);
+}
+
+TcpSession::TcpSession(boost::asio::io_service& io_service)
+    : socket_(io_service),
+      recv_buffer_(),
+      message_length_buffer_(),
+      message_length_(0),
+      partial_(0),
+      pending_(),
+      server_(nullptr),
+      queue_mutex_(),
+      queued_(),
+      writing_(),
+      write_pending_(false) {}
+
+boost::asio::ip::tcp::socket& TcpSession::socket() { return socket_; }
+
+void TcpSession::start() {
+  if (server_->paused_) {
+    pending_.clear();
+    server_->parked_.push_back(shared_from_this());
+    return;
+  }
+  partial_ = 0;
+  boost::asio::async_read(
+      socket_,
+      boost::asio::buffer(message_length_buffer_.data(),
+                          sizeof(message_length_)),
+      boost::bind(&TcpSession::handle_read_length, shared_from_this(),
+                  boost::asio::placeholders::error,
+                  boost::asio::placeholders::bytes_transferred));
+}
+
+void TcpSession::start(const std::string& pending) {
+  if (pending.size() < sizeof(message_length_)) {
+    std::memcpy(message_length_buffer_.data(), pending.data(), pending.size());
+    partial_ = pending.size();
+    boost::asio::async_read(
+        socket_,
+        boost::asio::buffer(message_length_buffer_.data() + partial_,
+                            sizeof(message_length_) - partial_),
+        boost::bind(&TcpSession::handle_read_length, shared_from_this(),
+                    boost::asio::placeholders::error,
+                    boost::asio::placeholders::bytes_transferred));
+    return;
+  }
+  std::memcpy(message_length_buffer_.data(), pending.data(),
+              sizeof(message_length_));
+  message_length_ = get_uint16(message_length_buffer_.data());
+  partial_ = pending.size() - sizeof(message_length_);
+  if (message_length_ > recv_buffer_.size() or partial_ > message_length_) {
+    std::cerr << "Dropping a session with a corrupt pending frame"
+              << std::endl;
+    return;
+  }
+  std::memcpy(recv_buffer_.data(), pending.data() + sizeof(message_length_),
+              partial_);
+  trace_.reset();
+  trace_.mark(kReceived);
+  boost::asio::async_read(
+      socket_,
+      boost::asio::buffer(recv_buffer_.data() + partial_,
+                          message_length_ - partial_),
+      boost::bind(&TcpSession::handle_read_message, shared_from_this(),
+                  boost::asio::placeholders::error,
+                  boost::asio::placeholders::bytes_transferred,
+                  message_length_));
+}
+
+bool TcpSession::park(const boost::system::error_code& error,
+                      std::size_t read) {
+  if (!server_->paused_ or
+      (error and error != boost::asio::error::operation_aborted)) {
+    return false;
+  }
+  pending_.assign(message_length_buffer_.data(),
+                  std::min(read, sizeof(message_length_)));
+  if (read > sizeof(message_length_)) {
+    pending_.append(recv_buffer_.data(), read - sizeof(message_length_));
+  }
+  server_->parked_.push_back(shared_from_this());
+  return true;
+}
+
+void TcpSession::handle_read_length(const boost::system::error_code& error,
+                                    std::size_t bytes_transferred) {
+  if (park(error, partial_ + bytes_transferred)) {
+    return;
+  }
+  trace_.reset();
+  trace_.mark(kReceived);
+  message_length_ = get_uint16(message_length_buffer_.data());
+  partial_ = 0;
+  if (error) {
+    if (error != boost::asio::error::eof) {
+      std::cerr << "Error reading message length: " << error.message()
+                << std::endl;
+    }
+    close_session();
+    return;
+  }
+  if (unlikely(message_length_ > recv_buffer_.size())) {
+    std::cerr << "Message of " << message_length_
+              << " bytes is too long, closing the connection" << std::endl;
+    socket_.close();
+    close_session();
+    return;
+  }
+  boost::asio::async_read(
+      socket_, boost::asio::buffer(recv_buffer_.data(), message_length_),
+      boost::bind(&TcpSession::handle_read_message, shared_from_this(),
+                  boost::asio::placeholders::error,
+                  boost::asio::placeholders::bytes_transferred,
+                  message_length_));
+}
+
+void TcpSession::handle_read_message(const boost::system::error_code& error,
+                                     std::size_t bytes_transferred,
+                                     std::size_t expected_length) {
+  if (error and
+      park(error, sizeof(message_length_) + partial_ + bytes_transferred)) {
+    return;
+  }
+  if (error) {
+    std::cerr << "Error reading message: " << error.message() << std::endl;
+    close_session();
+    return;
+  }
+  trace_.mark(kRead);
+  Message msg;
+  if (unlikely(!decode_message(recv_buffer_.data(), expected_length, msg))) {
+    try {
+      decode_message(json::parse(recv_buffer_.data(),
+                                 recv_buffer_.data() + expected_length),
+                     msg);
+    } catch (const std::exception& e) {
+      // json or window errors: one bad client must not take down the flows
+      // of the others
+      std::cerr << "Malformed message, closing the connection: " << e.what()
+                << std::endl;
+      socket_.close();
+      close_session();
+      return;
+    }
+  }
+  trace_.mark(kParsed);
+#ifdef DEBUG
+  std::cout << "Received message: " << std::endl;
+  std::cout << std::string(recv_buffer_.data(), expected_length) << std::endl;
+#endif
+  MessageType type = static_cast<MessageType>(msg.type);
+  int64_t flow_id = msg.flow_id;
+  int cwnd = msg.state.cwnd;
+  int64_t request_id = msg.request_id;
+  // the reply may outlive the connection's last read
+  ResponseCallback send_response =
+      [self = shared_from_this(), flow_id, cwnd, request_id](
+          float action, const std::string& info) {
+        self->send_response(flow_id, cwnd, request_id, action, info);
+      };
+  switch (type) {
+  case MessageType::START: {
+    std::cout << "Register flow " << flow_id << std::endl;
+    handle_flow_init(flow_id, std::move(send_response));
+    break;
+  }
+  case MessageType::ALIVE: {
+    if (unlikely(!msg.has_state)) {
+      std::cerr << "Flow " << flow_id << " sent ALIVE without state"
+                << std::endl;
+      break;
+    }
+    aggregate_state(msg);
+    handle_congestion_control(msg, std::move(send_response));
+    break;
+  }
+  case MessageType::OBSERVE: {
+    // flows that went away without END leave the aggregates
+    server_->expire_contexts();
+    handle_observe(msg, std::move(send_response));
+    break;
+  }
+  case MessageType::END: {
+    // other flows may still share the connection, keep it open
+    std::cout << "Remove flow " << flow_id << std::endl;
+    handle_flow_removal(flow_id, owner());
+    break;
+  }
+  default:
+    break;
+  }
+  // START replies and immediate-mode actions queued on this thread
+  flush_deferred_replies();
+  start();
+}
+
+void TcpSession::close_session() { server_->release_contexts(owner()); }
+
+void TcpSession::handle_flow_init(int64_t& flow_id,
+                                  ResponseCallback&& send_response) {
+  auto& flow_contexts = server_->flow_contexts;
+  if (flow_contexts.find(flow_id) != flow_contexts.end()) {
+    std::cerr << "Flow " << flow_id << " already exists" << std::endl;
+    flow_id = server_->unused_flow_id();
+  }
+  flow_contexts[flow_id] = new FlowContext(flow_id);
+  json reply;
+  reply["flow_id"] = flow_id;
+  TFInference::Get()->advertise_cadence(reply);
+  send_response(-1, reply.dump());
+}
+
+void TcpSession::handle_congestion_control(const Message& msg,
+                                           ResponseCallback&& send_response) {
+  int64_t flow_id = msg.flow_id;
+  NNInput state;
+  // the window of a stateless ALIVE comes with it
+  Fc1Cache* fc1_cache = nullptr;
+  if (!stateless_input(msg, state)) {
+    auto context = server_->claim_context(flow_id, owner(), send_response);
+    if (unlikely(!context)) {
+      return;
+    }
+    {
+      TraceSpan span("format_state", flow_id);
+      state = context->format_state(msg.state, msg.executed);
+    }
+    fc1_cache = &context->fc1_cache();
+  }
+  trace_.flow_id = flow_id;
+  trace_.mark(kFormatted);
+  PlanRequest plan{msg.plan_steps, msg.state, msg.phase_hint};
+  if (!batchMode) {
+    TFInference::Get()->inference_imdt(flow_id, state,
+                                       std::move(send_response), trace_, plan,
+                                       fc1_cache);
+  } else {
+    TFInference::Get()->submit_inference_request(
+        flow_id, state, std::move(send_response), trace_, plan, fc1_cache);
+  }
+}
+
+void TcpSession::handle_flow_removal(int64_t flow_id, uint64_t owner) {
+  server_->handle_flow_removal(flow_id, owner);
+}
+
+void TcpSession::send_response(int64_t flow_id, int cwnd, int64_t request_id,
+                               float action, const std::string& info) {
+  if (info != "") {
+    std::string body = info;
+    // every json reply echoes the request id, action replies do it below
+    if (request_id >= 0 and body.back() == '}') {
+      body.pop_back();
+      body += ",\"req_id\":" + std::to_string(request_id) + "}";
+    }
+    std::string response = put_field(body.length()) + body;
+    queue_reply(response.data(), response.size());
+    return;
+  }
+  std::array<char, kMaxActionReplySize> reply;
+  auto new_cwnd = map_action(action, cwnd);
+  size_t reply_len = encode_action_reply(reply.data(), flow_id, new_cwnd,
+                                         request_id,
+                                         TFInference::Get()->backoff());
+#ifdef DEBUG
+  std::cout << "Flow " << flow_id << " original cwnd: " << cwnd
+            << ", action: " << action << ", sending response: "
+            << std::string(reply.data() + 2, reply_len - 2) << std::endl;
+#endif
+  queue_reply(reply.data(), reply_len);
+}
+
+void TcpSession::queue_reply(const char* data, size_t length) {
+  bool first;
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    first = queued_.empty();
+    queued_.append(data, length);
+  }
+  if (first) {
+    defer_flush(shared_from_this());
+  }
+}
+
+void TcpSession::flush_replies() {
+  // a peer that stops reading must not stall the batch thread; runs inline
+  // when called on the io thread
+  boost::asio::dispatch(socket_.get_executor(),
+                        [self = shared_from_this()] { self->write_queued(); });
+}
+
+void TcpSession::write_queued() {
+  if (write_pending_) {
+    // handle_write picks up what was queued meanwhile
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    writing_.swap(queued_);
+  }
+  if (writing_.empty()) {
+    return;
+  }
+  write_pending_ = true;
+  boost::asio::async_write(
+      socket_, boost::asio::buffer(writing_),
+      boost::bind(&TcpSession::handle_write, shared_from_this(),
+                  boost::asio::placeholders::error,
+                  boost::asio::placeholders::bytes_transferred));
+}
+
+void TcpSession::handle_write(const boost::system::error_code& error,
+                              std::size_t written) {
+  if (error == boost::asio::error::operation_aborted and server_->paused_) {
+    // pause() cancels writes along with reads, the rest still goes out
+    writing_.erase(0, written);
+    boost::asio::async_write(
+        socket_, boost::asio::buffer(writing_),
+        boost::bind(&TcpSession::handle_write, shared_from_this(),
+                    boost::asio::placeholders::error,
+                    boost::asio::placeholders::bytes_transferred));
+    return;
+  }
+  write_pending_ = false;
+  writing_.clear();
+  if (unlikely(error)) {
+    std::cerr << "TCP Send Error: " << error.message() << std::endl;
+    return;
+  }
+  write_queued();
+}
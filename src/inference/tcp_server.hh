@@ -0,0 +1,119 @@
+#ifndef TCP_SERVER_HH
+#define TCP_SERVER_HH
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+
+#include "reply_batch.hh"
+#include "server.hh"
+
+/*
+ * Remote inference over TCP. A connection is shared by many flows and
+ * pipelined: clients tag each message with a "req_id" and keep several in
+ * flight, replies carry the same "req_id" and may come back in any order.
+ */
+class TcpServer;
+class TcpSession : public std::enable_shared_from_this<TcpSession>,
+                   Server,
+                   public BufferedReplies {
+ public:
+  TcpSession(boost::asio::io_service& io_service);
+  TcpSession(const TcpSession&) = delete;
+  TcpSession& operator=(const TcpSession&) = delete;
+
+  boost::asio::ip::tcp::socket& socket();
+
+  virtual void start() override;
+
+  /* start reading with the first bytes of a frame already in */
+  void start(const std::string& pending);
+
+  void set_tcp_server(TcpServer* server) { server_ = server; }
+
+  // bytes of the frame that was being read when the server paused
+  const std::string& pending() const { return pending_; }
+
+  /* hand the queued replies to the io thread, which writes them with one
+   * send; never blocks the caller */
+  virtual void flush_replies() override;
+
+ protected:
+  virtual void handle_flow_init(int64_t& flow_id,
+                                ResponseCallback&& send_response) override;
+  virtual void handle_congestion_control(
+      const Message& msg, ResponseCallback&& send_response) override;
+
+  virtual void handle_flow_removal(int64_t flow_id, uint64_t owner) override;
+
+ private:
+  void handle_read_length(const boost::system::error_code& error,
+                          std::size_t bytes_transferred);
+  void handle_read_message(const boost::system::error_code& error,
+                           std::size_t bytes_transferred,
+                           std::size_t expected_length);
+  bool park(const boost::system::error_code& error, std::size_t read);
+  /* owns the flows whose ALIVEs come over this connection */
+  uint64_t owner() const { return reinterpret_cast<uintptr_t>(this); }
+  /* the connection is gone, its flows may reconnect */
+  void close_session();
+  void send_response(int64_t flow_id, int cwnd, int64_t request_id,
+                     float action, const std::string& info);
+  /* append a framed reply, flushed by whoever made the queue non-empty */
+  void queue_reply(const char* data, size_t length);
+  /* on the io thread: start writing the queue unless a write is pending */
+  void write_queued();
+  void handle_write(const boost::system::error_code& error,
+                    std::size_t written);
+
+ private:
+  boost::asio::ip::tcp::socket socket_;
+  std::array<char, kMaxMessageSize> recv_buffer_;
+  std::array<char, 2> message_length_buffer_;
+  uint16_t message_length_;
+  std::size_t partial_;
+  std::string pending_;
+  TcpServer* server_;
+
+  // replies queued by the io and inference threads
+  std::mutex queue_mutex_;
+  std::string queued_;
+  // owned by the io thread while a write is pending, swapped with queued_
+  // so both keep their capacity
+  std::string writing_;
+  bool write_pending_;
+};
+
+class TcpServer : public Server {
+ public:
+  friend class TcpSession;
+  TcpServer(boost::asio::io_service& io_service, unsigned short port);
+  /* adopt the listener, sessions and flows of the infer being replaced */
+  TcpServer(boost::asio::io_service& io_service, const HandoffState& state);
+
+  virtual void start() override;
+
+  virtual void pause(std::function<void()> on_paused) override;
+  virtual void resume() override;
+  virtual void export_state(HandoffState& state) override;
+
+ protected:
+  virtual void handle_flow_init(int64_t&, ResponseCallback&&) override {}
+  virtual void handle_congestion_control(const Message&,
+                                         ResponseCallback&&) override {}
+
+ private:
+  void handle_accept(std::shared_ptr<TcpSession> new_session,
+                     const boost::system::error_code& error);
+
+ private:
+  boost::asio::io_service& io_service_;
+  boost::asio::ip::tcp::acceptor acceptor_;
+  std::vector<std::weak_ptr<TcpSession>> sessions_;
+  bool paused_;
+  std::vector<std::shared_ptr<TcpSession>> parked_;
+};
+
+#endif  // TCP_SERVER_HH
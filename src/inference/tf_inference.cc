@@ -1,90 +1,244 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
 #include <thread>
 
+#include "context.hh"
 #include "define.hh"
+#include "reply_batch.hh"
+#include "state_recorder.hh"
 #include "tf_inference.hh"
+#include "timestamp.hh"
+#include "tracer.hh"
 // TFInference* tf_infer_session = nullptr;
 
 TFInference::TFInference(const std::string& graph_path,
-                         const std::string& checkpoint_path, const int batch) {
-  create_session();
-  TF_CHECK_OK(LoadModel(session_, graph_path, checkpoint_path));
+                         const std::string& checkpoint_path, const int batch)
+    : backend_(InferenceBackend::Create(inferenceBackend, graph_path,
+                                        checkpoint_path, intraOpThreads,
+                                        interOpThreads)) {
+  if (incrementalFc1 and (backend_->fc1_units() == 0 or
+                         backend_->fc1_units() > kMaxFc1Units)) {
+    throw std::runtime_error("--incremental needs the native backend and at "
+                             "most " + std::to_string(kMaxFc1Units) +
+                             " fc1 units");
+  }
+  inference_req_queue_.reserve(1024);
+  batch_epoch_ns_ = monotonic_nsecs();
   // spawn a new thread to run the inference session
   if (batch) {
     inference_thread_ = new std::thread(&TFInference::inference_loop, this);
   }
   // perform a dummy inference to warm up the session
-  std::vector<std::vector<float>> states = {
-      std::vector<float>(kNNInputSize, 0.0)};
-  tensorflow::Tensor input = prepare_batch_input(states);
-  std::vector<tensorflow::Tensor> output;
-  internal_inference(input, output);
+  NNInput state{};
+  const float* states[] = {state.data()};
+  float action;
+  batch_inference(states, 1, &action);
 }
 
 void TFInference::inference_loop() {
+  // reused by every batch: the queue and the batch swap their buffers, and
+  // per-batch scratch comes from a monotonic arena on this thread's stack
+  std::vector<InferenceRequest> requests;
+  requests.reserve(1024);
+  alignas(std::max_align_t) std::array<std::byte, kBatchArenaSize> arena_buffer;
+  // requests left over by a capped batch are served without waiting
+  bool backlog = false;
+  auto has_work = [this] {
+    return (!keep_running_.load()) || (!inference_req_queue_.empty());
+  };
   // this loop check the inference request queue at a fixed interval
   while (keep_running_.load()) {
-    std::vector<InferenceRequest> requests;
+    if (alignedBatches and !backlog) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, has_work);
+      }
+      // the batch takes whatever arrives until the advertised boundary
+      sleep_until_boundary();
+    }
+    uint64_t batch_start_ns;
+    size_t leftover;
     {
       std::unique_lock<std::mutex> lock(mutex_);
       // wait until there is at least one request
-      cv_.wait(lock, [this] { return (!keep_running_.load()) || (!inference_req_queue_.empty()); });
-      // requests = std::move(inference_req_queue_);
-      requests.insert(requests.end(), std::make_move_iterator(inference_req_queue_.begin()), 
-                    std::make_move_iterator(inference_req_queue_.end()));
-      inference_req_queue_.erase(inference_req_queue_.begin(), inference_req_queue_.end());
-      // inference_req_queue_.clear();
+      cv_.wait(lock, has_work);
+      batch_start_ns = monotonic_nsecs();
+      if (maxBatchSize == 0 or inference_req_queue_.size() <= maxBatchSize) {
+        requests.swap(inference_req_queue_);
+      } else {
+        // the oldest requests first, the rest go into the next batch
+        auto last = inference_req_queue_.begin() + maxBatchSize;
+        std::move(inference_req_queue_.begin(), last,
+                  std::back_inserter(requests));
+        inference_req_queue_.erase(inference_req_queue_.begin(), last);
+      }
+      leftover = inference_req_queue_.size();
+      backlog = leftover > 0;
     }
     if (requests.size() > 0) {
-      std::vector<std::vector<float>> states;
-      std::vector<int> flow_ids;
+      // falls back to the heap only for batches beyond kBatchArenaSize
+      std::pmr::monotonic_buffer_resource arena(arena_buffer.data(),
+                                                arena_buffer.size());
+      std::pmr::vector<const float*> states(&arena);
+      std::pmr::vector<float> actions(requests.size(), &arena);
+      states.reserve(requests.size());
       for (auto& req : requests) {
-        flow_ids.push_back(req.first);
-        states.push_back(req.second);
+        req.trace.mark(kDequeued);
+        states.push_back(incrementalFc1 ? req.fc1 : req.state.data());
+      }
+      Tracer::Get()->instant("batch_formed", -1, "size", requests.size());
+      PerfSample perf;
+      {
+        TraceSpan span("inference", -1);
+        span.set_arg("size", requests.size());
+        batch_inference(states.data(), states.size(), actions.data(), &perf,
+                        incrementalFc1);
       }
-      std::vector<float> actions = batch_inference(states);
-      for (size_t i = 0; i < flow_ids.size(); ++i) {
-        send_reply(flow_ids[i], actions[i]);
+      if (unlikely(verifyIncremental)) {
+        verify_incremental(requests.data(), requests.size(), actions.data());
       }
+      auto plans =
+          make_plans(requests.data(), requests.size(), actions.data());
+      for (size_t i = 0; i < requests.size(); ++i) {
+        auto& trace = requests[i].trace;
+        trace.mark(kInferred);
+        trace.batch_size = requests.size();
+        trace.perf = perf;
+        std::string info = plans.empty() ? std::string() : std::move(plans[i]);
+        if (requests[i].arrived_ns) {
+          info = with_batch_lead(requests[i], actions[i], info,
+                                 batch_start_ns);
+        }
+        send_reply(requests[i], actions[i], info);
+      }
+      // one write per connection for the whole batch
+      flush_deferred_replies();
+      in_flight_ -= requests.size();
+      update_load(batch_start_ns, monotonic_nsecs(), requests.size(),
+                  leftover);
+    }
+    requests.clear();
+    if (!backlog and !alignedBatches) {
+      std::this_thread::sleep_for(std::chrono::microseconds(batchInterval));
     }
-    std::this_thread::sleep_for(std::chrono::microseconds(kBatchInterval));
   }
 }
 
-void TFInference::send_reply(int flow_id, float action) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  auto& send_response = flow_callbacks_[flow_id];
-  try{
-    send_response(action, "");
-  } catch (const std::exception& e) {
-    std::cerr << "Error sending response: " << e.what() << std::endl;
+std::vector<std::string> TFInference::make_plans(
+    const InferenceRequest* requests, size_t batch, const float* actions) {
+  struct Rollout {
+    size_t index;
+    int steps;
+    // a copy of the flow's window, the predicted states go in here
+    FlowContext context;
+    DeepCCState state;
+    std::array<int, kMaxPlanSteps> cwnds;
+  };
+  std::vector<std::string> plans;
+  std::vector<Rollout> rollouts;
+  int longest = 1;
+  for (size_t i = 0; i < batch; ++i) {
+    auto& plan = requests[i].plan;
+    int steps = std::min({plan.steps, maxPlanSteps, kMaxPlanSteps});
+    if (steps <= 1) {
+      continue;
+    }
+    rollouts.push_back({i, steps, FlowContext(requests[i].flow_id,
+                                              requests[i].state),
+                        plan.state, {}});
+    rollouts.back().cwnds[0] = map_action(actions[i], plan.state.cwnd);
+    longest = std::max(longest, steps);
+  }
+  if (rollouts.empty()) {
+    return plans;
+  }
+  TraceSpan span("rollout", -1);
+  span.set_arg("size", rollouts.size());
+  std::vector<Rollout*> active;
+  std::vector<const float*> states;
+  std::vector<float> next(rollouts.size());
+  for (int step = 1; step < longest; ++step) {
+    active.clear();
+    states.clear();
+    for (auto& rollout : rollouts) {
+      if (step >= rollout.steps) {
+        continue;
+      }
+      rollout.state = predict_state(rollout.state, rollout.cwnds[step - 1]);
+      states.push_back(rollout.context.format_state(rollout.state).data());
+      active.push_back(&rollout);
+    }
+    batch_inference(states.data(), states.size(), next.data());
+    for (size_t i = 0; i < active.size(); ++i) {
+      active[i]->cwnds[step] = map_action(next[i], active[i]->state.cwnd);
+    }
+  }
+  plans.resize(batch);
+  for (auto& rollout : rollouts) {
+    auto& request = requests[rollout.index];
+    plans[rollout.index] =
+        encode_plan_reply(request.flow_id, rollout.cwnds.data(), rollout.steps,
+                          request.plan.state);
+  }
+  return plans;
+}
+
+void TFInference::send_reply(InferenceRequest& request, float action,
+                             const std::string& info) {
+  {
+    TraceSpan span("reply", request.flow_id);
+    try{
+      request.send_response(action, info);
+    } catch (const std::exception& e) {
+      std::cerr << "Error sending response: " << e.what() << std::endl;
+    }
+  }
+  request.trace.mark(kReplied);
+  StageTracer::Get()->record(request.trace);
+  if (unlikely(StateRecorder::Get()->enabled())) {
+    StateRecorder::Get()->record(request.state, action);
   }
-  flow_callbacks_.erase(flow_id);
 }
 
-float TFInference::inference_imdt(int flow_id, std::vector<float>&& state,
-                                  ResponseCallback&& send_response) {
-  register_flow_callback(flow_id, send_response);
+float TFInference::inference_imdt(int64_t flow_id, const NNInput& state,
+                                  ResponseCallback&& send_response,
+                                  const RequestTrace& trace,
+                                  const PlanRequest& plan,
+                                  Fc1Cache* fc1_cache) {
+  InferenceRequest request(flow_id, state, std::move(send_response), trace,
+                           plan);
+  fill_fc1(request, fc1_cache);
+  request.trace.mark(kDequeued);
 #ifdef PROFILE
   auto start = std::chrono::high_resolution_clock::now();
 #endif
-  std::vector<std::vector<float>> states = {state};
-  tensorflow::Tensor input = prepare_batch_input(states);
-  std::vector<tensorflow::Tensor> output;
-  auto start = std::chrono::high_resolution_clock::now();
-  internal_inference(input, output);
-  auto end = std::chrono::high_resolution_clock::now();
-  auto duration =
-      std::chrono::duration_cast<std::chrono::microseconds>(end - start);
-// std::cout << "Inference time: " << duration.count() << " microseconds"
-          // << std::endl;
-  float action = output[0].flat<float>().data()[0];
+  const float* states[] = {incrementalFc1 ? request.fc1 : state.data()};
+  float action;
+  {
+    TraceSpan span("inference", flow_id);
+    batch_inference(states, 1, &action, &request.trace.perf, incrementalFc1);
+  }
+  if (unlikely(verifyIncremental)) {
+    verify_incremental(&request, 1, &action);
+  }
+  request.trace.mark(kInferred);
+  request.trace.batch_size = 1;
 #ifdef DEBUG
   std::cout << "Inference: "
             << " flow_id " << flow_id << ", state: " << print_state(state)
             << ", action: " << action << std::endl;
 #endif
 
-  send_reply(flow_id, action);
+  if (plan.steps > 1) {
+    auto plans = make_plans(&request, 1, &action);
+    send_reply(request, action, plans.empty() ? std::string() : plans[0]);
+  } else {
+    send_reply(request, action);
+  }
+  flush_deferred_replies();
 #ifdef PROFILE
   auto end = std::chrono::high_resolution_clock::now();
   auto duration =
@@ -95,132 +249,160 @@ float TFInference::inference_imdt(int flow_id, std::vector<float>&& state,
   return action;
 }
 
-void TFInference::submit_inference_request(int flow_id,
-                                           std::vector<float>&& state,
-                                           ResponseCallback&& send_response) {
+void TFInference::submit_inference_request(int64_t flow_id,
+                                           const NNInput& state,
+                                           ResponseCallback&& send_response,
+                                           const RequestTrace& trace,
+                                           const PlanRequest& plan,
+                                           Fc1Cache* fc1_cache) {
+  InferenceRequest request(flow_id, state, std::move(send_response), trace,
+                           plan);
+  if (plan.phase_hint and alignedBatches) {
+    request.arrived_ns = monotonic_nsecs();
+  }
+  // on the receiving thread, outside the batch
+  fill_fc1(request, fc1_cache);
   // store the inference request
   std::lock_guard<std::mutex> lock(mutex_);
-  register_flow_callback(flow_id, std::move(send_response));
-  inference_req_queue_.push_back({flow_id, state});
+  inference_req_queue_.push_back(std::move(request));
+  in_flight_++;
   cv_.notify_all();
 }
 
-std::vector<float> TFInference::batch_inference(
-    const std::vector<std::vector<float>>& states) {
-  tensorflow::Tensor input = prepare_batch_input(states, states.size());
-  std::vector<tensorflow::Tensor> output;
-  internal_inference(input, output);
-  std::vector<float> actions;
-  actions.resize(states.size());
-  auto values = output[0].flat<float>().data();
-  for (size_t i = 0; i < states.size(); ++i) {
-    actions[i] = values[i];
-  }
-  return actions;
+void TFInference::advertise_cadence(json& reply) const {
+  if (!alignedBatches or !batchMode or batchInterval == 0) {
+    return;
+  }
+  reply["batch_interval"] = batchInterval;
+  reply["batch_phase"] = (batch_epoch_ns_ / 1000) % batchInterval;
 }
 
-tensorflow::Tensor TFInference::prepare_batch_input(
-    const std::vector<std::vector<float>>& states, int batch) {
-  tensorflow::TensorShape input_shape({batch, kNNInputSize});
-  tensorflow::Tensor tmp(tensorflow::DT_FLOAT, input_shape);
-  // copy state to input tensor
-  for (int i = 0; i < batch; ++i) {
-    auto state = states[i];
-    auto input = tmp.tensor<float, 2>();
-    for (size_t j = 0; j < kNNInputSize; ++j) {
-      input(i, j) = state[j];
-    }
+void TFInference::update_load(uint64_t batch_start_ns, uint64_t end_ns,
+                              size_t batch, size_t leftover) {
+  // weight of a new sample, and how far below the lower backoff's load
+  // demand has to fall before it is taken
+  const double kGain = 0.125, kHysteresis = 0.8;
+  // clients need a few ticks to follow a change, keep each one that long
+  const uint64_t kHoldNs = 250 * 1000 * 1000;
+  if (targetLoad <= 0) {
+    return;
+  }
+  uint64_t period = batch_start_ns - last_batch_start_ns_;
+  bool first = last_batch_start_ns_ == 0;
+  last_batch_start_ns_ = batch_start_ns;
+  if (first or period == 0) {
+    return;
+  }
+  double sample = static_cast<double>(end_ns - batch_start_ns) / period;
+  if (leftover > 0) {
+    // more arrives than a batch can take
+    sample = std::max(sample, 1.0 + static_cast<double>(leftover) / batch);
+  }
+  load_ += kGain * (sample - load_);
+  // clients that honour the backoff already query that many times less
+  int backoff = backoff_.load(std::memory_order_relaxed);
+  double demand = load_ * backoff;
+  int next = backoff;
+  if (demand > targetLoad * backoff) {
+    next = std::min(kMaxBackoff,
+                    static_cast<int>(std::ceil(demand / targetLoad)));
+  } else if (backoff > 1 and
+             demand < targetLoad * (backoff - 1) * kHysteresis) {
+    next = backoff - 1;
+  }
+  if (next != backoff and
+      batch_start_ns - backoff_changed_ns_ >= kHoldNs) {
+    backoff_changed_ns_ = batch_start_ns;
+    std::cout << "Load " << load_ << " of the batch thread, clients back off "
+              << next << "x" << std::endl;
+    // what the load should settle at, so that the old rate in the average
+    // does not count twice
+    load_ = demand / next;
+    backoff_.store(next, std::memory_order_relaxed);
   }
-  return tmp;
 }
 
-int TFInference::internal_inference(const tensorflow::Tensor& data,
-                                    std::vector<tensorflow::Tensor>& output) {
-  static tensorflow::Tensor train_flag(tensorflow::DT_BOOL,
-                                       tensorflow::TensorShape());
-  *train_flag.flat<bool>().data() = false;
-
-  // std::cout << data.DebugString() << std::endl;
-  // std::cout << train_flag.DebugString() << std::endl;
-  TensorDict feedDict = {
-      {"s0:0", data},
-      {"Actor_is_training:0", train_flag},
-  };
-  std::vector<std::string> outputOps = {
-      {"actor/Mul:0"},
-  };
-  // std::vector<tensorflow::Tensor> outputTensors;
-  tensorflow::Status status = session_->Run(feedDict, outputOps, {}, &output);
-  if (!status.ok()) {
-    std::cout << status.ToString() << "\n";
-    throw std::runtime_error("Error during inference");
-  }
-  // output = outputTensors;
-  return 0;
+void TFInference::sleep_until_boundary() const {
+  if (batchInterval == 0) {
+    return;
+  }
+  const uint64_t interval_ns = batchInterval * 1000;
+  uint64_t now = monotonic_nsecs();
+  uint64_t next = now + interval_ns - (now - batch_epoch_ns_) % interval_ns;
+  std::this_thread::sleep_for(std::chrono::nanoseconds(next - now));
 }
 
-int TFInference::create_session() {
-  tensorflow::SessionOptions options;
-
-  tensorflow::ConfigProto* config = &options.config;
-  config->set_allow_soft_placement(true);
-  tensorflow::Status status = NewSession(options, &session_);
-  if (!status.ok()) {
-    std::cout << status.ToString() << "\n";
-    return 1;
-  }
-  std::cout << "Session successfully created.\n";
-  return 1;
+std::string TFInference::with_batch_lead(const InferenceRequest& request,
+                                         float action, const std::string& info,
+                                         uint64_t batch_start_ns) const {
+  // hints are asked for once in a while, so the json path is fine here
+  json reply;
+  if (info.empty()) {
+    reply["cwnd"] = map_action(action, request.plan.state.cwnd);
+    reply["flow_id"] = request.flow_id;
+  } else {
+    reply = json::parse(info);
+  }
+  reply["batch_lead"] = batch_start_ns > request.arrived_ns
+                            ? (batch_start_ns - request.arrived_ns) / 1000
+                            : 0;
+  // a client that registered without START learns the cadence here
+  advertise_cadence(reply);
+  return reply.dump();
 }
 
-tensorflow::Status TFInference::LoadModel(tensorflow::Session* sess,
-                                          std::string graph_fn,
-                                          std::string checkpoint_fn) {
-  tensorflow::Status status;
-
-  // Read in the protobuf graph we exported
-  tensorflow::MetaGraphDef graph_def;
-  status = ReadBinaryProto(tensorflow::Env::Default(), graph_fn, &graph_def);
-  if (status != tensorflow::Status::OK()) {
-    std::cout << status.ToString() << std::endl;
-    return status;
+void TFInference::fill_fc1(InferenceRequest& request, Fc1Cache* fc1_cache) {
+  if (!incrementalFc1) {
+    return;
   }
-
-  // create the graph in the current session
-  status = sess->Create(graph_def.graph_def());
-  if (status != tensorflow::Status::OK()) {
-    std::cout << status.ToString() << std::endl;
-    return status;
+  if (fc1_cache) {
+    fc1_cache->update(*backend_, request.state, request.fc1);
+  } else {
+    Fc1Cache::compute(*backend_, request.state, request.fc1);
   }
+}
 
-  // restore model from checkpoint, iff checkpoint is given
-  if (checkpoint_fn != "") {
-    const std::string restore_op_name = graph_def.saver_def().restore_op_name();
-    const std::string filename_tensor_name =
-        graph_def.saver_def().filename_tensor_name();
-
-    tensorflow::Tensor filename_tensor(tensorflow::DT_STRING,
-                                       tensorflow::TensorShape());
-    filename_tensor.scalar<std::string>()() = checkpoint_fn;
-
-    TensorDict feed_dict = {{filename_tensor_name, filename_tensor}};
-    status = sess->Run(feed_dict, {}, {restore_op_name}, nullptr);
-    if (status != tensorflow::Status::OK()) {
-      std::cout << status.ToString() << std::endl;
-      return status;
+void TFInference::verify_incremental(const InferenceRequest* requests,
+                                     size_t batch, const float* actions) {
+  // float sums in another order
+  const float kTolerance = 1e-4;
+  std::vector<const float*> states;
+  for (size_t i = 0; i < batch; ++i) {
+    states.push_back(requests[i].state.data());
+  }
+  std::vector<float> full(batch);
+  backend_->run(states.data(), batch, full.data());
+  for (size_t i = 0; i < batch; ++i) {
+    float difference = std::abs(actions[i] - full[i]);
+    max_difference_ = std::max(max_difference_, difference);
+    if (difference > kTolerance and ++mismatched_ <= 10) {
+      std::cerr << "Incremental fc1 mismatch for flow " << requests[i].flow_id
+                << ": " << actions[i] << " vs " << full[i] << std::endl;
     }
-  } else {
-    // virtual Status Run(const std::vector<std::pair<string, Tensor> >&
-    // inputs,
-    //                  const std::vector<string>& output_tensor_names,
-    //                  const std::vector<string>& target_node_names,
-    //                  std::vector<Tensor>* outputs) = 0;
-    status = sess->Run({}, {}, {"init"}, nullptr);
-    if (status != tensorflow::Status::OK()) {
-      std::cout << status.ToString() << std::endl;
-      return status;
+    if (++verified_ % 10000 == 0) {
+      std::cout << "Incremental fc1: " << verified_ << " actions checked, "
+                << mismatched_ << " mismatches, max difference "
+                << max_difference_ << std::endl;
     }
   }
+}
 
-  return tensorflow::Status::OK();
-}
\ No newline at end of file
+void TFInference::batch_inference(const float* const* states, size_t batch,
+                                  float* actions, PerfSample* perf,
+                                  bool from_fc1) {
+  PerfCounters* counters = perf ? PerfCounters::ThreadLocal() : nullptr;
+  PerfSample before;
+  if (counters) {
+    counters->read(before);
+  }
+  if (from_fc1) {
+    backend_->run_fc1(states, batch, actions);
+  } else {
+    backend_->run(states, batch, actions);
+  }
+  if (counters and counters->read(*perf)) {
+    perf->cycles -= before.cycles;
+    perf->instructions -= before.instructions;
+    perf->llc_misses -= before.llc_misses;
+  }
+}
@@ -1,28 +1,79 @@
 #ifndef TF_INFERENCE_HH
 #define TF_INFERENCE_HH
 
+#include <atomic>
+#include <condition_variable>
 #include <deque>
+#include <memory>
+#include <memory_resource>
 #include <mutex>
 #include <thread>
+#include <vector>
 
-#include <tensorflow/core/platform/env.h>
-#include <tensorflow/core/protobuf/meta_graph.pb.h>
-#include <tensorflow/core/public/session.h>
-
+#include "backend.hh"
 #include "define.hh"
-typedef std::vector<std::pair<std::string, tensorflow::Tensor>> TensorDict;
+#include "fc1_cache.hh"
+#include "plan.hh"
+#include "stage_tracer.hh"
+
+// most a reply asks clients to stretch their query interval, --target-load
+const int kMaxBackoff = 8;
 
 class TFInference;
 class TFInference {
+ private:
+  // the request owns its reply callback, so no per-flow callback table
+  struct InferenceRequest {
+    int64_t flow_id;
+    NNInput state;
+    ResponseCallback send_response;
+    RequestTrace trace;
+    PlanRequest plan;
+    // fc1's product of state with --incremental, left to fill_fc1 rather
+    // than zeroed for every request
+    float fc1[kMaxFc1Units];
+    // when a request with a phase hint was queued, 0 for the others
+    uint64_t arrived_ns = 0;
+
+    InferenceRequest(int64_t flow_id_, const NNInput& state_,
+                     ResponseCallback&& send_response_,
+                     const RequestTrace& trace_, const PlanRequest& plan_)
+        : flow_id(flow_id_),
+          state(state_),
+          send_response(std::move(send_response_)),
+          trace(trace_),
+          plan(plan_) {}
+  };
+
  public:
   static TFInference* Get() {
     static TFInference tf_inference(graphPath, checkpointPath, batchMode);
     return &tf_inference;
   }
 
+  /* wait until every queued request has been replied to */
+  void drain() {
+    while (in_flight_.load() > 0) {
+      std::this_thread::sleep_for(std::chrono::microseconds(batchInterval));
+    }
+  }
+
+  /* how many times less often clients should query, 1 unless the batch
+   * thread is busier than --target-load */
+  int backoff() const { return backoff_.load(std::memory_order_relaxed); }
+
+  /* add the batch cadence to a START reply with --aligned-batches:
+   * batches start when CLOCK_MONOTONIC in microseconds is batch_phase
+   * modulo batch_interval */
+  void advertise_cadence(json& reply) const;
+
   void stop() {
+    {
+      // under the lock, so the loop cannot miss the wakeup
+      std::lock_guard<std::mutex> lock(mutex_);
+      keep_running_ = false;
+    }
     cv_.notify_all();
-    keep_running_ = false;
     if (inference_thread_) {
       inference_thread_->join();
     }
@@ -34,11 +85,14 @@ class TFInference {
   // disallow copy and assign
   TFInference(const TFInference&) = delete;
   TFInference& operator=(const TFInference&) = delete;
-  ~TFInference() { delete session_; }
+  ~TFInference() {}
 
  public:
-  void submit_inference_request(int flow_id, std::vector<float>&& state,
-                                ResponseCallback&& send_response);
+  void submit_inference_request(int64_t flow_id, const NNInput& state,
+                                ResponseCallback&& send_response,
+                                const RequestTrace& trace = RequestTrace(),
+                                const PlanRequest& plan = PlanRequest(),
+                                Fc1Cache* fc1_cache = nullptr);
   /**
    * @brief Perform the inference immediately and send the response back
    *
@@ -46,8 +100,11 @@ class TFInference {
    * @param send_response
    * @return float
    */
-  float inference_imdt(int flow_id, std::vector<float>&& state,
-                       ResponseCallback&& send_response);
+  float inference_imdt(int64_t flow_id, const NNInput& state,
+                       ResponseCallback&& send_response,
+                       const RequestTrace& trace = RequestTrace(),
+                       const PlanRequest& plan = PlanRequest(),
+                       Fc1Cache* fc1_cache = nullptr);
 
  private:
   /**
@@ -57,40 +114,67 @@ class TFInference {
    *
    */
   void inference_loop();
-  tensorflow::Tensor prepare_batch_input(
-      const std::vector<std::vector<float>>& states, int batch = 1);
 
+ public:
   /**
    * @brief Perform batch inference asynchronously
    *
-   * @param states
-   * @return std::vector<float>
+   * @param states batch rows of kNNInputSize floats each, or of fc1's
+   * product if from_fc1
+   * @param actions receives one action per row
    */
-  public:
-  std::vector<float> batch_inference(
-      const std::vector<std::vector<float>>& states);
+  void batch_inference(const float* const* states, size_t batch,
+                       float* actions, PerfSample* perf = nullptr,
+                       bool from_fc1 = false);
 
-  int internal_inference(const tensorflow::Tensor& data,
-                         std::vector<tensorflow::Tensor>& output);
+  void send_reply(InferenceRequest& request, float action,
+                  const std::string& info = std::string());
 
-  void send_reply(int flow_id, float action);
+  /**
+   * @brief Roll the actor forward for the requests that asked for a plan,
+   * one extra batch per step over the predicted states, see plan.hh
+   *
+   * @param actions the actions of this batch, the first step of each plan
+   * @return the encoded plan replies by request, empty if no request asked
+   * for a plan
+   */
+  std::vector<std::string> make_plans(const InferenceRequest* requests,
+                                      size_t batch, const float* actions);
 
-  int create_session();
+ private:
+  /* fc1's product of the request's window with --incremental, from the
+   * flow's cache if there is one */
+  void fill_fc1(InferenceRequest& request, Fc1Cache* fc1_cache);
 
-  tensorflow::Status LoadModel(tensorflow::Session* sess, std::string graph_fn,
-                               std::string checkpoint_fn = "");
+  /* the reply to a request with a phase hint, info with "batch_lead", the
+   * microseconds it waited for the batch that started at batch_start_ns */
+  std::string with_batch_lead(const InferenceRequest& request, float action,
+                              const std::string& info,
+                              uint64_t batch_start_ns) const;
 
-  inline void register_flow_callback(int flow_id,
-                                     ResponseCallback send_response) {
-    flow_callbacks_[flow_id] = send_response;
-  }
+  /* fold a batch that ran from batch_start_ns to end_ns, with leftover
+   * requests still queued behind it, into the load and the backoff */
+  void update_load(uint64_t batch_start_ns, uint64_t end_ns, size_t batch,
+                   size_t leftover);
+
+  /* sleep until the next batch boundary of --aligned-batches */
+  void sleep_until_boundary() const;
+
+  /* compare actions from cached fc1 sums with a full evaluation */
+  void verify_incremental(const InferenceRequest* requests, size_t batch,
+                          const float* actions);
+
+ public:
+
+  // bytes of the per-batch arena, enough for batches of a few thousands
+  static const size_t kBatchArenaSize = 64 * 1024;
 
  private:
-  using InferenceRequest = std::pair<int, std::vector<float>>;
-  tensorflow::Session* session_;
-  // for batch inference
+  // selected by --backend
+  std::unique_ptr<InferenceBackend> backend_;
+  // for batch inference, swapped with the loop's batch so that both keep
+  // their capacity
   std::vector<InferenceRequest> inference_req_queue_;
-  std::unordered_map<int, ResponseCallback> flow_callbacks_;
   std::mutex mutex_;
   std::condition_variable cv_;
 
@@ -98,6 +182,21 @@ class TFInference {
   std::thread* inference_thread_;
   // flag to indicate whether stop 
   std::atomic<bool> keep_running_ = true;
+  // submitted requests not replied to yet
+  std::atomic<size_t> in_flight_ = 0;
+  // batches start at batch_epoch_ns_ plus a multiple of batchInterval with
+  // --aligned-batches
+  uint64_t batch_epoch_ns_ = 0;
+  // EWMA of the batch thread's busy fraction, above 1 while requests queue
+  // up behind capped batches, and the backoff it asks for
+  double load_ = 0;
+  uint64_t last_batch_start_ns_ = 0;
+  uint64_t backoff_changed_ns_ = 0;
+  std::atomic<int> backoff_ = 1;
+  // --verify-incremental results
+  uint64_t verified_ = 0;
+  uint64_t mismatched_ = 0;
+  float max_difference_ = 0;
 };
 
 #endif  // TF_INFERENCE_HH
\ No newline at end of file
@@ -1,11 +1,45 @@
 #include "udp_server.hh"
 
+#include "tracer.hh"
+
 UdpServer::UdpServer(boost::asio::io_service& io_service)
     : Server(),
       socket_(io_service, boost::asio::ip::udp::endpoint(
-                              boost::asio::ip::udp::v4(), PORT)) {}
+                              boost::asio::ip::udp::v4(), PORT)),
+      io_service_(io_service),
+      paused_(false) {}
+
+UdpServer::UdpServer(boost::asio::io_service& io_service,
+                     const HandoffState& state)
+    : Server(),
+      socket_(io_service, boost::asio::ip::udp::v4(), state.listener_fd),
+      io_service_(io_service),
+      paused_(false) {
+  adopt_contexts(state);
+}
+
+void UdpServer::pause(std::function<void()> on_paused) {
+  // datagrams arrive whole, so any point between two receives will do
+  paused_ = true;
+  socket_.cancel();
+  io_service_.post(on_paused);
+}
+
+void UdpServer::resume() {
+  paused_ = false;
+  start();
+}
+
+void UdpServer::export_state(HandoffState& state) {
+  state.channel = "udp";
+  state.listener_fd = socket_.native_handle();
+  export_contexts(state);
+}
 
 void UdpServer::start() {
+  if (paused_) {
+    return;
+  }
   // std::cout << "Server started" << std::endl;
   socket_.async_receive_from(
       boost::asio::buffer(recv_buffer_), remote_endpoint_,
@@ -14,12 +48,17 @@ void UdpServer::start() {
                   boost::asio::placeholders::bytes_transferred()));
 }
 
-void UdpServer::handle_flow_init(int& flow_id,
+uint64_t UdpServer::owner(const boost::asio::ip::udp::endpoint& peer) {
+  return (static_cast<uint64_t>(peer.address().to_v4().to_ulong()) << 16) |
+         peer.port();
+}
+
+void UdpServer::handle_flow_init(int64_t& flow_id,
                                  ResponseCallback&& send_response) {
   std::string response;
   if (flow_contexts.find(flow_id) != flow_contexts.end()) {
     // generate a random one if already exists
-    flow_id = rand();
+    flow_id = unused_flow_id();
     // std::cout << "Flow " << flow_id
     //           << " already exists, generate a new one: " << flow_id
     //           << std::endl;
@@ -27,54 +66,75 @@ void UdpServer::handle_flow_init(int& flow_id,
   flow_contexts[flow_id] = new FlowContext(flow_id);
   json reply;
   reply["flow_id"] = flow_id;
+  TFInference::Get()->advertise_cadence(reply);
   response = reply.dump();
   send_response(-1, response);
 }
 
-void UdpServer::handle_congestion_control(int flow_id, json& data,
+void UdpServer::handle_congestion_control(const Message& msg,
                                           ResponseCallback&& send_response) {
-  if (unlikely(flow_contexts.find(flow_id) == flow_contexts.end())) {
-    std::cerr << "Flow " << flow_id << " does not exist" << std::endl;
-    return;
+  int64_t flow_id = msg.flow_id;
+  NNInput state;
+  // the window of a stateless ALIVE comes with it
+  Fc1Cache* fc1_cache = nullptr;
+  if (!stateless_input(msg, state)) {
+    auto context =
+        claim_context(flow_id, owner(remote_endpoint_), send_response);
+    if (unlikely(!context)) {
+      return;
+    }
+    {
+      TraceSpan span("format_state", flow_id);
+      state = context->format_state(msg.state, msg.executed);
+    }
+    fc1_cache = &context->fc1_cache();
   }
-  auto context = flow_contexts[flow_id];
-  auto state = context->format_state(data["state"]);
+  trace_.flow_id = flow_id;
+  trace_.mark(kFormatted);
+  PlanRequest plan{msg.plan_steps, msg.state, msg.phase_hint};
   if (!batchMode) {
-    TFInference::Get()->inference_imdt(flow_id, std::move(state),
-                                       std::move(send_response));
+    TFInference::Get()->inference_imdt(flow_id, state,
+                                       std::move(send_response), trace_, plan,
+                                       fc1_cache);
   } else {
-    TFInference::Get()->submit_inference_request(flow_id, std::move(state),
-                                                 std::move(send_response));
+    TFInference::Get()->submit_inference_request(
+        flow_id, state, std::move(send_response), trace_, plan, fc1_cache);
   }
 }
 
 void UdpServer::handle_receive(const boost::system::error_code& error,
                                std::size_t bytes_transferred) {
   if (!error) {
-    std::string info;
-    std::string response;
-    info.resize(2);
-    // read the first two bytes which indicates the message length
-    std::memcpy(info.data(), recv_buffer_.data(), 2);
-    auto length = get_uint16(info.data());
+    // a datagram arrives whole
+    trace_.reset();
+    trace_.mark(kReceived);
+    trace_.ts[kRead] = trace_.ts[kReceived];
+    // the first two bytes indicate the message length
+    auto length = get_uint16(recv_buffer_.data());
     // check if the message is complete
     if (length != bytes_transferred - 2) {
       std::cout << "Incomplete message received" << std::endl;
       return;
     }
-    info.resize(length);
-    // read the message
-    std::memcpy(info.data(), recv_buffer_.data() + 2, length);
-    json data = json::parse(info);
+    const char* message = recv_buffer_.data() + 2;
+    Message msg;
+    if (unlikely(!decode_message(message, length, msg))) {
+      // not the shape the fast path knows, take the DOM
+      decode_message(json::parse(message, message + length), msg);
+    }
+    trace_.mark(kParsed);
 #ifdef DEBUG
     std::cout << "Received message: " << std::endl;
-    std::cout << data.dump(4) << std::endl;
+    std::cout << std::string(message, length) << std::endl;
 #endif
-    MessageType type = data.at("type");
-    int flow_id = data.at("flow_id");
+    MessageType type = static_cast<MessageType>(msg.type);
+    int64_t flow_id = msg.flow_id;
+    int cwnd = msg.state.cwnd;
     ResponseCallback send_response =
-        std::bind(&UdpServer::send_response, this, remote_endpoint_, data,
-                  std::placeholders::_1, std::placeholders::_2);
+        [this, endpoint = remote_endpoint_, flow_id, cwnd](
+            float action, const std::string& info) {
+          this->send_response(endpoint, flow_id, cwnd, action, info);
+        };
     switch (type) {
     case MessageType::START: {
       std::cout << "Register flow " << flow_id << std::endl;
@@ -82,11 +142,21 @@ void UdpServer::handle_receive(const boost::system::error_code& error,
       break;
     }
     case MessageType::ALIVE: {
-      handle_congestion_control(flow_id, data, std::move(send_response));
+      if (unlikely(!msg.has_state)) {
+        std::cerr << "Flow " << flow_id << " sent ALIVE without state"
+                  << std::endl;
+        break;
+      }
+      aggregate_state(msg);
+      handle_congestion_control(msg, std::move(send_response));
+      break;
+    }
+    case MessageType::OBSERVE: {
+      handle_observe(msg, std::move(send_response));
       break;
     }
     case MessageType::END: {
-      handle_flow_removal(flow_id);
+      handle_flow_removal(flow_id, owner(remote_endpoint_));
       break;
     }
     default:
@@ -97,31 +167,34 @@ void UdpServer::handle_receive(const boost::system::error_code& error,
 }
 
 void UdpServer::send_response(boost::asio::ip::udp::endpoint remote_endpoint,
-                              const json data, float action,
+                              int64_t flow_id, int cwnd, float action,
                               const std::string& info) {
   std::string response;
+  // action replies are framed on the stack, only START replies use info
+  std::array<char, kMaxActionReplySize> reply;
+  size_t reply_len;
   if (info != "") {
     response = put_field(info.length()) + info;
   } else {
-    int cwnd = data["state"]["cwnd"];
     auto new_cwnd = map_action(action, cwnd);
-    json reply;
-    reply["cwnd"] = new_cwnd;
-    reply["flow_id"] = data["flow_id"];
-    response = put_field(reply.dump().length()) + reply.dump();
+    reply_len = encode_action_reply(reply.data(), flow_id, new_cwnd, -1,
+                                    TFInference::Get()->backoff());
   }
+  auto buffer = info != "" ? boost::asio::buffer(response)
+                           : boost::asio::buffer(reply.data(), reply_len);
 #ifdef DEBUG
-  std::cout << "Original cwnd: " << cwnd << ", action: " << action
-            << ", new cwnd: " << new_cwnd << std::endl;
-  std::cout << "Flow " << data["flow_id"] << "Action: " << reply.dump(4)
-            << std::endl;
+  std::cout << "Flow " << flow_id << " original cwnd: " << cwnd
+            << ", action: " << action << std::endl;
   std::cout << "Sending response: " << std::endl;
-  std::cout << response << std::endl;
+  std::cout << std::string(static_cast<const char*>(buffer.data()),
+                           buffer.size())
+            << std::endl;
 #endif
-  auto len = socket_.send_to(boost::asio::buffer(response), remote_endpoint);
-  if (unlikely(len != response.length())) {
+  auto len = socket_.send_to(buffer, remote_endpoint);
+  if (unlikely(len != boost::asio::buffer_size(buffer))) {
     std::cerr << "UDP Send Error: " << len << " bytes sent, "
-              << response.length() << " bytes expected" << std::endl;
+              << boost::asio::buffer_size(buffer) << " bytes expected"
+              << std::endl;
   }
 }
 
@@ -16,21 +16,29 @@
 class UdpServer : public Server {
  public:
   UdpServer(boost::asio::io_service& io_service);
+  /* adopt the socket and flows of the infer being replaced */
+  UdpServer(boost::asio::io_service& io_service, const HandoffState& state);
 
   virtual void start() override;
 
+  virtual void pause(std::function<void()> on_paused) override;
+  virtual void resume() override;
+  virtual void export_state(HandoffState& state) override;
+
  protected:
-  virtual void handle_flow_init(int& flow_id,
+  virtual void handle_flow_init(int64_t& flow_id,
                                 ResponseCallback&& send_response) override;
   virtual void handle_congestion_control(
-      int flow_id, json& data, ResponseCallback&& send_response) override;
+      const Message& msg, ResponseCallback&& send_response) override;
 
  private:
   void handle_receive(const boost::system::error_code& error,
                       std::size_t bytes_transferred);
+  /* the peer owns the flows whose ALIVEs it sends */
+  static uint64_t owner(const boost::asio::ip::udp::endpoint& peer);
 
   void send_response(boost::asio::ip::udp::endpoint remote_endpoint,
-                     const json data, float action,
+                     int64_t flow_id, int cwnd, float action,
                      const std::string& info = "");
 
   void handle_send(const boost::system::error_code& error,
@@ -39,7 +47,9 @@ class UdpServer : public Server {
  private:
   boost::asio::ip::udp::socket socket_;
   boost::asio::ip::udp::endpoint remote_endpoint_;
-  std::array<char, 1024> recv_buffer_;
+  std::array<char, kMaxMessageSize> recv_buffer_;
+  boost::asio::io_service& io_service_;
+  bool paused_;
 };
 
 #endif  // UDP_SERVER_HH
\ No newline at end of file
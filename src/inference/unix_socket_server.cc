@@ -1,14 +1,41 @@
 #include "unix_socket_server.hh"
+
+#include <algorithm>
+#include <cstring>
+
 #include "serialization.hh"
+#include "tracer.hh"
 
 UnixSocketServer::UnixSocketServer(boost::asio::io_service& io_service,
                                    const std::string& socket_path)
     : io_service_(io_service),
       acceptor_(io_service,
-                boost::asio::local::stream_protocol::endpoint(socket_path)) {
+                boost::asio::local::stream_protocol::endpoint(socket_path)),
+      sessions_(),
+      paused_(false),
+      parked_() {
   start();
 }
 
+UnixSocketServer::UnixSocketServer(boost::asio::io_service& io_service,
+                                   const HandoffState& state)
+    : io_service_(io_service),
+      acceptor_(io_service, boost::asio::local::stream_protocol(),
+                state.listener_fd),
+      sessions_(),
+      paused_(false),
+      parked_() {
+  adopt_contexts(state);
+  for (auto& handoff : state.sessions) {
+    auto session = std::make_shared<Session>(io_service_);
+    session->set_udp_server(this);
+    session->socket().assign(boost::asio::local::stream_protocol(),
+                             handoff.fd);
+    sessions_.push_back(session);
+    session->start(handoff.pending);
+  }
+}
+
 void UnixSocketServer::start() {
   std::shared_ptr<Session> new_session = std::make_shared<Session>(io_service_);
   new_session->set_udp_server(this);
@@ -21,58 +48,193 @@ void UnixSocketServer::start() {
 void UnixSocketServer::handle_accept(std::shared_ptr<Session> new_session,
                                      const boost::system::error_code& error) {
   if (!error) {
+    // forget sessions whose client has gone
+    sessions_.erase(std::remove_if(sessions_.begin(), sessions_.end(),
+                                   [](const std::weak_ptr<Session>& s) {
+                                     return s.expired();
+                                   }),
+                    sessions_.end());
+    sessions_.push_back(new_session);
     new_session->start();
-    start();
-  } else {
+    if (!paused_) {
+      start();
+    }
+  } else if (!paused_) {
     std::cerr << "Accept error: " << error.message() << std::endl;
   }
 }
 
-Session::Session(boost::asio::io_service& io_service) : socket_(io_service) {}
+void UnixSocketServer::pause(std::function<void()> on_paused) {
+  paused_ = true;
+  acceptor_.cancel();
+  for (auto& weak : sessions_) {
+    if (auto session = weak.lock()) {
+      // a session closed by END has nothing to cancel
+      boost::system::error_code ignored;
+      session->socket().cancel(ignored);
+    }
+  }
+  // the aborted reads complete before this, each parking its session
+  io_service_.post(on_paused);
+}
+
+void UnixSocketServer::resume() {
+  paused_ = false;
+  for (auto& session : parked_) {
+    session->start(session->pending());
+  }
+  parked_.clear();
+  start();
+}
+
+void UnixSocketServer::export_state(HandoffState& state) {
+  state.channel = "unix";
+  state.listener_fd = acceptor_.native_handle();
+  for (auto& session : parked_) {
+    state.sessions.push_back(
+        {session->socket().native_handle(), session->pending()});
+  }
+  export_contexts(state);
+}
+
+Session::Session(boost::asio::io_service& io_service)
+    : socket_(io_service), partial_(0), pending_() {}
 
 boost::asio::local::stream_protocol::socket& Session::socket() {
   return socket_;
 }
 
 void Session::start() {
+  if (server_->paused_) {
+    pending_.clear();
+    server_->parked_.push_back(shared_from_this());
+    return;
+  }
+  partial_ = 0;
   boost::asio::async_read(
       socket_,
       boost::asio::buffer(message_length_buffer_.data(),
                           sizeof(message_length_)),
       boost::bind(&Session::handle_read_length, shared_from_this(),
-                  boost::asio::placeholders::error));
+                  boost::asio::placeholders::error,
+                  boost::asio::placeholders::bytes_transferred));
 }
 
-void Session::handle_read_length(const boost::system::error_code& error) {
+void Session::start(const std::string& pending) {
+  if (pending.size() < sizeof(message_length_)) {
+    // still in the length header
+    std::memcpy(message_length_buffer_.data(), pending.data(), pending.size());
+    partial_ = pending.size();
+    boost::asio::async_read(
+        socket_,
+        boost::asio::buffer(message_length_buffer_.data() + partial_,
+                            sizeof(message_length_) - partial_),
+        boost::bind(&Session::handle_read_length, shared_from_this(),
+                    boost::asio::placeholders::error,
+                    boost::asio::placeholders::bytes_transferred));
+    return;
+  }
+  std::memcpy(message_length_buffer_.data(), pending.data(),
+              sizeof(message_length_));
   message_length_ = get_uint16(message_length_buffer_.data());
+  partial_ = pending.size() - sizeof(message_length_);
+  if (message_length_ > recv_buffer_.size() or partial_ > message_length_) {
+    std::cerr << "Dropping a session with a corrupt pending frame"
+              << std::endl;
+    return;
+  }
+  std::memcpy(recv_buffer_.data(), pending.data() + sizeof(message_length_),
+              partial_);
+  trace_.reset();
+  trace_.mark(kReceived);
+  boost::asio::async_read(
+      socket_,
+      boost::asio::buffer(recv_buffer_.data() + partial_,
+                          message_length_ - partial_),
+      boost::bind(&Session::handle_read_message, shared_from_this(),
+                  boost::asio::placeholders::error,
+                  boost::asio::placeholders::bytes_transferred,
+                  message_length_));
+}
+
+bool Session::park(const boost::system::error_code& error, std::size_t read) {
+  if (!server_->paused_ or
+      (error and error != boost::asio::error::operation_aborted)) {
+    return false;
+  }
+  // keep what has been read of the frame, the next owner continues from it
+  pending_.assign(message_length_buffer_.data(),
+                  std::min(read, sizeof(message_length_)));
+  if (read > sizeof(message_length_)) {
+    pending_.append(recv_buffer_.data(), read - sizeof(message_length_));
+  }
+  server_->parked_.push_back(shared_from_this());
+  return true;
+}
+
+void Session::handle_read_length(const boost::system::error_code& error,
+                                 std::size_t bytes_transferred) {
+  // a complete header parks too: the body may take a while to arrive
+  if (park(error, partial_ + bytes_transferred)) {
+    return;
+  }
+  trace_.reset();
+  trace_.mark(kReceived);
+  message_length_ = get_uint16(message_length_buffer_.data());
+  partial_ = 0;
   if (!error) {
     boost::asio::async_read(
         socket_, boost::asio::buffer(recv_buffer_.data(), message_length_),
         boost::bind(&Session::handle_read_message, shared_from_this(),
-                    boost::asio::placeholders::error, message_length_));
+                    boost::asio::placeholders::error,
+                    boost::asio::placeholders::bytes_transferred,
+                    message_length_));
   } else {
     std::cerr << "Error reading message length: " << error.message()
               << std::endl;
+    // the flow may come back on a new connection
+    server_->release_contexts(owner());
   }
 }
 
 void Session::handle_read_message(const boost::system::error_code& error,
+                                  std::size_t bytes_transferred,
                                   std::size_t expected_length) {
+  // a complete message is still handled, start() parks afterwards
+  if (error and
+      park(error, sizeof(message_length_) + partial_ + bytes_transferred)) {
+    return;
+  }
   bool stop = false;
   if (!error) {
-    std::string message(recv_buffer_.data(), expected_length);
-    // std::cout << "Received message: " << message << std::endl;
-    std::string response;
-    json data = json::parse(message);
+    trace_.mark(kRead);
+    Message msg;
+    if (unlikely(!decode_message(recv_buffer_.data(), expected_length, msg))) {
+      // not the shape the fast path knows, take the DOM
+      try {
+        decode_message(json::parse(recv_buffer_.data(),
+                                   recv_buffer_.data() + expected_length),
+                       msg);
+      } catch (const std::exception& e) {
+        std::cerr << "Malformed message, closing the connection: "
+                  << e.what() << std::endl;
+        socket_.close();
+        server_->release_contexts(owner());
+        return;
+      }
+    }
+    trace_.mark(kParsed);
 #ifdef DEBUG
     std::cout << "Received message: " << std::endl;
-    std::cout << data.dump(4) << std::endl;
+    std::cout << std::string(recv_buffer_.data(), expected_length) << std::endl;
 #endif
-    MessageType type = data.at("type");
-    int flow_id = data.at("flow_id");
-    ResponseCallback send_response =
-        std::bind(&Session::send_response, this, data, std::placeholders::_1,
-                  std::placeholders::_2);
+    MessageType type = static_cast<MessageType>(msg.type);
+    int64_t flow_id = msg.flow_id;
+    int cwnd = msg.state.cwnd;
+    ResponseCallback send_response = [this, flow_id, cwnd](
+                                         float action, const std::string& info) {
+      this->send_response(flow_id, cwnd, action, info);
+    };
     switch (type) {
     case MessageType::START: {
       std::cout << "Register flow " << flow_id << std::endl;
@@ -80,12 +242,24 @@ void Session::handle_read_message(const boost::system::error_code& error,
       break;
     }
     case MessageType::ALIVE: {
-      handle_congestion_control(flow_id, data, std::move(send_response));
+      if (unlikely(!msg.has_state)) {
+        std::cerr << "Flow " << flow_id << " sent ALIVE without state"
+                  << std::endl;
+        break;
+      }
+      aggregate_state(msg);
+      handle_congestion_control(msg, std::move(send_response));
+      break;
+    }
+    case MessageType::OBSERVE: {
+      // flows that went away without END leave the aggregates
+      server_->expire_contexts();
+      handle_observe(msg, std::move(send_response));
       break;
     }
     case MessageType::END: {
       std::cout << "Remove flow " << flow_id << std::endl;
-      handle_flow_removal(flow_id);
+      handle_flow_removal(flow_id, owner());
       stop = true;
       break;
     }
@@ -100,67 +274,86 @@ void Session::handle_read_message(const boost::system::error_code& error,
     }
   } else {
     std::cerr << "Error reading message: " << error.message() << std::endl;
+    server_->release_contexts(owner());
   }
 }
 
-void Session::handle_flow_init(int& flow_id, ResponseCallback&& send_response) {
+void Session::handle_flow_init(int64_t& flow_id,
+                               ResponseCallback&& send_response) {
   auto& flow_contexts = server_->flow_contexts;
   if (flow_contexts.find(flow_id) != flow_contexts.end()) {
     std::cerr << "Flow " << flow_id << " already exists" << std::endl;
-    flow_id = rand();
+    flow_id = server_->unused_flow_id();
   }
   flow_contexts[flow_id] = new FlowContext(flow_id);
   json reply;
   reply["flow_id"] = flow_id;
+  TFInference::Get()->advertise_cadence(reply);
   std::string response = reply.dump();
   send_response(-1, response);
 }
 
-void Session::handle_congestion_control(int flow_id, json& data,
+void Session::handle_congestion_control(const Message& msg,
                                         ResponseCallback&& send_response) {
-  auto& flow_contexts = server_->flow_contexts;
-  if (unlikely(flow_contexts.find(flow_id) == flow_contexts.end())) {
-    std::cerr << "Flow " << flow_id << " does not exist" << std::endl;
-    return;
+  int64_t flow_id = msg.flow_id;
+  NNInput state;
+  // the window of a stateless ALIVE comes with it
+  Fc1Cache* fc1_cache = nullptr;
+  if (!stateless_input(msg, state)) {
+    auto context = server_->claim_context(flow_id, owner(), send_response);
+    if (unlikely(!context)) {
+      return;
+    }
+    {
+      TraceSpan span("format_state", flow_id);
+      state = context->format_state(msg.state, msg.executed);
+    }
+    fc1_cache = &context->fc1_cache();
   }
-  auto context = flow_contexts[flow_id];
-  auto state = context->format_state(data["state"]);
+  trace_.flow_id = flow_id;
+  trace_.mark(kFormatted);
+  PlanRequest plan{msg.plan_steps, msg.state, msg.phase_hint};
   if (!batchMode) {
-    TFInference::Get()->inference_imdt(flow_id, std::move(state),
-                                       std::move(send_response));
+    TFInference::Get()->inference_imdt(flow_id, state,
+                                       std::move(send_response), trace_, plan,
+                                       fc1_cache);
   } else {
-    TFInference::Get()->submit_inference_request(flow_id, std::move(state),
-                                                 std::move(send_response));
+    TFInference::Get()->submit_inference_request(
+        flow_id, state, std::move(send_response), trace_, plan, fc1_cache);
   }
 }
 
-void Session::handle_flow_removal(int flow_id) {
-  server_->handle_flow_removal(flow_id);
+void Session::handle_flow_removal(int64_t flow_id, uint64_t owner) {
+  server_->handle_flow_removal(flow_id, owner);
 }
 
-void Session::send_response(const json data, float action,
+void Session::send_response(int64_t flow_id, int cwnd, float action,
                             const std::string& info) {
   std::string response;
+  // action replies are framed on the stack, only START replies use info
+  std::array<char, kMaxActionReplySize> reply;
+  size_t reply_len;
   if (info != "") {
     response = put_field(info.length()) + info;
   } else {
-    int cwnd = data["state"]["cwnd"];
     auto new_cwnd = map_action(action, cwnd);
-    json reply;
-    reply["cwnd"] = new_cwnd;
-    reply["flow_id"] = data["flow_id"];
-    response = put_field(reply.dump().length()) + reply.dump();
+    reply_len = encode_action_reply(reply.data(), flow_id, new_cwnd, -1,
+                                    TFInference::Get()->backoff());
   }
+  auto buffer = info != "" ? boost::asio::buffer(response)
+                           : boost::asio::buffer(reply.data(), reply_len);
 #ifdef DEBUG
   std::cout << "Original cwnd: " << cwnd << ", action: " << action
-            << ", new cwnd: " << new_cwnd << std::endl;
-  std::cout << "Action: " << reply.dump(4) << std::endl;
+            << std::endl;
   std::cout << "Sending response: " << std::endl;
-  std::cout << response << std::endl;
+  std::cout << std::string(static_cast<const char*>(buffer.data()),
+                           buffer.size())
+            << std::endl;
 #endif
-  auto len = socket_.send(boost::asio::buffer(response));
-  if (unlikely(len != response.length())) {
+  auto len = socket_.send(buffer);
+  if (unlikely(len != boost::asio::buffer_size(buffer))) {
     std::cerr << "UNIX Socket Send Error: " << len << " bytes sent, "
-              << response.length() << " bytes expected" << std::endl;
+              << boost::asio::buffer_size(buffer) << " bytes expected"
+              << std::endl;
   }
 }
@@ -3,6 +3,7 @@
 
 #include <string>
 #include <unordered_map>
+#include <vector>
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
 
@@ -17,27 +18,43 @@ class Session : public std::enable_shared_from_this<Session>, Server {
 
   virtual void start() override;
 
+  /* start reading with the first bytes of a frame already in */
+  void start(const std::string& pending);
+
   void set_udp_server(UnixSocketServer* server) { server_ = server; }
 
+  // bytes of the frame that was being read when the server paused
+  const std::string& pending() const { return pending_; }
+
  protected:
-  virtual void handle_flow_init(int& flow_id,
+  virtual void handle_flow_init(int64_t& flow_id,
                                 ResponseCallback&& send_response) override;
   virtual void handle_congestion_control(
-      int flow_id, json& data, ResponseCallback&& send_response) override;
+      const Message& msg, ResponseCallback&& send_response) override;
 
-  virtual void handle_flow_removal(int flow_id) override;
+  virtual void handle_flow_removal(int64_t flow_id, uint64_t owner) override;
 
  private:
-  void handle_read_length(const boost::system::error_code& error);
+  void handle_read_length(const boost::system::error_code& error,
+                          std::size_t bytes_transferred);
   void handle_read_message(const boost::system::error_code& error,
+                           std::size_t bytes_transferred,
                            std::size_t expected_length);
-  void send_response(const json data, float action, const std::string& info);
+  /* stop reading and hand the session to the server while it is paused */
+  bool park(const boost::system::error_code& error, std::size_t read);
+  /* owns the flow whose ALIVEs come over this connection */
+  uint64_t owner() const { return reinterpret_cast<uintptr_t>(this); }
+  void send_response(int64_t flow_id, int cwnd, float action,
+                     const std::string& info);
 
  private:
   boost::asio::local::stream_protocol::socket socket_;
-  std::array<char, 1024> recv_buffer_;
+  std::array<char, kMaxMessageSize> recv_buffer_;
   std::array<char, 2> message_length_buffer_;
   uint16_t message_length_;
+  // bytes of the current frame read before the outstanding async_read
+  std::size_t partial_;
+  std::string pending_;
   // per flow inference context
   UnixSocketServer* server_;
 };
@@ -47,14 +64,21 @@ class UnixSocketServer : public Server {
   friend class Session;
   UnixSocketServer(boost::asio::io_service& io_service,
                    const std::string& socket_path);
+  /* adopt the listener, sessions and flows of the infer being replaced */
+  UnixSocketServer(boost::asio::io_service& io_service,
+                   const HandoffState& state);
 
   virtual void start() override;
 
+  virtual void pause(std::function<void()> on_paused) override;
+  virtual void resume() override;
+  virtual void export_state(HandoffState& state) override;
+
  protected:
-  virtual void handle_flow_init(int& flow_id,
+  virtual void handle_flow_init(int64_t& flow_id,
                                 ResponseCallback&& send_response) override {}
   virtual void handle_congestion_control(
-      int flow_id, json& data, ResponseCallback&& send_response) override {}
+      const Message& msg, ResponseCallback&& send_response) override {}
 
  private:
   void handle_accept(std::shared_ptr<Session> new_session,
@@ -63,6 +87,12 @@ class UnixSocketServer : public Server {
  private:
   boost::asio::io_service& io_service_;
   boost::asio::local::stream_protocol::acceptor acceptor_;
+  // every session that may still be reading, to cancel them on pause
+  std::vector<std::weak_ptr<Session>> sessions_;
+  bool paused_;
+  // sessions that stopped reading since the pause, kept alive until exit
+  // because in-flight replies still go through them
+  std::vector<std::shared_ptr<Session>> parked_;
 };
 
 #endif  // UNIX_SOCKET_SERVER_HH
\ No newline at end of file
@@ -0,0 +1,97 @@
+#include "feature.hh"
+
+#include <cmath>
+
+#include "tcp_info.hh"
+
+DeepCCState make_deepcc_state(const TCPDeepCCInfo& info, uint64_t max_tput,
+                              double loss_ratio) {
+  DeepCCState state;
+  state.avg_thr = info.avg_thr;
+  state.avg_urtt = info.avg_urtt;
+  state.srtt_us = info.srtt_us;
+  state.min_rtt = info.min_rtt;
+  state.max_tput = max_tput;
+  state.cwnd = info.cwnd;
+  state.packets_out = info.packets_out;
+  state.pacing_rate = info.pacing_rate;
+  state.retrans_out = info.retrans_out;
+  state.loss_ratio = loss_ratio;
+  return state;
+}
+
+DeepCCState make_deepcc_state(const json& state_dict) {
+  DeepCCState state;
+  state.avg_thr = state_dict.at("avg_thr");
+  state.avg_urtt = state_dict.at("avg_urtt");
+  state.srtt_us = state_dict.at("srtt_us");
+  state.min_rtt = state_dict.at("min_rtt");
+  state.max_tput = state_dict.at("max_tput");
+  state.cwnd = state_dict.at("cwnd");
+  state.packets_out = state_dict.at("packets_out");
+  state.pacing_rate = state_dict.at("pacing_rate");
+  state.retrans_out = state_dict.at("retrans_out");
+  state.loss_ratio = state_dict.at("loss_ratio");
+  return state;
+}
+
+void transform_state(const DeepCCState& s, float* out) {
+  if (s.avg_thr == 0) {
+    out[0] = 0.5;
+  } else {
+    out[0] = s.max_tput > 0 ? (float)s.avg_thr / s.avg_thr : 0;
+  }
+  if (s.avg_urtt == 0) {
+    out[1] = 2;
+  } else if (s.min_rtt == 0) {
+    out[1] = 0;
+  } else {
+    out[1] = (float)s.avg_urtt / s.min_rtt;
+  }
+
+  if (s.srtt_us == 0) {
+    out[2] = 2;
+  } else if (s.min_rtt == 0) {
+    out[2] = 0;
+  } else {
+    out[2] = (float)s.srtt_us / 8 / s.min_rtt;
+  }
+
+  if (s.min_rtt == 0 or s.max_tput == 0) {
+    out[3] = 0;
+  } else {
+    out[3] = (float)s.cwnd * 1460 * 8 / (s.min_rtt / 1e6) / s.max_tput / 10;
+  }
+  out[4] = (float)s.max_tput / 1e7;
+  out[5] = (float)s.min_rtt / 5e5;
+  out[6] = s.max_tput > 0 ? (float)s.loss_ratio / s.max_tput : 0;
+  out[7] = (float)s.packets_out / s.cwnd;
+  out[8] = s.max_tput > 0 ? (float)s.pacing_rate / s.max_tput : 0;
+  out[9] = s.packets_out > 0 ? (float)s.retrans_out / s.packets_out : 0;
+
+  if (out[2] > 2) {
+    out[2] = 2;
+  }
+  if (out[1] > 2) {
+    out[1] = 2;
+  }
+  if (out[3] > 2) {
+    out[3] = 2;
+  }
+  if (out[8] > 2) {
+    out[8] = 2;
+  }
+}
+
+int map_action(float action, float cwnd) {
+  int out;
+  float tmp;
+  if (action >= 0) {
+    tmp = 1 + 0.025 * action;
+    out = std::ceil(tmp * cwnd);
+  } else {
+    tmp = 1 / (1 - 0.025 * action);
+    out = std::floor(tmp * cwnd);
+  }
+  return out;
+}
@@ -0,0 +1,53 @@
+#ifndef FEATURE_HH
+#define FEATURE_HH
+
+#include <cstddef>
+#include <cstdint>
+
+#include "json.hpp"
+using json = nlohmann::json;
+
+/* kept opaque: tcp_info.hh pulls in <linux/tcp.h>, which clashes with the
+ * <netinet/tcp.h> that boost::asio includes in infer */
+struct TCPDeepCCInfo;
+
+/* one DeepCC state has kStateSize features, the actor sees the last
+ * kRecurrentNum of them */
+const size_t kStateSize = 10;
+const size_t kRecurrentNum = 5;
+const size_t kNNInputSize = 50;
+
+/**
+ * @brief The fields of a DeepCC report that the actor's features are built
+ * from, i.e. TCPDeepCCInfo plus what DeepCCSocket adds on top of it.
+ *
+ * Widths follow what infer has always read out of the JSON message, so the
+ * features stay bit-identical whichever way the state arrives.
+ */
+struct DeepCCState {
+  uint32_t avg_thr;
+  uint32_t avg_urtt;
+  uint32_t srtt_us;
+  uint32_t min_rtt;
+  uint32_t max_tput;
+  uint32_t cwnd;
+  uint32_t packets_out;
+  uint32_t pacing_rate;
+  uint32_t retrans_out;
+  double loss_ratio;
+};
+
+/* build the state from a kernel report and the socket-side statistics */
+DeepCCState make_deepcc_state(const TCPDeepCCInfo& info, uint64_t max_tput,
+                              double loss_ratio);
+
+/* build the state from the "state" object of a client message */
+DeepCCState make_deepcc_state(const json& state_dict);
+
+/* normalise one state into kStateSize features written to `out` */
+void transform_state(const DeepCCState& state, float* out);
+
+/* translate the actor's output into a new cwnd */
+int map_action(float action, float cwnd);
+
+#endif  // FEATURE_HH
@@ -0,0 +1,187 @@
+#include "inference_client.hh"
+
+#include <sys/socket.h>
+
+#include "exception.hh"
+#include "serialization.hh"
+
+using namespace std;
+using json = nlohmann::json;
+
+InferenceClient::InferenceClient(const Address& server,
+                                 const size_t pool_size)
+    : next_request_id_(0), pool_() {
+  if (pool_size == 0) {
+    throw runtime_error("InferenceClient: empty connection pool");
+  }
+  for (size_t i = 0; i < pool_size; ++i) {
+    pool_.emplace_back(new Connection());
+    Connection& conn = *pool_.back();
+    conn.socket.connect(server);
+    conn.socket.set_nodelay();
+    conn.reader = thread(&InferenceClient::read_replies, this, ref(conn));
+  }
+}
+
+InferenceClient::~InferenceClient() {
+  for (auto& conn : pool_) {
+    /* wake the reader up, it fails whatever is still outstanding */
+    ::shutdown(conn->socket.fd_num(), SHUT_RDWR);
+    conn->reader.join();
+  }
+}
+
+InferenceClient::Connection& InferenceClient::connection_of(
+    const json& message) {
+  // flow ids take all 64 bits, json::value() would narrow them to int
+  uint64_t flow_id = message.value("flow_id", uint64_t(0));
+  return *pool_[flow_id % pool_.size()];
+}
+
+future<json> InferenceClient::async_call(json message) {
+  int64_t request_id = next_request_id_++;
+  message["req_id"] = request_id;
+  Connection& conn = connection_of(message);
+
+  future<json> reply;
+  {
+    lock_guard<mutex> lock(conn.outstanding_mutex);
+    if (conn.broken) {
+      throw runtime_error("InferenceClient: connection is broken");
+    }
+    reply = conn.outstanding[request_id].get_future();
+  }
+  const string body = message.dump();
+  send_frame(conn, put_field(body.length()) + body);
+  return reply;
+}
+
+vector<future<json>> InferenceClient::async_call_all(vector<json> messages) {
+  vector<future<json>> replies;
+  replies.reserve(messages.size());
+  vector<string> frames(pool_.size());
+  for (auto& message : messages) {
+    int64_t request_id = next_request_id_++;
+    message["req_id"] = request_id;
+    size_t index = message.value("flow_id", uint64_t(0)) % pool_.size();
+    Connection& conn = *pool_[index];
+    {
+      lock_guard<mutex> lock(conn.outstanding_mutex);
+      if (conn.broken) {
+        promise<json> failed;
+        failed.set_exception(make_exception_ptr(
+            runtime_error("InferenceClient: connection is broken")));
+        replies.push_back(failed.get_future());
+        continue;
+      }
+      replies.push_back(conn.outstanding[request_id].get_future());
+    }
+    const string body = message.dump();
+    frames[index] += put_field(body.length()) + body;
+  }
+  for (size_t i = 0; i < pool_.size(); ++i) {
+    if (frames[i].empty()) {
+      continue;
+    }
+    try {
+      send_frame(*pool_[i], frames[i]);
+    } catch (const exception& e) {
+      /* the futures of the connection carry the error */
+    }
+  }
+  return replies;
+}
+
+json InferenceClient::call(json message) {
+  return async_call(move(message)).get();
+}
+
+void InferenceClient::notify(json message) {
+  Connection& conn = connection_of(message);
+  const string body = message.dump();
+  send_frame(conn, put_field(body.length()) + body);
+}
+
+void InferenceClient::send_frame(Connection& conn, const string& frame) {
+  {
+    lock_guard<mutex> lock(conn.queue_mutex);
+    conn.queued += frame;
+    /* the thread that is writing picks this frame up too */
+    if (conn.writing) {
+      return;
+    }
+    conn.writing = true;
+  }
+
+  string batch;
+  while (true) {
+    {
+      lock_guard<mutex> lock(conn.queue_mutex);
+      if (conn.queued.empty()) {
+        conn.writing = false;
+        return;
+      }
+      batch.swap(conn.queued);
+    }
+    try {
+      conn.socket.write(batch);
+    } catch (const exception& e) {
+      {
+        lock_guard<mutex> lock(conn.queue_mutex);
+        conn.queued.clear();
+        conn.writing = false;
+      }
+      fail_outstanding(conn, e.what());
+      throw;
+    }
+    batch.clear();
+  }
+}
+
+void InferenceClient::read_replies(Connection& conn) {
+  string buffer;
+  try {
+    while (true) {
+      string data = conn.socket.read();
+      if (conn.socket.eof()) {
+        break;
+      }
+      buffer += data;
+
+      /* one read usually carries the replies of a whole batch */
+      size_t pos = 0;
+      while (buffer.size() - pos >= 2) {
+        uint16_t len = get_uint16(buffer.data() + pos);
+        if (buffer.size() - pos - 2 < len) {
+          break;
+        }
+        json reply = json::parse(buffer.begin() + pos + 2,
+                                 buffer.begin() + pos + 2 + len);
+        pos += 2 + len;
+
+        int64_t request_id = reply.value("req_id", int64_t(-1));
+        lock_guard<mutex> lock(conn.outstanding_mutex);
+        auto it = conn.outstanding.find(request_id);
+        if (it == conn.outstanding.end()) {
+          continue;
+        }
+        it->second.set_value(move(reply));
+        conn.outstanding.erase(it);
+      }
+      buffer.erase(0, pos);
+    }
+    fail_outstanding(conn, "inference server closed the connection");
+  } catch (const exception& e) {
+    fail_outstanding(conn, e.what());
+  }
+}
+
+void InferenceClient::fail_outstanding(Connection& conn, const string& reason) {
+  lock_guard<mutex> lock(conn.outstanding_mutex);
+  conn.broken = true;
+  for (auto& entry : conn.outstanding) {
+    entry.second.set_exception(
+        make_exception_ptr(runtime_error("InferenceClient: " + reason)));
+  }
+  conn.outstanding.clear();
+}
@@ -0,0 +1,74 @@
+#ifndef INFERENCE_CLIENT_HH
+#define INFERENCE_CLIENT_HH
+
+#include <atomic>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "address.hh"
+#include "json.hpp"
+#include "socket.hh"
+
+/**
+ * @brief Client side of infer's TCP channel.
+ *
+ * Keeps a pool of persistent connections; a flow always goes through the same
+ * one so that its messages stay in order. Calls from any number of threads
+ * are pipelined: each message is tagged with a "req_id", a reader thread per
+ * connection hands every reply to whoever waits for that id, and messages
+ * queued while a write is under way leave together in the next write.
+ */
+class InferenceClient {
+ public:
+  InferenceClient(const Address& server, const size_t pool_size = 1);
+  ~InferenceClient();
+
+  InferenceClient(const InferenceClient&) = delete;
+  InferenceClient& operator=(const InferenceClient&) = delete;
+
+  /* send message (with "type" and "flow_id") without waiting for the reply;
+   * the future throws if the connection breaks first */
+  std::future<nlohmann::json> async_call(nlohmann::json message);
+
+  /* send messages in one write per connection, e.g. the ALIVEs of every
+   * flow of a process; a future throws if its connection is broken */
+  std::vector<std::future<nlohmann::json>> async_call_all(
+      std::vector<nlohmann::json> messages);
+
+  /* send message and wait for its reply */
+  nlohmann::json call(nlohmann::json message);
+
+  /* send a message that gets no reply, e.g. END */
+  void notify(nlohmann::json message);
+
+ private:
+  struct Connection {
+    TCPSocket socket{};
+    std::thread reader{};
+
+    // frames waiting for the writer, and whether a thread is writing
+    std::mutex queue_mutex{};
+    std::string queued{};
+    bool writing = false;
+
+    std::mutex outstanding_mutex{};
+    std::unordered_map<int64_t, std::promise<nlohmann::json>> outstanding{};
+    bool broken = false;
+  };
+
+  Connection& connection_of(const nlohmann::json& message);
+  void send_frame(Connection& conn, const std::string& frame);
+  void read_replies(Connection& conn);
+  void fail_outstanding(Connection& conn, const std::string& reason);
+
+ private:
+  std::atomic<int64_t> next_request_id_;
+  std::vector<std::unique_ptr<Connection>> pool_;
+};
+
+#endif /* INFERENCE_CLIENT_HH */
@@ -0,0 +1,334 @@
+#include "inference_pool.hh"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "logging.hh"
+
+using namespace std;
+using json = nlohmann::json;
+
+namespace {
+
+// message types of infer's protocol that the pool sends itself
+const int kEndType = 2;
+const int kObserveType = 4;
+
+/* FNV-1a with a final mix, the same on every client */
+uint64_t ring_hash(const string& key) {
+  uint64_t h = 14695981039346656037ull;
+  for (unsigned char c : key) {
+    h = (h ^ c) * 1099511628211ull;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  return h;
+}
+
+}  // namespace
+
+constexpr chrono::milliseconds InferencePool::kRetryInterval;
+constexpr chrono::milliseconds InferencePool::kProbeInterval;
+
+InferencePool::InferencePool(const vector<Address>& endpoints,
+                             const string& key,
+                             chrono::microseconds deadline)
+    : endpoints_(),
+      order_(),
+      deadline_(deadline),
+      serving_(0),
+      flow_id_(0),
+      mutex_(),
+      stop_cv_(),
+      stopping_(false),
+      prober_() {
+  if (endpoints.empty()) {
+    throw runtime_error("InferencePool: no inference endpoint");
+  }
+  vector<pair<uint64_t, size_t>> ring;
+  for (size_t i = 0; i < endpoints.size(); ++i) {
+    endpoints_.push_back({endpoints[i], endpoints[i].str()});
+    for (size_t v = 0; v < kVirtualNodes; ++v) {
+      ring.emplace_back(ring_hash(endpoints_[i].name + "#" + to_string(v)), i);
+    }
+  }
+  sort(ring.begin(), ring.end());
+  /* walk the ring clockwise from the key, each endpoint where it first
+   * shows up */
+  auto it = lower_bound(ring.begin(), ring.end(),
+                        make_pair(ring_hash(key), size_t(0)));
+  for (size_t n = 0; n < ring.size() and order_.size() < endpoints_.size();
+       ++n, ++it) {
+    if (it == ring.end()) {
+      it = ring.begin();
+    }
+    if (find(order_.begin(), order_.end(), it->second) == order_.end()) {
+      order_.push_back(it->second);
+    }
+  }
+}
+
+InferencePool::~InferencePool() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  stop_cv_.notify_all();
+  if (prober_.joinable()) {
+    prober_.join();
+  }
+}
+
+void InferencePool::start(int64_t flow_id) {
+  flow_id_ = flow_id;
+  size_t started = 0;
+  bool serving = false;
+  for (size_t index : order_) {
+    if (started == kStarted) {
+      break;
+    }
+    if (!start_endpoint(index)) {
+      continue;
+    }
+    started++;
+    if (!serving) {
+      serving = true;
+      serving_ = index;
+    }
+  }
+  if (!serving) {
+    throw runtime_error("InferencePool: no inference endpoint is reachable");
+  }
+  prober_ = thread(&InferencePool::probe, this);
+}
+
+bool InferencePool::start_endpoint(size_t index) {
+  Endpoint& endpoint = endpoints_[index];
+  try {
+    /* connecting blocks, so it is done without the lock; the endpoint
+     * creates the flow's context on its first ALIVE */
+    auto client = make_shared<InferenceClient>(endpoint.address);
+    {
+      lock_guard<mutex> lock(mutex_);
+      endpoint.client = client;
+      endpoint.misses = 0;
+      endpoint.latency_us = 0;
+    }
+    LOG(INFO) << "Inference endpoint " << endpoint.name << " is up";
+    return true;
+  } catch (const exception& e) {
+    lock_guard<mutex> lock(mutex_);
+    endpoint.retry_at = clock::now() + kRetryInterval;
+    LOG(WARNING) << "Inference endpoint " << endpoint.name
+                 << " is unreachable: " << e.what();
+    return false;
+  }
+}
+
+void InferencePool::mark_down(size_t index, const string& reason) {
+  shared_ptr<InferenceClient> client;
+  int64_t flow_id;
+  {
+    lock_guard<mutex> lock(mutex_);
+    Endpoint& endpoint = endpoints_[index];
+    if (!endpoint.client) {
+      return;
+    }
+    client.swap(endpoint.client);
+    flow_id = flow_id_;
+    endpoint.retry_at = clock::now() + kRetryInterval;
+    LOG(WARNING) << "Inference endpoint " << endpoint.name
+                 << " is down: " << reason;
+  }
+  /* a slow endpoint may still hold the flow's context */
+  try {
+    client->notify({{"type", kEndType}, {"flow_id", flow_id}});
+  } catch (const exception& e) {
+  }
+}
+
+void InferencePool::record_latency(size_t index, clock::duration latency) {
+  double us = chrono::duration<double, micro>(latency).count();
+  lock_guard<mutex> lock(mutex_);
+  Endpoint& endpoint = endpoints_[index];
+  endpoint.misses = 0;
+  endpoint.latency_us = endpoint.latency_us == 0
+                            ? us
+                            : endpoint.latency_us +
+                                  kEwmaGain * (us - endpoint.latency_us);
+}
+
+json InferencePool::call(json message) {
+  struct Candidate {
+    size_t index;
+    shared_ptr<InferenceClient> client;
+  };
+  vector<Candidate> candidates;
+  {
+    lock_guard<mutex> lock(mutex_);
+    message["flow_id"] = flow_id_;
+    for (size_t index : order_) {
+      if (endpoints_[index].client) {
+        candidates.push_back({index, endpoints_[index].client});
+      }
+    }
+    /* an endpoint slower than half the deadline goes after the others */
+    const double slow_us =
+        chrono::duration<double, micro>(deadline_).count() / 2;
+    stable_partition(candidates.begin(), candidates.end(),
+                     [&](const Candidate& c) {
+                       return endpoints_[c.index].latency_us <= slow_us;
+                     });
+  }
+  const auto deadline = clock::now() + deadline_;
+  for (size_t n = 0; n < candidates.size(); ++n) {
+    auto& candidate = candidates[n];
+    auto sent = clock::now();
+    if (sent >= deadline) {
+      break;
+    }
+    /* leave half of what is left for the next endpoint */
+    auto budget = deadline - sent;
+    if (n + 1 < candidates.size()) {
+      budget /= 2;
+    }
+    try {
+      auto future = candidate.client->async_call(message);
+      if (future.wait_for(budget) == future_status::ready) {
+        json reply = future.get();
+        record_latency(candidate.index, clock::now() - sent);
+        lock_guard<mutex> lock(mutex_);
+        if (serving_ != candidate.index) {
+          LOG(INFO) << "Flow moves from inference endpoint "
+                    << endpoints_[serving_].name << " to "
+                    << endpoints_[candidate.index].name;
+          serving_ = candidate.index;
+        }
+        return reply;
+      }
+      bool down;
+      {
+        lock_guard<mutex> lock(mutex_);
+        down = ++endpoints_[candidate.index].misses >= kMaxMisses;
+      }
+      if (down) {
+        mark_down(candidate.index, to_string(kMaxMisses) + " late replies");
+      }
+    } catch (const exception& e) {
+      mark_down(candidate.index, e.what());
+    }
+  }
+  return json();
+}
+
+void InferencePool::notify(json message) {
+  vector<shared_ptr<InferenceClient>> clients;
+  {
+    lock_guard<mutex> lock(mutex_);
+    message["flow_id"] = flow_id_;
+    for (auto& endpoint : endpoints_) {
+      if (endpoint.client) {
+        clients.push_back(endpoint.client);
+      }
+    }
+  }
+  /* written without the lock, as in call(), so a stalled endpoint does not
+   * hold up the others */
+  for (auto& client : clients) {
+    try {
+      client->notify(message);
+    } catch (const exception& e) {
+    }
+  }
+}
+
+void InferencePool::set_flow_id(int64_t flow_id) {
+  notify({{"type", kEndType}});
+  lock_guard<mutex> lock(mutex_);
+  flow_id_ = flow_id;
+}
+
+string InferencePool::serving() const {
+  lock_guard<mutex> lock(mutex_);
+  return endpoints_[serving_].name;
+}
+
+void InferencePool::probe() {
+  while (true) {
+    {
+      unique_lock<mutex> lock(mutex_);
+      if (stop_cv_.wait_for(lock, kProbeInterval,
+                            [this] { return stopping_; })) {
+        return;
+      }
+    }
+    /* keep kStarted endpoints up, the first ones in the flow's order */
+    size_t started = 0;
+    for (size_t index : order_) {
+      shared_ptr<InferenceClient> client;
+      int64_t flow_id;
+      bool retry, serving;
+      {
+        lock_guard<mutex> lock(mutex_);
+        client = endpoints_[index].client;
+        flow_id = flow_id_;
+        retry = clock::now() >= endpoints_[index].retry_at;
+        serving = index == serving_;
+      }
+      if (!client) {
+        if (started < kStarted and retry and start_endpoint(index)) {
+          started++;
+        }
+        continue;
+      }
+      started++;
+      if (serving) {
+        /* its calls keep its latency up to date */
+        continue;
+      }
+      try {
+        auto sent = clock::now();
+        auto future =
+            client->async_call({{"type", kObserveType}, {"flow_id", flow_id}});
+        if (future.wait_for(deadline_) == future_status::ready) {
+          future.get();
+          record_latency(index, clock::now() - sent);
+        } else {
+          bool down;
+          {
+            lock_guard<mutex> lock(mutex_);
+            down = ++endpoints_[index].misses >= kMaxMisses;
+          }
+          if (down) {
+            mark_down(index, to_string(kMaxMisses) + " late pings");
+          }
+        }
+      } catch (const exception& e) {
+        mark_down(index, e.what());
+      }
+    }
+  }
+}
+
+vector<Address> InferencePool::parse_endpoints(const string& list) {
+  vector<Address> endpoints;
+  size_t begin = 0;
+  while (begin <= list.size()) {
+    size_t end = list.find(',', begin);
+    if (end == string::npos) {
+      end = list.size();
+    }
+    string endpoint = list.substr(begin, end - begin);
+    auto colon = endpoint.rfind(':');
+    if (colon == string::npos) {
+      throw runtime_error("Bad inference endpoint '" + endpoint +
+                          "', expected IP:PORT");
+    }
+    endpoints.emplace_back(
+        endpoint.substr(0, colon),
+        static_cast<uint16_t>(stoi(endpoint.substr(colon + 1))));
+    begin = end + 1;
+  }
+  return endpoints;
+}
@@ -0,0 +1,110 @@
+#ifndef INFERENCE_POOL_HH
+#define INFERENCE_POOL_HH
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "address.hh"
+#include "inference_client.hh"
+#include "json.hpp"
+
+/**
+ * @brief A flow's view of several infer processes on the TCP channel.
+ *
+ * The endpoints sit on a consistent hash ring, and the flow's key picks the
+ * order in which it prefers them, so flows spread evenly and only the flows
+ * of an endpoint that comes or goes move. The pool connects to the first
+ * reachable endpoint and to a standby after it. The flow brings its own id,
+ * and an endpoint creates the flow's context on its first ALIVE, so there is
+ * no START handshake.
+ * Every call has a deadline, normally the control interval: if the serving
+ * endpoint has not replied in time or its connection breaks, the rest of the
+ * deadline goes to the next endpoint that is up, and an empty reply tells
+ * the caller to fall back to local behaviour for this interval.
+ *
+ * An endpoint is taken down when its connection breaks or after kMaxMisses
+ * late replies in a row, and one whose latency EWMA is above half the
+ * deadline is tried after the others. A prober thread reconnects down
+ * endpoints once kRetryInterval has passed, and pings the ones that are up with
+ * an OBSERVE so that the latency EWMA of the standby stays current.
+ */
+class InferencePool {
+ public:
+  typedef std::chrono::steady_clock clock;
+
+  /* key places the flow on the ring, e.g. its --id */
+  InferencePool(const std::vector<Address>& endpoints, const std::string& key,
+                std::chrono::microseconds deadline);
+  ~InferencePool();
+
+  InferencePool(const InferencePool&) = delete;
+  InferencePool& operator=(const InferencePool&) = delete;
+
+  /* connect to the serving endpoint and its standby; throws if no endpoint
+   * is reachable */
+  void start(int64_t flow_id);
+
+  /* send message to the first endpoint that is up, as flow_id; null if no
+   * endpoint replied before the deadline */
+  nlohmann::json call(nlohmann::json message);
+
+  /* send a message that gets no reply, e.g. END, to every started endpoint */
+  void notify(nlohmann::json message);
+
+  /* continue as flow_id after a collision, the old id is ended */
+  void set_flow_id(int64_t flow_id);
+
+  /* "ip:port" of the endpoint that answered the last call */
+  std::string serving() const;
+
+  /* parse "IP:PORT[,IP:PORT]..." */
+  static std::vector<Address> parse_endpoints(const std::string& list);
+
+ private:
+  // virtual nodes per endpoint on the ring
+  static constexpr size_t kVirtualNodes = 64;
+  // endpoints kept connected: the serving one and a standby
+  static constexpr size_t kStarted = 2;
+  // late replies in a row that take an endpoint down
+  static constexpr int kMaxMisses = 3;
+  static constexpr std::chrono::milliseconds kRetryInterval{500};
+  static constexpr std::chrono::milliseconds kProbeInterval{200};
+  // weight of a new latency sample, as for TCP's srtt
+  static constexpr double kEwmaGain = 0.125;
+
+  struct Endpoint {
+    Address address;
+    std::string name;
+    // null while down
+    std::shared_ptr<InferenceClient> client{};
+    double latency_us = 0;
+    int misses = 0;
+    clock::time_point retry_at{};
+  };
+
+  /* connect, true if the endpoint is up afterwards */
+  bool start_endpoint(size_t index);
+  void mark_down(size_t index, const std::string& reason);
+  void record_latency(size_t index, clock::duration latency);
+  void probe();
+
+ private:
+  std::vector<Endpoint> endpoints_;
+  // endpoint indices in the flow's order of preference
+  std::vector<size_t> order_;
+  std::chrono::microseconds deadline_;
+  size_t serving_;
+  int64_t flow_id_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable stop_cv_;
+  bool stopping_;
+  std::thread prober_;
+};
+
+#endif /* INFERENCE_POOL_HH */
@@ -5,6 +5,8 @@
 #include <sys/un.h>
 #include <unistd.h>
 
+#include <cstring>
+
 #include "exception.hh"
 
 using namespace std;
@@ -116,4 +118,69 @@ string::const_iterator IPCSocket::write(const std::string& buffer,
   } while (write_all and (it != buffer.end()));
 
   return it;
-}
\ No newline at end of file
+}
+
+void IPCSocket::send_fds(const string& payload, const vector<int>& fds) {
+  if (payload.empty()) {
+    throw runtime_error("send_fds: fds need at least one byte to ride on");
+  }
+  if (fds.size() > kMaxFds) {
+    throw runtime_error("send_fds: too many fds in one message");
+  }
+  vector<char> control(CMSG_SPACE(sizeof(int) * kMaxFds), 0);
+  iovec iov = {const_cast<char*>(payload.data()), payload.size()};
+  msghdr msg = {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  if (not fds.empty()) {
+    msg.msg_control = control.data();
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+    memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+  }
+
+  /* the fds go with the first sendmsg, the rest of payload is plain data */
+  ssize_t sent = SystemCall("sendmsg", ::sendmsg(fd_num(), &msg, MSG_NOSIGNAL));
+  register_write();
+  if (static_cast<size_t>(sent) < payload.size()) {
+    write(payload.substr(sent));
+  }
+}
+
+string IPCSocket::recv_fds(const size_t length, vector<int>& fds) {
+  string payload(length, 0);
+  vector<char> control(CMSG_SPACE(sizeof(int) * kMaxFds), 0);
+  size_t received = 0;
+  while (received < length) {
+    iovec iov = {&payload[received], length - received};
+    msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+    ssize_t len =
+        SystemCall("recvmsg", ::recvmsg(fd_num(), &msg, MSG_CMSG_CLOEXEC));
+    register_read();
+    if (len == 0) {
+      set_eof();
+      throw runtime_error("recv_fds: peer closed the socket");
+    }
+    if (msg.msg_flags & MSG_CTRUNC) {
+      throw runtime_error("recv_fds: fds were truncated");
+    }
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (cmsg->cmsg_level != SOL_SOCKET or cmsg->cmsg_type != SCM_RIGHTS) {
+        continue;
+      }
+      size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      const int* received_fds = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+      fds.insert(fds.end(), received_fds, received_fds + count);
+    }
+    received += len;
+  }
+  return payload;
+}
@@ -5,6 +5,7 @@
 
 #include <atomic>
 #include <string>
+#include <vector>
 
 #include "file_descriptor.hh"
 
@@ -36,6 +37,14 @@ class IPCSocket : public FileDescriptor {
    * destrctor of FileDescriptor */
   inline void set_disconnected(void) { connected_.store(false); }
 
+  /* send payload with fds attached (SCM_RIGHTS), at most kMaxFds of them */
+  void send_fds(const std::string& payload, const std::vector<int>& fds);
+  /* read exactly length bytes sent by send_fds, appending received fds */
+  std::string recv_fds(const size_t length, std::vector<int>& fds);
+
+  /* the kernel limit on fds per message (SCM_MAX_FD) */
+  static const size_t kMaxFds = 253;
+
   /* override write; add sanity check*/
   virtual std::string::const_iterator write(const std::string& buffer,
                                             const bool write_all = true);
@@ -1,5 +1,7 @@
 #include "serialization.hh"
 
+#include <cstring>
+
 using namespace std;
 
 string put_field( const uint16_t n){
@@ -7,6 +9,11 @@ string put_field( const uint16_t n){
   return string(reinterpret_cast<const char*>(&network_order), sizeof(network_order));
 }
 
+void put_field( const uint16_t n, char * out ){
+  const uint16_t network_order = htobe16(n);
+  memcpy(out, &network_order, sizeof(network_order));
+}
+
 uint16_t get_uint16(const char * data)
 {
   return be16toh(*reinterpret_cast<const uint16_t *>(data));
@@ -5,6 +5,8 @@
 #include <cstdint>
 
 std::string put_field(const uint16_t n);
+/* write the 2-byte header into out, for callers that own the buffer */
+void put_field(const uint16_t n, char * out);
 uint16_t get_uint16(const char * data);
 
 #endif /* SERIALIZATION_HH */
\ No newline at end of file
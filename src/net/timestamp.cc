@@ -40,3 +40,11 @@ uint64_t timestamp( void )
 {
     return usec_to_msec( timestamp_usecs() );
 }
+
+uint64_t monotonic_nsecs( void )
+{
+    timespec ts;
+    SystemCall( "clock_gettime", clock_gettime( CLOCK_MONOTONIC, &ts ) );
+
+    return uint64_t( ts.tv_sec ) * 1000000000 + uint64_t( ts.tv_nsec );
+}
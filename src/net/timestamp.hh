@@ -11,4 +11,7 @@ uint64_t initial_timestamp( void );
 uint64_t timestamp_usecs( void );
 uint64_t initial_timestamp_usecs( void );
 
+/* CLOCK_MONOTONIC in nanoseconds, for measuring intervals */
+uint64_t monotonic_nsecs( void );
+
 #endif /* TIMESTAMP_HH */
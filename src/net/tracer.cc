@@ -0,0 +1,138 @@
+#include "tracer.hh"
+
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+#include "exception.hh"
+
+namespace {
+
+inline long current_tid() { return syscall(SYS_gettid); }
+
+}  // namespace
+
+Tracer::Tracer() : fd_(-1), pid_(getpid()), mutex_(), buffer_() {
+  const char* path = getenv("ASTRAEA_TRACE");
+  if (path != nullptr and path[0] != '\0') {
+    open(path, "");
+  }
+}
+
+Tracer::~Tracer() {
+  if (fd_ >= 0) {
+    flush();
+    ::close(fd_);
+  }
+}
+
+void Tracer::open(const std::string& path, const std::string& process_name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (fd_ >= 0) {
+    flush_locked();
+    ::close(fd_);
+  }
+  // whoever creates the file opens the array
+  fd_ = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_EXCL, 0644);
+  if (fd_ >= 0) {
+    buffer_ += "[\n";
+  } else if (errno == EEXIST) {
+    fd_ = SystemCall("open " + path,
+                     ::open(path.c_str(), O_WRONLY | O_APPEND));
+  } else {
+    throw unix_error("open " + path);
+  }
+  buffer_.reserve(kFlushSize * 2);
+  if (not process_name.empty()) {
+    name_process_locked(process_name);
+  }
+}
+
+void Tracer::set_process_name(const std::string& name) {
+  if (not enabled()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  name_process_locked(name);
+}
+
+void Tracer::name_process_locked(const std::string& name) {
+  char line[256];
+  snprintf(line, sizeof(line),
+           "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+           "\"args\":{\"name\":\"%s-%d\"}},\n",
+           pid_, name.c_str(), pid_);
+  buffer_ += line;
+}
+
+void Tracer::complete(const char* name, int64_t flow_id, uint64_t begin_ns,
+                      uint64_t end_ns, const char* arg_name, int64_t arg) {
+  if (not enabled()) {
+    return;
+  }
+  append(name, 'X', flow_id, begin_ns, end_ns - begin_ns, arg_name, arg);
+}
+
+void Tracer::instant(const char* name, int64_t flow_id, const char* arg_name,
+                     int64_t arg) {
+  if (not enabled()) {
+    return;
+  }
+  append(name, 'i', flow_id, monotonic_nsecs(), 0, arg_name, arg);
+}
+
+void Tracer::append(const char* name, char phase, int64_t flow_id,
+                    uint64_t ts_ns, uint64_t dur_ns, const char* arg_name,
+                    int64_t arg) {
+  // trace viewers take microseconds, keep the nanoseconds as fraction
+  char line[320];
+  int len = snprintf(line, sizeof(line),
+                     "{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%" PRIu64
+                     ".%03" PRIu64 ",\"pid\":%d,\"tid\":%ld",
+                     name, phase, ts_ns / 1000, ts_ns % 1000, pid_,
+                     current_tid());
+  if (phase == 'X') {
+    len += snprintf(line + len, sizeof(line) - len,
+                    ",\"dur\":%" PRIu64 ".%03" PRIu64, dur_ns / 1000,
+                    dur_ns % 1000);
+  } else {
+    len += snprintf(line + len, sizeof(line) - len, ",\"s\":\"t\"");
+  }
+  len += snprintf(line + len, sizeof(line) - len,
+                  ",\"args\":{\"flow_id\":%" PRId64, flow_id);
+  if (arg_name != nullptr) {
+    len += snprintf(line + len, sizeof(line) - len, ",\"%s\":%" PRId64,
+                    arg_name, arg);
+  }
+  snprintf(line + len, sizeof(line) - len, "}},\n");
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  buffer_ += line;
+  if (buffer_.size() >= kFlushSize) {
+    flush_locked();
+  }
+}
+
+void Tracer::flush() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  flush_locked();
+}
+
+void Tracer::flush_locked() {
+  if (fd_ < 0 or buffer_.empty()) {
+    return;
+  }
+  // one write per flush, so lines from other processes land in between
+  // whole events only
+  ssize_t n = ::write(fd_, buffer_.data(), buffer_.size());
+  if (n != ssize_t(buffer_.size())) {
+    std::cerr << "Tracer: short write, " << n << " of " << buffer_.size()
+              << " bytes" << std::endl;
+  }
+  buffer_.clear();
+}
@@ -0,0 +1,97 @@
+#ifndef TRACER_HH
+#define TRACER_HH
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "timestamp.hh"
+
+/**
+ * @brief Opt-in timeline tracer writing Chrome/Perfetto trace JSON.
+ *
+ * Set ASTRAEA_TRACE=<file> (or call open()) in every process of a run and
+ * they all append to that one file. Timestamps come from CLOCK_MONOTONIC,
+ * so events of clients and infer on the same host share one timeline. The
+ * file is a JSON array without the closing bracket, which both chrome://tracing
+ * and ui.perfetto.dev accept.
+ *
+ * Events are buffered and flushed in whole lines with O_APPEND, so writers
+ * from different processes do not interleave within an event.
+ */
+class Tracer {
+ public:
+  static Tracer* Get() {
+    static Tracer tracer;
+    return &tracer;
+  }
+
+  /* start tracing into path, name labels this process in the viewer */
+  void open(const std::string& path, const std::string& process_name);
+  inline bool enabled() const { return fd_ >= 0; }
+  void set_process_name(const std::string& name);
+
+  /* a span of [begin_ns, end_ns), see TraceSpan */
+  void complete(const char* name, int64_t flow_id, uint64_t begin_ns,
+                uint64_t end_ns, const char* arg_name = nullptr,
+                int64_t arg = 0);
+  /* a point in time */
+  void instant(const char* name, int64_t flow_id,
+               const char* arg_name = nullptr, int64_t arg = 0);
+
+  void flush();
+
+ private:
+  Tracer();
+  ~Tracer();
+  Tracer(const Tracer&) = delete;
+  Tracer& operator=(const Tracer&) = delete;
+
+  void append(const char* name, char phase, int64_t flow_id, uint64_t ts_ns,
+              uint64_t dur_ns, const char* arg_name, int64_t arg);
+  void flush_locked();
+  void name_process_locked(const std::string& name);
+
+ private:
+  static const size_t kFlushSize = 64 * 1024;
+
+  int fd_;
+  int pid_;
+  std::mutex mutex_;
+  std::string buffer_;
+};
+
+/* records the lifetime of the scope as one complete event */
+class TraceSpan {
+ public:
+  TraceSpan(const char* name, int64_t flow_id)
+      : name_(name),
+        flow_id_(flow_id),
+        begin_ns_(Tracer::Get()->enabled() ? monotonic_nsecs() : 0),
+        arg_name_(nullptr),
+        arg_(0) {}
+  ~TraceSpan() {
+    if (begin_ns_ != 0) {
+      Tracer::Get()->complete(name_, flow_id_, begin_ns_, monotonic_nsecs(),
+                              arg_name_, arg_);
+    }
+  }
+
+  /* attach one integer argument, e.g. the cwnd that was applied */
+  void set_arg(const char* name, int64_t value) {
+    arg_name_ = name;
+    arg_ = value;
+  }
+
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+
+ private:
+  const char* name_;
+  int64_t flow_id_;
+  uint64_t begin_ns_;
+  const char* arg_name_;
+  int64_t arg_;
+};
+
+#endif  // TRACER_HH
@@ -0,0 +1,128 @@
+/**
+ * @file preload.cc
+ * @brief libastraea_preload: Astraea for an unmodified TCP application.
+ *
+ * LD_PRELOAD=libastraea_preload.so ASTRAEA_PORTS=PORT[,PORT]... APP
+ *
+ * connect(), accept() and accept4() hand every TCP socket whose remote
+ * (connect) or local (accept) port is in ASTRAEA_PORTS to the process's
+ * SocketController, and close() takes it back before the socket goes away.
+ * Without ASTRAEA_PORTS the library does nothing.
+ */
+
+#include <dlfcn.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+
+#include "socket_controller.hh"
+
+namespace {
+
+template <typename Function>
+Function next(const char* name) {
+  return reinterpret_cast<Function>(dlsym(RTLD_NEXT, name));
+}
+
+/* port of an IPv4 or IPv6 address, 0 for any other family */
+uint16_t port_of(const sockaddr* addr) {
+  if (addr == nullptr) {
+    return 0;
+  }
+  switch (addr->sa_family) {
+  case AF_INET:
+    return ntohs(reinterpret_cast<const sockaddr_in*>(addr)->sin_port);
+  case AF_INET6:
+    return ntohs(reinterpret_cast<const sockaddr_in6*>(addr)->sin6_port);
+  default:
+    return 0;
+  }
+}
+
+bool is_stream(int fd) {
+  int type = 0;
+  socklen_t length = sizeof(type);
+  return ::getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &length) == 0 and
+         type == SOCK_STREAM;
+}
+
+/* the controller if fd, a socket with port, is to be controlled */
+SocketController* controller_for(int fd, uint16_t port) {
+  if (SocketController::on_controller_thread()) {
+    return nullptr;
+  }
+  SocketController* controller = SocketController::Get();
+  if (controller == nullptr or port == 0 or !controller->matches(port) or
+      !is_stream(fd)) {
+    return nullptr;
+  }
+  return controller;
+}
+
+void control_accepted(int fd) {
+  if (fd < 0) {
+    return;
+  }
+  int saved_errno = errno;
+  sockaddr_storage local{};
+  socklen_t length = sizeof(local);
+  if (::getsockname(fd, reinterpret_cast<sockaddr*>(&local), &length) == 0) {
+    auto controller =
+        controller_for(fd, port_of(reinterpret_cast<sockaddr*>(&local)));
+    if (controller) {
+      controller->add(fd);
+    }
+  }
+  errno = saved_errno;
+}
+
+}  // namespace
+
+extern "C" {
+
+int connect(int fd, const sockaddr* addr, socklen_t length) {
+  static auto real_connect =
+      next<int (*)(int, const sockaddr*, socklen_t)>("connect");
+  int ret = real_connect(fd, addr, length);
+  // a non-blocking socket is controlled from the handshake on
+  if (ret == 0 or errno == EINPROGRESS) {
+    int saved_errno = errno;
+    auto controller = controller_for(fd, port_of(addr));
+    if (controller) {
+      controller->add(fd);
+    }
+    errno = saved_errno;
+  }
+  return ret;
+}
+
+int accept(int fd, sockaddr* addr, socklen_t* length) {
+  static auto real_accept =
+      next<int (*)(int, sockaddr*, socklen_t*)>("accept");
+  int ret = real_accept(fd, addr, length);
+  control_accepted(ret);
+  return ret;
+}
+
+int accept4(int fd, sockaddr* addr, socklen_t* length, int flags) {
+  static auto real_accept4 =
+      next<int (*)(int, sockaddr*, socklen_t*, int)>("accept4");
+  int ret = real_accept4(fd, addr, length, flags);
+  control_accepted(ret);
+  return ret;
+}
+
+int close(int fd) {
+  static auto real_close = next<int (*)(int)>("close");
+  if (!SocketController::on_controller_thread()) {
+    SocketController* controller = SocketController::Get();
+    if (controller) {
+      controller->remove(fd);
+    }
+  }
+  return real_close(fd);
+}
+
+}  // extern "C"
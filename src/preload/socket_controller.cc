@@ -0,0 +1,331 @@
+#include "socket_controller.hh"
+
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#include "common.hh"
+#include "tcp_info.hh"
+#include "timestamp.hh"
+
+using namespace std;
+using json = nlohmann::json;
+
+namespace {
+
+// message types of infer's protocol
+const int kEnd = 2;
+const int kAlive = 3;
+// tcp_info.tcpi_state of an established connection
+const uint8_t kTcpEstablished = 1;
+// DeepCC mode client_eval_batch enables too
+const int kDeepCCMode = 2;
+const chrono::seconds kReconnectInterval{1};
+
+thread_local bool controller_thread = false;
+
+string env_or(const char* name, const string& fallback) {
+  const char* value = getenv(name);
+  return value and *value ? value : fallback;
+}
+
+}  // namespace
+
+SocketController::Config SocketController::config_from_env() {
+  Config config;
+  string ports = env_or("ASTRAEA_PORTS", "");
+  size_t begin = 0;
+  while (begin < ports.size()) {
+    size_t end = ports.find(',', begin);
+    if (end == string::npos) {
+      end = ports.size();
+    }
+    int port = atoi(ports.substr(begin, end - begin).c_str());
+    if (port > 0 and port < 65536) {
+      config.ports.push_back(static_cast<uint16_t>(port));
+    }
+    begin = end + 1;
+  }
+  config.infer = env_or("ASTRAEA_INFER", config.infer);
+  config.interval = chrono::milliseconds(
+      max(1, atoi(env_or("ASTRAEA_INTERVAL", "20").c_str())));
+  config.congestion_control =
+      env_or("ASTRAEA_CC", config.congestion_control);
+  config.max_backoff =
+      max(1, atoi(env_or("ASTRAEA_MAX_BACKOFF", "4").c_str()));
+  config.engage_bytes = strtoull(env_or("ASTRAEA_ENGAGE_BYTES", "0").c_str(),
+                                 nullptr, 10);
+  config.engage_rtts =
+      max(0.0, atof(env_or("ASTRAEA_ENGAGE_RTTS", "0").c_str()));
+  return config;
+}
+
+atomic<SocketController*> SocketController::instance_{nullptr};
+
+SocketController* SocketController::Get() {
+  static once_flag created;
+  call_once(created, [] {
+    Config config = config_from_env();
+    if (config.ports.empty()) {
+      return;
+    }
+    // never destroyed, sockets may still be closed while the process exits
+    instance_ = new SocketController(config);
+    pthread_atfork(nullptr, nullptr, &SocketController::after_fork);
+  });
+  return instance_;
+}
+
+void SocketController::after_fork() {
+  /* the child has no control thread and maybe a locked mutex, so it starts
+   * over; the parent's sockets stay with the parent */
+  instance_ = new SocketController(instance_.load()->config_);
+}
+
+SocketController::SocketController(const Config& config)
+    : config_(config),
+      infer_(),
+      generator_(random_device()()),
+      mutex_(),
+      registered_(),
+      added_(),
+      running_(false),
+      flows_() {}
+
+bool SocketController::on_controller_thread() { return controller_thread; }
+
+bool SocketController::matches(uint16_t port) const {
+  return find(config_.ports.begin(), config_.ports.end(), port) !=
+         config_.ports.end();
+}
+
+bool SocketController::deferred() const {
+  return config_.engage_bytes > 0 or config_.engage_rtts > 0;
+}
+
+bool SocketController::set_congestion_control(int fd) {
+  const string& cc = config_.congestion_control;
+  if (::setsockopt(fd, IPPROTO_TCP, TCP_CONGESTION, cc.c_str(), cc.size()) <
+      0) {
+    cerr << "astraea_preload: cannot set " << cc << " on fd " << fd << ": "
+         << strerror(errno) << endl;
+    return false;
+  }
+  return true;
+}
+
+void SocketController::add(int fd) {
+  // a deferred socket gets the cc once it engages
+  if (!deferred() and !set_congestion_control(fd)) {
+    return;
+  }
+  auto flow = make_shared<Flow>(fd, timestamp_usecs());
+  lock_guard<mutex> lock(mutex_);
+  registered_[fd] = flow;
+  added_.push_back(flow);
+  if (!running_) {
+    running_ = true;
+    thread(&SocketController::run, this).detach();
+  }
+}
+
+void SocketController::remove(int fd) {
+  shared_ptr<Flow> flow;
+  {
+    lock_guard<mutex> lock(mutex_);
+    auto it = registered_.find(fd);
+    if (it == registered_.end()) {
+      return;
+    }
+    flow = it->second;
+    registered_.erase(it);
+  }
+  // waits for the control thread to be done with the fd
+  lock_guard<mutex> lock(flow->mutex);
+  flow->closed = true;
+}
+
+void SocketController::run() {
+  controller_thread = true;
+  auto deadline = chrono::steady_clock::now() + config_.interval;
+  while (true) {
+    tick(deadline);
+    this_thread::sleep_until(deadline);
+    deadline += config_.interval;
+  }
+}
+
+void SocketController::reconnect() {
+  if (chrono::steady_clock::now() < reconnect_at_) {
+    return;
+  }
+  reconnect_at_ = chrono::steady_clock::now() + kReconnectInterval;
+  auto colon = config_.infer.rfind(':');
+  try {
+    infer_ = make_unique<InferenceClient>(Address(
+        config_.infer.substr(0, colon),
+        static_cast<uint16_t>(stoi(config_.infer.substr(colon + 1)))));
+  } catch (const exception& e) {
+    cerr << "astraea_preload: cannot reach infer at " << config_.infer
+         << ": " << e.what() << endl;
+    infer_.reset();
+  }
+  // the flows keep their ids, a new infer registers them with their ALIVEs
+}
+
+int64_t SocketController::random_flow_id() {
+  int64_t flow_id;
+  do {
+    flow_id = static_cast<int64_t>(generator_() >> 1);
+  } while (flow_id == 0);
+  return flow_id;
+}
+
+json SocketController::read_state(Flow& flow) {
+  TCPDeepCCInfo info;
+  socklen_t length = sizeof(info);
+  if (::getsockopt(flow.fd, IPPROTO_TCP, TCP_DEEPCC_INFO, &info, &length) <
+      0) {
+    return json();
+  }
+  uint64_t now = timestamp_usecs();
+  uint64_t time_delta = max(now - flow.last_request_us, u64(1));
+  flow.last_request_us = now;
+  flow.max_tput = max(flow.max_tput, info.avg_thr);
+  json state = info.to_json();
+  state["max_tput"] = flow.max_tput;
+  // loss ratio in bytes per second
+  state["loss_ratio"] = double(info.lost_bytes) * 1000000 / time_delta;
+  state["time_delta"] = time_delta;
+  return state;
+}
+
+bool SocketController::engaged(Flow& flow, const tcp_info& tcp) {
+  if (!deferred()) {
+    return true;
+  }
+  uint64_t now = timestamp_usecs();
+  // tcpi_rtt is the srtt in us
+  flow.rtts += double(now - flow.last_check_us) / max(tcp.tcpi_rtt, 1u);
+  flow.last_check_us = now;
+  return (config_.engage_bytes > 0 and
+          tcp.tcpi_bytes_acked >= config_.engage_bytes) or
+         (config_.engage_rtts > 0 and flow.rtts >= config_.engage_rtts);
+}
+
+void SocketController::try_start(Flow& flow) {
+  if (flow.failed) {
+    return;
+  }
+  tcp_info tcp;
+  socklen_t length = sizeof(tcp);
+  if (::getsockopt(flow.fd, IPPROTO_TCP, TCP_INFO, &tcp, &length) < 0 or
+      tcp.tcpi_state != kTcpEstablished) {
+    return;
+  }
+  // short transfers end before this and never cost infer anything
+  if (!engaged(flow, tcp)) {
+    return;
+  }
+  if (deferred() and !set_congestion_control(flow.fd)) {
+    flow.failed = true;
+    return;
+  }
+  if (::setsockopt(flow.fd, IPPROTO_TCP, TCP_DEEPCC_ENABLE, &kDeepCCMode,
+                   sizeof(kDeepCCMode)) < 0) {
+    cerr << "astraea_preload: cannot enable DeepCC on fd " << flow.fd << ": "
+         << strerror(errno) << endl;
+    flow.failed = true;
+    return;
+  }
+  flow.enabled = true;
+  flow.flow_id = random_flow_id();
+  flow.last_request_us = timestamp_usecs();
+}
+
+void SocketController::tick(chrono::steady_clock::time_point deadline) {
+  {
+    lock_guard<mutex> lock(mutex_);
+    flows_.insert(flows_.end(), added_.begin(), added_.end());
+    added_.clear();
+  }
+  if (!infer_) {
+    reconnect();
+    if (!infer_) {
+      return;
+    }
+  }
+
+  vector<json> messages;
+  vector<Flow*> asked;
+  for (auto it = flows_.begin(); it != flows_.end();) {
+    Flow& flow = **it;
+    lock_guard<mutex> lock(flow.mutex);
+    if (flow.closed) {
+      if (flow.enabled and infer_) {
+        try {
+          infer_->notify({{"type", kEnd}, {"flow_id", flow.flow_id}});
+        } catch (const exception& e) {
+        }
+      }
+      it = flows_.erase(it);
+      continue;
+    }
+    ++it;
+    if (!flow.enabled) {
+      try_start(flow);
+      if (!flow.enabled) {
+        continue;
+      }
+    }
+    if (flow.backoff_left > 0) {
+      flow.backoff_left--;
+      continue;
+    }
+    json state = read_state(flow);
+    if (state.is_null()) {
+      continue;
+    }
+    messages.push_back(
+        {{"type", kAlive}, {"flow_id", flow.flow_id}, {"state", state}});
+    asked.push_back(&flow);
+  }
+  if (messages.empty() or !infer_) {
+    return;
+  }
+
+  // one write carries the ALIVEs of every socket of the process
+  auto replies = infer_->async_call_all(move(messages));
+  for (size_t i = 0; i < replies.size(); ++i) {
+    // a late reply is dropped, the socket keeps its cwnd until next tick
+    if (replies[i].wait_until(deadline) != future_status::ready) {
+      continue;
+    }
+    Flow& flow = *asked[i];
+    try {
+      json reply = replies[i].get();
+      lock_guard<mutex> lock(flow.mutex);
+      if (flow.closed) {
+        continue;
+      }
+      if (reply.contains("collision")) {
+        // another flow holds the id, the next tick registers a new one
+        flow.flow_id = random_flow_id();
+        continue;
+      }
+      int cwnd = reply.at("cwnd");
+      ::setsockopt(flow.fd, IPPROTO_TCP, TCP_CWND, &cwnd, sizeof(cwnd));
+      flow.backoff_left =
+          clamp(reply.value("backoff", 1), 1, config_.max_backoff) - 1;
+    } catch (const exception& e) {
+      // the connection broke, the next one registers the flows again
+      infer_.reset();
+      return;
+    }
+  }
+}
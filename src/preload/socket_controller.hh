@@ -0,0 +1,123 @@
+#ifndef SOCKET_CONTROLLER_HH
+#define SOCKET_CONTROLLER_HH
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "address.hh"
+#include "inference_client.hh"
+#include "json.hpp"
+#include "tcp_info.hh"
+
+/**
+ * @brief The one control thread of a process under libastraea_preload.
+ *
+ * The shim hands over every socket it matched. Each tick, the thread reads
+ * the DeepCC info of all of them, sends their ALIVEs to infer in a single
+ * write over one TCP connection, and applies the cwnds that come back
+ * before the next tick. DeepCC gets enabled on a socket at the first tick
+ * it is established, as the kernel wants that after the handshake; the
+ * socket then draws a random flow id that infer registers with its first
+ * ALIVE. It is ended (END) once the application closes it.
+ */
+class SocketController {
+ public:
+  struct Config {
+    // local or remote ports whose sockets are controlled
+    std::vector<uint16_t> ports{};
+    std::string infer = "127.0.0.1:8888";
+    std::chrono::milliseconds interval{20};
+    std::string congestion_control = "astraea";
+    // most "backoff" honoured, see --target-load of infer
+    int max_backoff = 4;
+    // a socket keeps the kernel's default cc until this many bytes were
+    // acked or RTTs passed, whichever comes first; 0 and 0 engage at once
+    uint64_t engage_bytes = 0;
+    double engage_rtts = 0;
+  };
+
+  /* ASTRAEA_PORTS, ASTRAEA_INFER, ASTRAEA_INTERVAL, ASTRAEA_CC,
+   * ASTRAEA_MAX_BACKOFF, ASTRAEA_ENGAGE_BYTES and ASTRAEA_ENGAGE_RTTS */
+  static Config config_from_env();
+
+  /* the process's controller, null if ASTRAEA_PORTS selects no port */
+  static SocketController* Get();
+
+  bool matches(uint16_t port) const;
+
+  /* control fd from now on, it may still be connecting */
+  void add(int fd);
+  /* stop controlling fd, before the application closes it */
+  void remove(int fd);
+
+  /* true on the controller's own thread, whose sockets are never matched */
+  static bool on_controller_thread();
+
+ private:
+  explicit SocketController(const Config& config);
+  static void after_fork();
+
+  struct Flow {
+    int fd;
+    // set by remove(), under mutex, so that the fd is not used afterwards
+    std::mutex mutex{};
+    bool closed = false;
+
+    // owned by the control thread
+    bool enabled = false;
+    // RTTs counted towards engage_rtts until then
+    double rtts = 0;
+    uint64_t last_check_us;
+    // DeepCC could not be enabled, the kernel's cc keeps the socket
+    bool failed = false;
+    // 0 until DeepCC is enabled
+    int64_t flow_id = 0;
+    uint64_t max_tput = 0;
+    uint64_t last_request_us = 0;
+    int backoff_left = 0;
+
+    explicit Flow(int fd_, uint64_t now_us) : fd(fd_), last_check_us(now_us) {}
+  };
+
+  void run();
+  void tick(std::chrono::steady_clock::time_point deadline);
+  /* the ALIVE state of flow, as DeepCCSocket::get_tcp_deepcc_info_json()
+   * builds it; null if the socket has no DeepCC info */
+  nlohmann::json read_state(Flow& flow);
+  bool deferred() const;
+  bool set_congestion_control(int fd);
+  /* whether an established socket passed engage_bytes or engage_rtts */
+  bool engaged(Flow& flow, const tcp_info& tcp);
+  /* enable DeepCC and draw a flow id once the socket is established and
+   * engaged */
+  void try_start(Flow& flow);
+  /* a positive id no other flow is likely to have */
+  int64_t random_flow_id();
+  void reconnect();
+
+ private:
+  static std::atomic<SocketController*> instance_;
+
+  Config config_;
+  std::unique_ptr<InferenceClient> infer_;
+  std::chrono::steady_clock::time_point reconnect_at_{};
+  std::mt19937_64 generator_;
+
+  // sockets registered by the application's threads
+  std::mutex mutex_;
+  std::unordered_map<int, std::shared_ptr<Flow>> registered_;
+  // registered since the last tick
+  std::vector<std::shared_ptr<Flow>> added_;
+  bool running_;
+  // the control thread's copy
+  std::vector<std::shared_ptr<Flow>> flows_;
+};
+
+#endif  // SOCKET_CONTROLLER_HH
@@ -0,0 +1,98 @@
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+
+#include <cstring>
+#include <stdexcept>
+
+#include "simulator.hh"
+
+namespace py = pybind11;
+
+namespace {
+
+using FloatArray =
+    py::array_t<float, py::array::c_style | py::array::forcecast>;
+
+/* copy one output buffer of the VectorEnv into a fresh numpy array */
+template <typename T>
+py::array_t<T> to_array(const std::vector<T>& data,
+                        std::vector<py::ssize_t> shape) {
+  py::array_t<T> out(shape);
+  std::memcpy(out.mutable_data(), data.data(), data.size() * sizeof(T));
+  return out;
+}
+
+py::tuple observation(const VectorEnv& env) {
+  const py::ssize_t m = env.num_envs();
+  const py::ssize_t f = env.num_flows();
+  return py::make_tuple(
+      to_array(env.states(), {m, f, py::ssize_t(kNNInputSize)}),
+      to_array(env.global_states(), {m, f, py::ssize_t(kGlobalStateSize)}),
+      to_array(env.rewards(), {m, f}), to_array(env.cwnds(), {m, f}),
+      to_array(env.dones(), {m}).attr("astype")("bool"));
+}
+
+}  // namespace
+
+PYBIND11_MODULE(astraea_sim, m) {
+  m.doc() = "Vectorised multi-flow congestion environment for Astraea";
+  m.attr("STATE_SIZE") = kStateSize;
+  m.attr("NN_INPUT_SIZE") = kNNInputSize;
+  m.attr("GLOBAL_STATE_SIZE") = kGlobalStateSize;
+
+  py::class_<EnvConfig>(m, "EnvConfig")
+      .def(py::init<>())
+      .def_readwrite("num_links", &EnvConfig::num_links)
+      .def_readwrite("flows_per_link", &EnvConfig::flows_per_link)
+      .def_readwrite("min_bandwidth_mbps", &EnvConfig::min_bandwidth_mbps)
+      .def_readwrite("max_bandwidth_mbps", &EnvConfig::max_bandwidth_mbps)
+      .def_readwrite("min_rtt_ms", &EnvConfig::min_rtt_ms)
+      .def_readwrite("max_rtt_ms", &EnvConfig::max_rtt_ms)
+      .def_readwrite("min_buffer_bdp", &EnvConfig::min_buffer_bdp)
+      .def_readwrite("max_buffer_bdp", &EnvConfig::max_buffer_bdp)
+      .def_readwrite("control_interval_ms", &EnvConfig::control_interval_ms)
+      .def_readwrite("sim_tick_ms", &EnvConfig::sim_tick_ms)
+      .def_readwrite("mss", &EnvConfig::mss)
+      .def_readwrite("init_cwnd", &EnvConfig::init_cwnd)
+      .def_readwrite("min_cwnd", &EnvConfig::min_cwnd)
+      .def_readwrite("max_cwnd", &EnvConfig::max_cwnd)
+      .def_readwrite("max_steps", &EnvConfig::max_steps)
+      .def_readwrite("delay_weight", &EnvConfig::delay_weight)
+      .def_readwrite("loss_weight", &EnvConfig::loss_weight)
+      .def_readwrite("fairness_weight", &EnvConfig::fairness_weight);
+
+  py::class_<VectorEnv>(m, "VectorEnv")
+      .def(py::init<size_t, const EnvConfig&, size_t, uint64_t>(),
+           py::arg("num_envs"), py::arg("config") = EnvConfig(),
+           py::arg("num_threads") = 1, py::arg("seed") = 0)
+      .def_property_readonly("num_envs", &VectorEnv::num_envs)
+      .def_property_readonly("num_flows", &VectorEnv::num_flows)
+      .def(
+          "reset",
+          [](VectorEnv& env) {
+            {
+              py::gil_scoped_release release;
+              env.reset();
+            }
+            return observation(env);
+          },
+          "Restart every environment, returns (states, global_states, "
+          "rewards, cwnds, dones)")
+      .def(
+          "step",
+          [](VectorEnv& env, FloatArray actions) {
+            if (actions.size() !=
+                py::ssize_t(env.num_envs() * env.num_flows())) {
+              throw std::invalid_argument(
+                  "VectorEnv.step: expect one action per flow");
+            }
+            {
+              py::gil_scoped_release release;
+              env.step(actions.data());
+            }
+            return observation(env);
+          },
+          py::arg("actions"),
+          "Apply actions of shape [num_envs, num_flows], returns (states, "
+          "global_states, rewards, cwnds, dones)");
+}
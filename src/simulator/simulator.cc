@@ -0,0 +1,353 @@
+#include "simulator.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+SimFlow::SimFlow(uint32_t init_cwnd)
+    : cwnd_(init_cwnd),
+      min_rtt_us_(std::numeric_limits<double>::max()),
+      srtt_us_(0),
+      max_tput_(0),
+      loss_ratio_(0),
+      last_avg_rtt_us_(0),
+      last_thr_(0),
+      rtt_sum_us_(0),
+      rtt_cnt_(0),
+      delivered_bytes_(0),
+      lost_bytes_(0),
+      elapsed_us_(0),
+      window_() {}
+
+void SimFlow::on_tick(double dt_us, double rtt_us, double delivered,
+                      double lost) {
+  min_rtt_us_ = std::min(min_rtt_us_, rtt_us);
+  // srtt_us is kept << 3 as in the kernel
+  srtt_us_ = srtt_us_ == 0 ? rtt_us * 8 : srtt_us_ * 7 / 8 + rtt_us;
+  rtt_sum_us_ += rtt_us;
+  rtt_cnt_++;
+  delivered_bytes_ += delivered;
+  lost_bytes_ += lost;
+  elapsed_us_ += dt_us;
+}
+
+void SimFlow::report(uint32_t mss, TCPDeepCCInfo& info) {
+  info.init();
+  double interval_us = std::max(elapsed_us_, 1.0);
+  info.min_rtt = rtt_cnt_ ? min_rtt_us_ : 0;
+  info.avg_urtt = rtt_cnt_ ? rtt_sum_us_ / rtt_cnt_ : 0;
+  info.cnt = rtt_cnt_;
+  info.avg_thr = delivered_bytes_ * 1e6 / interval_us;
+  info.thr_cnt = rtt_cnt_;
+  info.cwnd = cwnd_;
+  info.srtt_us = srtt_us_;
+  info.snd_ssthresh = cwnd_;
+  info.packets_out = cwnd_;
+  info.lost_bytes = lost_bytes_;
+  info.retrans_out =
+      std::min<double>(cwnd_, std::ceil(lost_bytes_ / std::max(mss, 1u)));
+  info.max_packets_out = cwnd_;
+  info.mss = mss;
+  // astraea paces at cwnd * mtu / srtt, see astraea_update_pacing_rate()
+  if (srtt_us_ >= 8) {
+    info.pacing_rate = std::min<double>(
+        std::numeric_limits<u32>::max(), double(mss) * 1e6 * cwnd_ / (srtt_us_ / 8));
+  }
+
+  max_tput_ = std::max(max_tput_, info.avg_thr);
+  // same definition as DeepCCSocket::get_tcp_deepcc_info_json()
+  loss_ratio_ = lost_bytes_ * 1e6 / interval_us;
+  last_avg_rtt_us_ = info.avg_urtt;
+  last_thr_ = info.avg_thr;
+
+  rtt_sum_us_ = 0;
+  rtt_cnt_ = 0;
+  delivered_bytes_ = 0;
+  lost_bytes_ = 0;
+  elapsed_us_ = 0;
+}
+
+void SimFlow::push_state(const DeepCCState& state) {
+  std::memmove(window_.data(), window_.data() + kStateSize,
+               (kNNInputSize - kStateSize) * sizeof(float));
+  transform_state(state, window_.data() + kNNInputSize - kStateSize);
+}
+
+SimLink::SimLink(double bandwidth_mbps, double rtt_ms, double buffer_bdp,
+                 size_t num_flows, uint32_t init_cwnd, uint32_t mss)
+    : bandwidth_Bps_(bandwidth_mbps * 1e6 / 8),
+      base_rtt_us_(rtt_ms * 1e3),
+      buffer_bytes_(0),
+      queue_bytes_(0),
+      mss_(mss),
+      flows_(num_flows, SimFlow(init_cwnd)) {
+  buffer_bytes_ =
+      std::max(buffer_bdp * bandwidth_Bps_ * base_rtt_us_ / 1e6, double(mss));
+}
+
+void SimLink::advance(double dt_s) {
+  double rtt_us = base_rtt_us_ + queue_bytes_ / bandwidth_Bps_ * 1e6;
+  double arrivals = 0;
+  for (auto& flow : flows_) {
+    arrivals += double(flow.cwnd()) * mss_ / (rtt_us / 1e6) * dt_s;
+  }
+  double backlog = queue_bytes_ + arrivals;
+  double served = std::min(backlog, bandwidth_Bps_ * dt_s);
+  queue_bytes_ = backlog - served;
+  double dropped = std::max(queue_bytes_ - buffer_bytes_, 0.0);
+  queue_bytes_ -= dropped;
+  // in steady state a FIFO serves and drops in proportion to the arrivals
+  for (auto& flow : flows_) {
+    double sent = double(flow.cwnd()) * mss_ / (rtt_us / 1e6) * dt_s;
+    double share = arrivals > 0 ? sent / arrivals : 0;
+    flow.on_tick(dt_s * 1e6, rtt_us, served * share, dropped * share);
+  }
+}
+
+CongestionEnv::CongestionEnv(const EnvConfig& config, uint64_t seed)
+    : config_(config), rng_(seed), links_(), steps_(0) {
+  if (config_.num_links == 0 or config_.flows_per_link == 0) {
+    throw std::runtime_error("CongestionEnv: no flow to simulate");
+  }
+  if (config_.sim_tick_ms <= 0 or
+      config_.control_interval_ms < config_.sim_tick_ms) {
+    throw std::runtime_error("CongestionEnv: invalid time resolution");
+  }
+}
+
+void CongestionEnv::reset(float* states, float* global, float* cwnds) {
+  auto uniform = [this](double lo, double hi) {
+    return std::uniform_real_distribution<double>(lo, hi)(rng_);
+  };
+  links_.clear();
+  for (size_t i = 0; i < config_.num_links; ++i) {
+    links_.emplace_back(
+        uniform(config_.min_bandwidth_mbps, config_.max_bandwidth_mbps),
+        uniform(config_.min_rtt_ms, config_.max_rtt_ms),
+        uniform(config_.min_buffer_bdp, config_.max_buffer_bdp),
+        config_.flows_per_link, config_.init_cwnd, config_.mss);
+  }
+  steps_ = 0;
+  // one interval at the initial window so that the first states carry
+  // measurements
+  std::vector<float> rewards(num_flows());
+  simulate_interval();
+  observe(states, global, rewards.data(), cwnds);
+}
+
+void CongestionEnv::simulate_interval() {
+  const size_t ticks =
+      std::lround(config_.control_interval_ms / config_.sim_tick_ms);
+  for (auto& link : links_) {
+    for (size_t t = 0; t < ticks; ++t) {
+      link.advance(config_.sim_tick_ms / 1e3);
+    }
+  }
+}
+
+bool CongestionEnv::step(const float* actions, float* states, float* global,
+                         float* rewards, float* cwnds) {
+  size_t idx = 0;
+  for (auto& link : links_) {
+    for (auto& flow : link.flows()) {
+      float action = std::max(-1.0f, std::min(1.0f, actions[idx++]));
+      int64_t cwnd = map_action(action, flow.cwnd());
+      cwnd = std::max<int64_t>(cwnd, config_.min_cwnd);
+      cwnd = std::min<int64_t>(cwnd, config_.max_cwnd);
+      flow.set_cwnd(cwnd);
+    }
+  }
+  simulate_interval();
+  observe(states, global, rewards, cwnds);
+
+  if (++steps_ < config_.max_steps) {
+    return false;
+  }
+  reset(states, global, cwnds);
+  return true;
+}
+
+void CongestionEnv::observe(float* states, float* global, float* rewards,
+                            float* cwnds) {
+  size_t idx = 0;
+  for (auto& link : links_) {
+    auto& flows = link.flows();
+    const size_t first = idx;
+    double thr_sum = 0, thr_sq_sum = 0;
+    double min_thr = std::numeric_limits<double>::max(), max_thr = 0;
+    double lat_sum = 0, loss_sum = 0;
+    double min_win = std::numeric_limits<double>::max(), max_win = 0;
+    double win_sum = 0;
+    for (auto& flow : flows) {
+      TCPDeepCCInfo info;
+      flow.report(config_.mss, info);
+      flow.push_state(
+          make_deepcc_state(info, flow.max_tput(), flow.loss_ratio()));
+      std::memcpy(states + idx * kNNInputSize, flow.window().data(),
+                  kNNInputSize * sizeof(float));
+      cwnds[idx] = flow.cwnd();
+
+      double thr = info.avg_thr / 5e7;
+      thr_sum += thr;
+      thr_sq_sum += thr * thr;
+      min_thr = std::min(min_thr, thr);
+      max_thr = std::max(max_thr, thr);
+      lat_sum += info.avg_urtt / 5e5;
+      loss_sum += flow.loss_ratio() / 1e6;
+      min_win = std::min(min_win, info.cwnd / 1000.0);
+      max_win = std::max(max_win, info.cwnd / 1000.0);
+      win_sum += info.cwnd / 1000.0;
+      idx++;
+    }
+    const double n = flows.size();
+    const float link_global[kGlobalStateSize] = {
+        float(thr_sum),
+        float(min_thr),
+        float(max_thr),
+        float(lat_sum / n),
+        float(min_win),
+        float(max_win),
+        float(win_sum / n),
+        float(loss_sum / n),
+        float(n / 10),
+        float(link.base_rtt_us() / 2 / 1e3 / 500.0),
+        float(link.bdp_mbit() / 10),
+        float(link.bandwidth_mbps() / 500),
+    };
+    const double jain =
+        thr_sq_sum > 0 ? thr_sum * thr_sum / (n * thr_sq_sum) : 0;
+    const double capacity_Bps = link.bandwidth_mbps() * 1e6 / 8;
+    for (size_t i = first; i < idx; ++i) {
+      auto& flow = flows[i - first];
+      std::memcpy(global + i * kGlobalStateSize, link_global,
+                  sizeof(link_global));
+      double queueing = flow.avg_rtt_us() > 0
+                            ? (flow.avg_rtt_us() - link.base_rtt_us()) /
+                                  link.base_rtt_us()
+                            : 0;
+      double loss = flow.loss_ratio() / std::max(flow.throughput() +
+                                                     flow.loss_ratio(),
+                                                 1.0);
+      rewards[i] = flow.throughput() / capacity_Bps * n -
+                   config_.delay_weight * std::max(queueing, 0.0) -
+                   config_.loss_weight * loss +
+                   config_.fairness_weight * jain;
+    }
+  }
+}
+
+VectorEnv::VectorEnv(size_t num_envs, const EnvConfig& config,
+                     size_t num_threads, uint64_t seed)
+    : envs_(),
+      states_(),
+      global_(),
+      rewards_(),
+      cwnds_(),
+      dones_(),
+      actions_(nullptr),
+      reset_(false),
+      num_threads_(1),
+      workers_(),
+      mutex_(),
+      work_cv_(),
+      done_cv_(),
+      generation_(0),
+      pending_(0),
+      stop_(false) {
+  if (num_envs == 0) {
+    throw std::runtime_error("VectorEnv: at least one environment is needed");
+  }
+  std::seed_seq seq{seed};
+  std::vector<uint64_t> seeds(num_envs);
+  seq.generate(seeds.begin(), seeds.end());
+  for (size_t i = 0; i < num_envs; ++i) {
+    envs_.emplace_back(config, seeds[i]);
+  }
+  const size_t flows = num_envs * num_flows();
+  states_.resize(flows * kNNInputSize);
+  global_.resize(flows * kGlobalStateSize);
+  rewards_.resize(flows);
+  cwnds_.resize(flows);
+  dones_.resize(num_envs);
+
+  num_threads_ = std::max<size_t>(1, std::min(num_threads, num_envs));
+  for (size_t i = 1; i < num_threads_; ++i) {
+    workers_.emplace_back(&VectorEnv::worker, this, i);
+  }
+}
+
+VectorEnv::~VectorEnv() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  work_cv_.notify_all();
+  for (auto& t : workers_) {
+    t.join();
+  }
+}
+
+void VectorEnv::reset() { run_parallel(true); }
+
+void VectorEnv::step(const float* actions) {
+  actions_ = actions;
+  run_parallel(false);
+}
+
+void VectorEnv::run_env(size_t i, bool reset) {
+  const size_t flows = num_flows();
+  float* states = &states_[i * flows * kNNInputSize];
+  float* global = &global_[i * flows * kGlobalStateSize];
+  if (reset) {
+    envs_[i].reset(states, global, &cwnds_[i * flows]);
+    std::fill_n(&rewards_[i * flows], flows, 0);
+    dones_[i] = 0;
+  } else {
+    dones_[i] = envs_[i].step(actions_ + i * flows, states, global,
+                              &rewards_[i * flows], &cwnds_[i * flows]);
+  }
+}
+
+void VectorEnv::run_parallel(bool reset) {
+  const size_t stride = num_threads_;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    reset_ = reset;
+    pending_ = num_threads_ - 1;
+    generation_++;
+  }
+  work_cv_.notify_all();
+  // the calling thread takes its share as worker 0
+  for (size_t i = 0; i < envs_.size(); i += stride) {
+    run_env(i, reset);
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_cv_.wait(lock, [this] { return pending_ == 0; });
+}
+
+void VectorEnv::worker(size_t id) {
+  const size_t stride = num_threads_;
+  uint64_t seen = 0;
+  while (true) {
+    bool reset;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      work_cv_.wait(lock, [&] { return stop_ or generation_ != seen; });
+      if (stop_) {
+        return;
+      }
+      seen = generation_;
+      reset = reset_;
+    }
+    for (size_t i = id; i < envs_.size(); i += stride) {
+      run_env(i, reset);
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      pending_--;
+    }
+    done_cv_.notify_one();
+  }
+}
@@ -0,0 +1,199 @@
+#ifndef SIMULATOR_HH
+#define SIMULATOR_HH
+
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "feature.hh"
+#include "tcp_info.hh"
+
+/* same layout as the global state of python/agent/definitions.py */
+const size_t kGlobalStateSize = 12;
+
+struct EnvConfig {
+  size_t num_links = 1;
+  size_t flows_per_link = 2;
+  /* link parameters are drawn uniformly from these ranges on every reset */
+  double min_bandwidth_mbps = 10;
+  double max_bandwidth_mbps = 100;
+  double min_rtt_ms = 10;
+  double max_rtt_ms = 100;
+  /* bottleneck buffer in multiples of the BDP */
+  double min_buffer_bdp = 0.5;
+  double max_buffer_bdp = 4;
+  double control_interval_ms = 20;
+  /* resolution of the fluid queue model */
+  double sim_tick_ms = 1;
+  uint32_t mss = 1460;
+  uint32_t init_cwnd = 10;
+  uint32_t min_cwnd = 4;
+  uint32_t max_cwnd = 50000;
+  /* steps per episode */
+  size_t max_steps = 1000;
+  /* reward = thr - delay_weight * queueing - loss_weight * loss
+   *          + fairness_weight * jain_index */
+  double delay_weight = 0.5;
+  double loss_weight = 1.0;
+  double fairness_weight = 0.2;
+};
+
+/**
+ * @brief One window-limited flow. Its per-step statistics are summarised into
+ * a TCPDeepCCInfo, the same record the kernel hands to DeepCCSocket.
+ */
+class SimFlow {
+ public:
+  explicit SimFlow(uint32_t init_cwnd);
+
+  uint32_t cwnd() const { return cwnd_; }
+  void set_cwnd(uint32_t cwnd) { cwnd_ = cwnd; }
+
+  /* account for one fluid tick of dt_us */
+  void on_tick(double dt_us, double rtt_us, double delivered, double lost);
+
+  /* close a control interval: kernel-style report plus socket statistics */
+  void report(uint32_t mss, TCPDeepCCInfo& info);
+  uint64_t max_tput() const { return max_tput_; }
+  double loss_ratio() const { return loss_ratio_; }
+  double avg_rtt_us() const { return last_avg_rtt_us_; }
+  double throughput() const { return last_thr_; }
+
+  /* sliding window of features, exactly like FlowContext::format_state */
+  void push_state(const DeepCCState& state);
+  const std::array<float, kNNInputSize>& window() const { return window_; }
+
+ private:
+  uint32_t cwnd_;
+  double min_rtt_us_;
+  double srtt_us_;
+  uint64_t max_tput_;
+  double loss_ratio_;
+  double last_avg_rtt_us_;
+  double last_thr_;
+  /* accumulated over the current control interval */
+  double rtt_sum_us_;
+  uint32_t rtt_cnt_;
+  double delivered_bytes_;
+  double lost_bytes_;
+  double elapsed_us_;
+  std::array<float, kNNInputSize> window_;
+};
+
+/* a bottleneck link shared by its flows, modelled as a fluid FIFO queue */
+class SimLink {
+ public:
+  SimLink(double bandwidth_mbps, double rtt_ms, double buffer_bdp,
+          size_t num_flows, uint32_t init_cwnd, uint32_t mss);
+
+  void advance(double dt_s);
+
+  std::vector<SimFlow>& flows() { return flows_; }
+  double bandwidth_mbps() const { return bandwidth_Bps_ * 8 / 1e6; }
+  double base_rtt_us() const { return base_rtt_us_; }
+  double bdp_mbit() const { return bandwidth_Bps_ * 8 * base_rtt_us_ / 1e12; }
+
+ private:
+  double bandwidth_Bps_;
+  double base_rtt_us_;
+  double buffer_bytes_;
+  double queue_bytes_;
+  uint32_t mss_;
+  std::vector<SimFlow> flows_;
+};
+
+class CongestionEnv {
+ public:
+  CongestionEnv(const EnvConfig& config, uint64_t seed);
+
+  size_t num_flows() const {
+    return config_.num_links * config_.flows_per_link;
+  }
+
+  /**
+   * @brief Draw new links and restart every flow.
+   *
+   * @param states [num_flows x kNNInputSize] actor inputs
+   * @param global [num_flows x kGlobalStateSize] global state of each flow's
+   * bottleneck
+   * @param cwnds [num_flows] the initial windows
+   */
+  void reset(float* states, float* global, float* cwnds);
+
+  /**
+   * @brief Apply one action per flow and simulate one control interval.
+   *
+   * The episode restarts by itself once it is done; the returned states and
+   * cwnds are then the first ones of the new episode.
+   *
+   * @return true if this step ended the episode
+   */
+  bool step(const float* actions, float* states, float* global,
+            float* rewards, float* cwnds);
+
+ private:
+  void simulate_interval();
+  void observe(float* states, float* global, float* rewards, float* cwnds);
+
+ private:
+  EnvConfig config_;
+  std::mt19937_64 rng_;
+  std::vector<SimLink> links_;
+  size_t steps_;
+};
+
+/* many environments stepped in parallel by a fixed pool of worker threads */
+class VectorEnv {
+ public:
+  VectorEnv(size_t num_envs, const EnvConfig& config, size_t num_threads,
+            uint64_t seed);
+  ~VectorEnv();
+
+  VectorEnv(const VectorEnv&) = delete;
+  VectorEnv& operator=(const VectorEnv&) = delete;
+
+  void reset();
+  /* actions is [num_envs x num_flows] */
+  void step(const float* actions);
+
+  size_t num_envs() const { return envs_.size(); }
+  size_t num_flows() const { return envs_.front().num_flows(); }
+
+  /* outputs of the last reset() or step() */
+  const std::vector<float>& states() const { return states_; }
+  const std::vector<float>& global_states() const { return global_; }
+  const std::vector<float>& rewards() const { return rewards_; }
+  const std::vector<float>& cwnds() const { return cwnds_; }
+  const std::vector<uint8_t>& dones() const { return dones_; }
+
+ private:
+  void run_parallel(bool reset);
+  void worker(size_t id);
+  void run_env(size_t i, bool reset);
+
+ private:
+  std::vector<CongestionEnv> envs_;
+  std::vector<float> states_;
+  std::vector<float> global_;
+  std::vector<float> rewards_;
+  std::vector<float> cwnds_;
+  std::vector<uint8_t> dones_;
+  const float* actions_;
+  bool reset_;
+  /* number of threads stepping environments, the caller included */
+  size_t num_threads_;
+
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  uint64_t generation_;
+  size_t pending_;
+  bool stop_;
+};
+
+#endif  // SIMULATOR_HH
@@ -0,0 +1,24 @@
+"""Checks of the astraea_sim bindings, run by ctest with the module built."""
+
+import numpy as np
+
+import astraea_sim
+
+
+def test_reset_cwnds():
+    config = astraea_sim.EnvConfig()
+    config.init_cwnd = 10
+    env = astraea_sim.VectorEnv(2, config)
+    env.reset()
+    actions = np.ones((env.num_envs, env.num_flows), dtype=np.float32)
+    for _ in range(3):
+        env.step(actions)
+    # reset must not hand back the cwnds of the previous episode
+    _, _, _, cwnds, _ = env.reset()
+    assert cwnds.shape == (env.num_envs, env.num_flows)
+    assert np.all(cwnds == config.init_cwnd), cwnds
+
+
+if __name__ == "__main__":
+    test_reset_cwnds()
+    print("astraea_sim: ok")